@@ -0,0 +1,152 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include "batch.h"
+#include "bunyan.h"
+#include "util.h"
+
+
+batcher_t *
+batcher_create(unsigned int window_ms, unsigned int max, batch_send_t send,
+		void *arg)
+{
+	batcher_t *batcher = NULL;
+
+	if (send == NULL || max == 0) {
+		bunyan_debug("batcher_create: NULL arguments", BUNYAN_NONE);
+		return (NULL);
+	}
+
+	batcher = xmalloc(sizeof (batcher_t));
+	if (batcher == NULL)
+		return (NULL);
+
+	(void) pthread_mutex_init(&batcher->lock, NULL);
+	(void) pthread_cond_init(&batcher->full_cv, NULL);
+	(void) pthread_cond_init(&batcher->done_cv, NULL);
+	batcher->window_ms = window_ms;
+	batcher->max = max;
+	batcher->send = send;
+	batcher->arg = arg;
+
+	return (batcher);
+}
+
+
+void
+batcher_destroy(batcher_t *batcher)
+{
+	if (batcher != NULL) {
+		(void) pthread_cond_destroy(&batcher->done_cv);
+		(void) pthread_cond_destroy(&batcher->full_cv);
+		(void) pthread_mutex_destroy(&batcher->lock);
+		xfree(batcher);
+	}
+}
+
+
+int
+batcher_submit(batcher_t *batcher, batch_item_t *item, hrtime_t deadline)
+{
+	batch_item_t *batch = NULL;
+	batch_item_t *next = NULL;
+	unsigned int count;
+	hrtime_t batch_deadline;
+	hrtime_t window;
+	struct timespec ts;
+
+	if (batcher == NULL || item == NULL) {
+		bunyan_debug("batcher_submit: NULL arguments", BUNYAN_NONE);
+		return (BATCH_FALLBACK);
+	}
+
+	item->result = BATCH_FALLBACK;
+	item->done = B_FALSE;
+	item->next = NULL;
+
+	(void) pthread_mutex_lock(&batcher->lock);
+	if (batcher->tail == NULL)
+		batcher->head = item;
+	else
+		batcher->tail->next = item;
+	batcher->tail = item;
+	batcher->count++;
+	if (deadline != 0 &&
+	    (batcher->deadline == 0 || deadline < batcher->deadline))
+		batcher->deadline = deadline;
+
+	if (batcher->collecting) {
+		if (batcher->count >= batcher->max)
+			(void) pthread_cond_signal(&batcher->full_cv);
+		while (!item->done)
+			(void) pthread_cond_wait(&batcher->done_cv,
+			    &batcher->lock);
+		(void) pthread_mutex_unlock(&batcher->lock);
+		return (item->result);
+	}
+
+	/*
+	 * Nobody is collecting, so this batch is ours to lead.  If the last
+	 * leader had nobody join, traffic is too thin to batch, so only wait
+	 * long enough to notice if that has changed.
+	 */
+	batcher->collecting = B_TRUE;
+	window = (hrtime_t)batcher->window_ms * 1000000LL;
+	if (batcher->lone)
+		window = MIN(window, BATCH_LONE_WINDOW_US * 1000LL);
+	(void) clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += window / 1000000000LL;
+	ts.tv_nsec += (long)(window % 1000000000LL);
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	while (batcher->count < batcher->max &&
+	    pthread_cond_timedwait(&batcher->full_cv, &batcher->lock,
+	    &ts) != ETIMEDOUT)
+		continue;
+
+	batch = batcher->head;
+	count = batcher->count;
+	batcher->lone = (count == 1);
+	batch_deadline = batcher->deadline;
+	batcher->head = NULL;
+	batcher->tail = NULL;
+	batcher->count = 0;
+	batcher->deadline = 0;
+	batcher->collecting = B_FALSE;
+	(void) pthread_mutex_unlock(&batcher->lock);
+
+	/* A batch of one is just a single request with extra steps */
+	if (count > 1) {
+		bunyan_trace("batcher_submit: sending batch",
+		    BUNYAN_INT32, "count", count,
+		    BUNYAN_NONE);
+		batcher->send(batcher->arg, batch, count, batch_deadline);
+	}
+
+	/*
+	 * Followers' items live on their stacks, so don't touch one again
+	 * once it's marked done and the lock is dropped.
+	 */
+	(void) pthread_mutex_lock(&batcher->lock);
+	for (; batch != NULL; batch = next) {
+		next = batch->next;
+		batch->done = B_TRUE;
+	}
+	(void) pthread_cond_broadcast(&batcher->done_cv);
+	(void) pthread_mutex_unlock(&batcher->lock);
+
+	return (item->result);
+}
@@ -0,0 +1,115 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef BATCH_H_
+#define	BATCH_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Result meaning "the batch couldn't answer this; do it yourself" */
+#define	BATCH_FALLBACK	(-1)
+
+/* How long a leader waits for company after the last one had none */
+#define	BATCH_LONE_WINDOW_US	500
+
+/**
+ * One lookup waiting in a batch.  Owned by the submitting thread (it lives
+ * on that thread's stack); the sender only fills in result.
+ */
+typedef struct batch_item {
+	const char *uuid;
+	const char *ssh_fp;
+	const char *user;
+	int result;
+	boolean_t done;
+	struct batch_item *next;
+} batch_item_t;
+
+/**
+ * Sends a batch.  Must set result on every item in the list; anything left
+ * as BATCH_FALLBACK is redone by its submitter as a single request.
+ *
+ * @param arg
+ * @param items linked through next
+ * @param count
+ * @param deadline earliest deadline of any item (0 for none)
+ */
+typedef void (*batch_send_t)(void *arg, batch_item_t *items,
+			unsigned int count, hrtime_t deadline);
+
+/**
+ * Collects concurrent lookups into batches.
+ *
+ * There's no batching thread: the first submitter to find no batch open
+ * becomes its leader, waits up to `window_ms` (or until `max` items have
+ * joined), then detaches the batch, sends it and wakes everyone in it.
+ * Items arriving meanwhile start the next batch.
+ *
+ * When lookups are sparse, nobody joins and the wait is pure latency.  So
+ * once a leader has ended up alone (`lone`), the next one only waits
+ * BATCH_LONE_WINDOW_US; if anyone joins in that time, leaders go back to
+ * the full window.
+ */
+typedef struct batcher {
+	pthread_mutex_t lock;
+	pthread_cond_t full_cv;
+	pthread_cond_t done_cv;
+	batch_item_t *head;
+	batch_item_t *tail;
+	unsigned int count;
+	hrtime_t deadline;
+	boolean_t collecting;
+	boolean_t lone;
+	unsigned int window_ms;
+	unsigned int max;
+	batch_send_t send;
+	void *arg;
+} batcher_t;
+
+/**
+ * Creates a batcher.
+ *
+ * @param window_ms how long a leader collects before sending
+ * @param max send as soon as this many items are waiting
+ * @param send
+ * @param arg passed to send
+ * @return batcher_t on success, NULL on error
+ */
+extern batcher_t *batcher_create(unsigned int window_ms, unsigned int max,
+			batch_send_t send, void *arg);
+
+/**
+ * Frees a batcher.  There must be nothing in flight.
+ *
+ * @param batcher
+ */
+extern void batcher_destroy(batcher_t *batcher);
+
+/**
+ * Adds a lookup to the current batch and blocks until it's answered.
+ *
+ * @param batcher
+ * @param item uuid/ssh_fp/user filled in
+ * @param deadline gethrtime() by which an answer is needed, or 0
+ * @return the item's result, or BATCH_FALLBACK
+ */
+extern int batcher_submit(batcher_t *batcher, batch_item_t *item,
+			hrtime_t deadline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BATCH_H_ */
@@ -0,0 +1,79 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef BLOG_H_
+#define	BLOG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The binary log format, written by bunyan.c when log-binary-file is set
+ * and turned back into bunyan JSON by blog2json.
+ *
+ * A log is a sequence of entries, each a fixed BLOG_HDR_LEN byte header
+ * followed by `len` bytes of body.  All integers in the header are
+ * little-endian:
+ *
+ *   offset  size  field
+ *   0       1     type (BLOG_FILE, BLOG_STRING or BLOG_RECORD)
+ *   1       1     level (records only)
+ *   2       2     version (BLOG_VERSION)
+ *   4       4     len
+ *   8       8     BLOG_FILE: pid
+ *                 BLOG_STRING: id
+ *                 BLOG_RECORD: time, in microseconds since the epoch
+ *
+ * Integers in bodies are varints: 7 bits at a time, least significant
+ * first, with the top bit set on every byte but the last.  Signed ones are
+ * zigzag encoded first, so small negative numbers stay small.
+ *
+ * Every process writing to the log starts with a BLOG_FILE entry, whose
+ * body is the logger name and hostname as strings (a varint length and the
+ * bytes).  Ids are only good until the next BLOG_FILE entry.
+ *
+ * Messages and field names are interned: the first time one is used, a
+ * BLOG_STRING entry with the bytes as its body gives it an id, and records
+ * refer to it by that id from then on.  A string ref is a varint id, or 0
+ * followed by a length and the bytes for a string that isn't interned.
+ * The definition always comes before the first record to use it.
+ *
+ * No body is longer than BLOG_MAX_LEN, and no string id is bigger than
+ * BLOG_MAX_ID; a reader can treat anything past either as corrupt.
+ *
+ * When the log is rotated (see log-binary-max-size), the new file starts
+ * with a BLOG_FILE entry and the definition of every string given an id so
+ * far, so each file can be read on its own.
+ *
+ * A BLOG_RECORD body is the message as a string ref, then its fields, each
+ * a type byte (BUNYAN_POINTER etc.), the name as a string ref, and a value:
+ *
+ *   BUNYAN_POINTER  varint
+ *   BUNYAN_STRING   varint length + 1 and the bytes, or 0 for null
+ *   BUNYAN_INT32    zigzag varint
+ *   BUNYAN_BOOLEAN  one byte, 0 or 1
+ *   BUNYAN_INT64    zigzag varint
+ */
+
+#define	BLOG_HDR_LEN	16
+#define	BLOG_VERSION	1
+#define	BLOG_MAX_LEN	(1024 * 1024)
+#define	BLOG_MAX_ID	65535
+
+#define	BLOG_FILE	'F'
+#define	BLOG_STRING	'S'
+#define	BLOG_RECORD	'R'
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOG_H_ */
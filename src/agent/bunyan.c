@@ -6,25 +6,44 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
-#include <unistd.h>
+#include <atomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
 #include <sys/time.h>
-#include <time.h>
+#include <sys/uio.h>
 #include <sys/varargs.h>
+#include <time.h>
 #include <unistd.h>
-#include <netdb.h>
-
-#include <libnvpair.h>
 
 #include "nvpair_json.h"
+#include "blog.h"
 #include "bunyan.h"
+#include "stats.h"
 #include "util.h"
 
 #define	LOGGER_NAME		"smart-login"
 #define	ISO_TIME_BUF_LEN	26
 
+/* Per-thread record buffer; bigger records spill to the heap */
+#define	BUNYAN_BUF_LEN		4096
+
+/* Records up to this size are copied into the ring; bigger ones spill */
+#define	BUNYAN_SLOT_LEN		1024
+
+/* Most records the writer thread hands to one writev(2) */
+#define	BUNYAN_IOV_MAX		64
+
+/* Call sites we can rate limit (a power of two); any beyond are unlimited */
+#define	BUNYAN_SITES		512
+
 /*
  * This file implements logging in the style of Bunyan[1], a Javascript
  * library for emitting log records as a stream of line-separated JSON
@@ -44,6 +63,36 @@
  * for the bunyan_*() logging functions, formatted as per the specified
  * type.
  *
+ * v, name, hostname and pid never change, so they're serialized once into
+ * a prefix that starts every record.  The rest is formatted straight into a
+ * per-thread buffer, and the finished line goes out in a single write(2),
+ * so records from different threads never interleave.
+ *
+ * Once bunyan_async_start() has been called, finished lines go into a
+ * lock-free ring instead, and a writer thread drains it in batches with
+ * writev(2), so a slow log disk doesn't hold up whoever is logging.
+ *
+ * A thread working on a request can set its id with bunyan_req_id_set(),
+ * and every record it logs carries that as "req_id" (the same id goes to
+ * CAPI in an x-request-id header, so the two sides' logs can be joined).
+ *
+ * Records below BUNYAN_WARN can be rate limited per call site: each message
+ * (we key on the address of the literal, so this is cheap) gets at most
+ * bunyan_limits()'s per_sec records a second.  The rest are dropped before
+ * any formatting is done, and once their second is over a "log records
+ * suppressed" record says how many went from which site.  Records logged
+ * with bunyan_info_sampled() (the per-login audit records) are never rate
+ * limited, only thinned to 1 in sample_rate, and carry a "sample_rate"
+ * field so they can be scaled back up.  Warnings and worse are never
+ * limited, and neither is anything logged between bunyan_unlimited(B_TRUE)
+ * and bunyan_unlimited(B_FALSE) (used for stats, which are already
+ * periodic).
+ *
+ * After bunyan_binary_start(), records are encoded in the compact format
+ * described in blog.h instead, and go to a file rather than stdout.  That
+ * skips JSON formatting and escaping altogether, and blog2json turns the
+ * file back into the same JSON lines we'd otherwise have written.
+ *
  * [1] https://github.com/trentm/node-bunyan
  */
 
@@ -54,6 +103,119 @@
  */
 static int _bunyan_level = BUNYAN_INFO;
 
+static pthread_once_t _bunyan_once = PTHREAD_ONCE_INIT;
+static char _bunyan_prefix[MAXHOSTNAMELEN * 6 + 128];
+static size_t _bunyan_prefix_len = 0;
+
+static __thread char _bunyan_tls_buf[BUNYAN_BUF_LEN];
+
+typedef struct bunyan_buf {
+	char *data;
+	size_t len;
+	size_t size;
+} bunyan_buf_t;
+
+/*
+ * One record in the ring.  seq says whose turn the slot is (see
+ * bunyan_ring_put()); everything else belongs to that party.
+ */
+typedef struct bunyan_slot {
+	volatile uint64_t seq;
+	size_t len;
+	char *spill;
+	char data[BUNYAN_SLOT_LEN];
+} bunyan_slot_t;
+
+/*
+ * A bounded multi-producer, single-consumer queue of records, after
+ * Vyukov's bounded MPMC queue.  Producers claim a position by CAS on tail;
+ * slot i is free for position p when its seq is p, and holds a record for
+ * the writer when its seq is p + 1.  The lock and condition variables are
+ * only for sleeping: the writer when there's nothing to do, and producers
+ * when the ring is full and we're configured to block.
+ */
+typedef struct bunyan_ring {
+	bunyan_slot_t *slots;
+	uint64_t mask;
+	volatile uint64_t tail;
+	uint64_t head;
+	volatile uint64_t written;
+	boolean_t block;
+	volatile uint32_t writer_idle;
+	volatile uint32_t stopping;
+	unsigned int waiting;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cv;
+	pthread_cond_t space_cv;
+	pthread_cond_t written_cv;
+	pthread_t writer;
+} bunyan_ring_t;
+
+static bunyan_ring_t *_bunyan_ring = NULL;
+static stats_counter_t *_bunyan_dropped = NULL;
+
+/* Where records go: stdout, or the binary log */
+static int _bunyan_fd = STDOUT_FILENO;
+static boolean_t _bunyan_binary = B_FALSE;
+
+/*
+ * The binary log's rotation state.  Every write to it is under
+ * _bunyan_blog_lock, which keeps the size right and lets us swap files
+ * between entries.  defs holds a copy of each BLOG_STRING entry written,
+ * by id, and hdr the BLOG_FILE entry, so a new file can be started with
+ * them.
+ */
+static pthread_mutex_t _bunyan_blog_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *_bunyan_blog_path = NULL;
+static uint64_t _bunyan_blog_max = 0;
+static unsigned int _bunyan_blog_keep = 0;
+static uint64_t _bunyan_blog_size = 0;
+static char *_bunyan_blog_hdr = NULL;
+static size_t _bunyan_blog_hdr_len = 0;
+static char *_bunyan_blog_defs[BUNYAN_SITES + 1];
+static size_t _bunyan_blog_def_lens[BUNYAN_SITES + 1];
+
+/*
+ * Rate limiting state for one call site.  msg is claimed once, by CAS, and
+ * never changes after that; the counters are all updated atomically.  id is
+ * msg's id in the binary log, once it has one.
+ */
+typedef struct bunyan_site {
+	const char *volatile msg;
+	volatile uint64_t window;
+	volatile uint32_t count;
+	volatile uint32_t suppressed;
+	volatile uint32_t calls;
+	volatile uint32_t id;
+} bunyan_site_t;
+
+static bunyan_site_t _bunyan_sites[BUNYAN_SITES];
+static unsigned int _bunyan_per_sec = 0;
+static volatile uint64_t _bunyan_swept = 0;
+static unsigned int _bunyan_sample_rate = 1;
+static stats_counter_t *_bunyan_suppressed = NULL;
+static __thread boolean_t _bunyan_unlimited = B_FALSE;
+static __thread char _bunyan_req_id[BUNYAN_REQ_ID_LEN];
+
+/* Serializes handing out binary log string ids */
+static pthread_mutex_t _bunyan_intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t _bunyan_next_id = 1;
+
+/*
+ * The date and time down to the second only changes once a second, so each
+ * thread keeps the last one it formatted and only redoes it when the second
+ * rolls over.  bunyan_bench.c is also built with BUNYAN_TIME_NOCACHE, which
+ * formats it every time, to measure what that saves.
+ */
+static __thread time_t _bunyan_time_sec = -1;
+static __thread char _bunyan_time_buf[ISO_TIME_BUF_LEN];
+
+#if defined(BUNYAN_TIME_NOCACHE)
+#define	BUNYAN_TIME_CACHED(sec)	B_FALSE
+#else
+#define	BUNYAN_TIME_CACHED(sec)	((sec) == _bunyan_time_sec)
+#endif
+
 /*
  * Format the current date/time as an ISO 8601 string in the provided buffer.
  * Buffer must be at least ISO_TIME_BUF_LEN bytes long.
@@ -63,74 +225,1085 @@ bunyan_iso_time(char *buf)
 {
 	struct timeval tv;
 	struct tm tm;
+	int ms;
 
 	if (gettimeofday(&tv, NULL) != 0)
 		return (-1);
 
-	if (gmtime_r(&tv.tv_sec, &tm) == NULL)
+	if (!BUNYAN_TIME_CACHED(tv.tv_sec)) {
+		if (gmtime_r(&tv.tv_sec, &tm) == NULL)
+			return (-1);
+
+		if (strftime(_bunyan_time_buf, ISO_TIME_BUF_LEN, "%FT%T",
+		    &tm) != 19) {
+			return (-1);
+		}
+		_bunyan_time_sec = tv.tv_sec;
+	}
+
+	(void) memcpy(buf, _bunyan_time_buf, 19);
+	ms = (int)(tv.tv_usec / 1000);
+	buf[19] = '.';
+	buf[20] = '0' + ms / 100;
+	buf[21] = '0' + ms / 10 % 10;
+	buf[22] = '0' + ms % 10;
+	buf[23] = 'Z';
+	buf[24] = '\0';
+
+	return (0);
+}
+
+/*
+ * Build the part of every record that never changes:
+ * {"v":0,"name":"...","hostname":"...","pid":N,
+ */
+static void
+bunyan_init_prefix(void)
+{
+	char namebuf[MAXHOSTNAMELEN];
+	char host[sizeof (_bunyan_prefix) - 64];
+	ssize_t len;
+
+	(void) gethostname(namebuf, sizeof (namebuf));
+	namebuf[sizeof (namebuf) - 1] = '\0';
+
+	len = bunyan_json_escape(host, sizeof (host) - 1, namebuf);
+	if (len < 0 || len >= sizeof (host))
+		len = snprintf(host, sizeof (host), "\"\"");
+	host[len] = '\0';
+
+	len = snprintf(_bunyan_prefix, sizeof (_bunyan_prefix),
+	    "{\"v\":0,\"name\":\"%s\",\"hostname\":%s,\"pid\":%d,",
+	    LOGGER_NAME, host, (int)getpid());
+	if (len < 0 || len >= sizeof (_bunyan_prefix))
+		len = 0;
+	_bunyan_prefix_len = len;
+}
+
+/*
+ * Makes room for n more bytes, moving off the thread's buffer and onto the
+ * heap if need be.
+ */
+static int
+bunyan_buf_reserve(bunyan_buf_t *b, size_t n)
+{
+	char *data = NULL;
+	size_t size = b->size;
+
+	if (b->len + n <= b->size)
+		return (0);
+
+	while (size < b->len + n)
+		size *= 2;
+	data = xmalloc(size);
+	if (data == NULL)
 		return (-1);
+	(void) memcpy(data, b->data, b->len);
+	if (b->data != _bunyan_tls_buf)
+		xfree(b->data);
+	b->data = data;
+	b->size = size;
 
-	if (strftime(buf, ISO_TIME_BUF_LEN, "%FT%T", &tm) != 19) {
+	return (0);
+}
+
+static int
+bunyan_buf_append(bunyan_buf_t *b, const char *str, size_t n)
+{
+	if (bunyan_buf_reserve(b, n) != 0)
 		return (-1);
+	(void) memcpy(b->data + b->len, str, n);
+	b->len += n;
+	return (0);
+}
+
+static int
+bunyan_buf_printf(bunyan_buf_t *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return (-1);
+
+	if (n >= b->size - b->len) {
+		if (bunyan_buf_reserve(b, n + 1) != 0)
+			return (-1);
+		va_start(ap, fmt);
+		(void) vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+		va_end(ap);
 	}
+	b->len += n;
+
+	return (0);
+}
 
-	(void) snprintf(&buf[19], 6, ".%03dZ", (int)(tv.tv_usec / 1000));
+/* Appends str as a quoted JSON string, or null */
+static int
+bunyan_buf_string(bunyan_buf_t *b, const char *str)
+{
+	ssize_t n;
+
+	if (str == NULL)
+		return (bunyan_buf_append(b, "null", 4));
+
+	n = bunyan_json_escape(b->data + b->len, b->size - b->len, str);
+	if (n < 0)
+		return (-1);
+
+	if (n > b->size - b->len) {
+		if (bunyan_buf_reserve(b, n) != 0)
+			return (-1);
+		(void) bunyan_json_escape(b->data + b->len, b->size - b->len,
+		    str);
+	}
+	b->len += n;
+
+	return (0);
+}
+
+/* Appends ,"name": */
+static int
+bunyan_buf_key(bunyan_buf_t *b, const char *name)
+{
+	if (bunyan_buf_append(b, ",", 1) != 0 ||
+	    bunyan_buf_string(b, name) != 0 ||
+	    bunyan_buf_append(b, ":", 1) != 0)
+		return (-1);
+	return (0);
+}
+
+static int
+bunyan_write_sync(const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(_bunyan_fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+static int
+bunyan_writev(struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		n = writev(_bunyan_fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		while (iovcnt > 0 && n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
 
 	return (0);
 }
 
 /*
- * Emit a bunyan log record.
+ * Moves the binary log aside, logadm(1M) style: path.0 is the newest old
+ * log and path.<keep - 1> the oldest, which falls off the end.  The new
+ * file starts with the BLOG_FILE entry and every string definition, since
+ * records still to come may use any of them.  If the new file can't be
+ * opened we carry on in the old one, and try again once it has grown by
+ * another log-binary-max-size.  Caller holds _bunyan_blog_lock.
+ */
+static void
+bunyan_blog_rotate(void)
+{
+	char from[MAXPATHLEN];
+	char to[MAXPATHLEN];
+	unsigned int i;
+	int fd;
+
+	_bunyan_blog_size = 0;
+
+	for (i = _bunyan_blog_keep; i > 0; i--) {
+		if (i > 1) {
+			(void) snprintf(from, sizeof (from), "%s.%u",
+			    _bunyan_blog_path, i - 2);
+		} else {
+			(void) snprintf(from, sizeof (from), "%s",
+			    _bunyan_blog_path);
+		}
+		(void) snprintf(to, sizeof (to), "%s.%u", _bunyan_blog_path,
+		    i - 1);
+		(void) rename(from, to);
+	}
+	if (_bunyan_blog_keep == 0)
+		(void) unlink(_bunyan_blog_path);
+
+	fd = open(_bunyan_blog_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+	    0644);
+	if (fd < 0)
+		return;
+	/* Keep the descriptor number, so _bunyan_fd never changes */
+	(void) dup2(fd, _bunyan_fd);
+	(void) close(fd);
+
+	if (bunyan_write_sync(_bunyan_blog_hdr, _bunyan_blog_hdr_len) != 0)
+		return;
+	_bunyan_blog_size += _bunyan_blog_hdr_len;
+	for (i = 1; i <= BUNYAN_SITES; i++) {
+		if (_bunyan_blog_defs[i] == NULL)
+			continue;
+		if (bunyan_write_sync(_bunyan_blog_defs[i],
+		    _bunyan_blog_def_lens[i]) != 0)
+			return;
+		_bunyan_blog_size += _bunyan_blog_def_lens[i];
+	}
+}
+
+/*
+ * Writes whole entries to the binary log, keeping a copy of any string
+ * definitions among them, and rotates it once it reaches
+ * log-binary-max-size.  Entries are never split across files.
  */
 static int
-bunyan_vlog(int level, char *msg, va_list *ap)
+bunyan_blog_writev(struct iovec *iov, int iovcnt)
 {
-	int rc = -1;
-	nvlist_t *nvl;
-	char buf[ISO_TIME_BUF_LEN];
-	char namebuf[MAXHOSTNAMELEN];
-	int type;
+	const unsigned char *hdr = NULL;
+	uint64_t id;
+	size_t len = 0;
+	int rc;
+	int i, j;
+
+	(void) pthread_mutex_lock(&_bunyan_blog_lock);
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+		hdr = iov[i].iov_base;
+		if (iov[i].iov_len < BLOG_HDR_LEN || hdr[0] != BLOG_STRING)
+			continue;
+		for (id = 0, j = 7; j >= 0; j--)
+			id = (id << 8) | hdr[8 + j];
+		if (id == 0 || id > BUNYAN_SITES ||
+		    _bunyan_blog_defs[id] != NULL)
+			continue;
+		_bunyan_blog_defs[id] = xmalloc(iov[i].iov_len);
+		if (_bunyan_blog_defs[id] == NULL)
+			continue;
+		(void) memcpy(_bunyan_blog_defs[id], hdr, iov[i].iov_len);
+		_bunyan_blog_def_lens[id] = iov[i].iov_len;
+	}
+
+	rc = bunyan_writev(iov, iovcnt);
+	_bunyan_blog_size += len;
+	if (_bunyan_blog_max != 0 && _bunyan_blog_size >= _bunyan_blog_max)
+		bunyan_blog_rotate();
+	(void) pthread_mutex_unlock(&_bunyan_blog_lock);
+
+	return (rc);
+}
+
+/* Writes whole entries out, to the binary log or stdout */
+static int
+bunyan_output(struct iovec *iov, int iovcnt)
+{
+	if (_bunyan_binary)
+		return (bunyan_blog_writev(iov, iovcnt));
+	return (bunyan_writev(iov, iovcnt));
+}
+
+/* Sets ts to ms from now */
+static void
+bunyan_timeout(struct timespec *ts, unsigned int ms)
+{
+	(void) clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/*
+ * The ring's counters are 64 bits, which a 32-bit build can't load or store
+ * in one go; these keep other threads from seeing half an update.
+ */
+static uint64_t
+bunyan_load_64(volatile uint64_t *p)
+{
+	return (atomic_add_64_nv(p, 0));
+}
 
-	if ((rc = nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0)) != 0) {
-		fprintf(stderr, "could not allocate nvlist\n");
+static void
+bunyan_store_64(volatile uint64_t *p, uint64_t v)
+{
+	(void) atomic_swap_64(p, v);
+}
+
+static boolean_t
+bunyan_ring_ready(bunyan_ring_t *r, uint64_t pos)
+{
+	boolean_t ready =
+	    (bunyan_load_64(&r->slots[pos & r->mask].seq) == pos + 1);
+
+	membar_consumer();
+	return (ready);
+}
+
+/*
+ * Copies a finished record into the ring.  Never takes a lock unless the
+ * writer is asleep (to wake it) or the ring is full and we block.
+ */
+static int
+bunyan_ring_put(bunyan_ring_t *r, const char *buf, size_t len)
+{
+	bunyan_slot_t *slot = NULL;
+	char *spill = NULL;
+	uint64_t pos, seq;
+	int64_t diff;
+	struct timespec ts;
+
+	if (len > BUNYAN_SLOT_LEN) {
+		spill = xmalloc(len);
+		if (spill == NULL)
+			return (-1);
+		(void) memcpy(spill, buf, len);
+	}
+
+	pos = bunyan_load_64(&r->tail);
+	for (;;) {
+		slot = &r->slots[pos & r->mask];
+		seq = bunyan_load_64(&slot->seq);
+		membar_consumer();
+		diff = (int64_t)(seq - pos);
+		if (diff == 0) {
+			if (atomic_cas_64(&r->tail, pos, pos + 1) == pos)
+				break;
+		} else if (diff < 0) {
+			/* Full: the writer hasn't freed this slot yet */
+			if (!r->block) {
+				stats_incr(_bunyan_dropped);
+				xfree(spill);
+				return (-1);
+			}
+			(void) pthread_mutex_lock(&r->lock);
+			r->waiting++;
+			bunyan_timeout(&ts, 10);
+			(void) pthread_cond_timedwait(&r->space_cv, &r->lock,
+			    &ts);
+			r->waiting--;
+			(void) pthread_mutex_unlock(&r->lock);
+		}
+		pos = bunyan_load_64(&r->tail);
+	}
+
+	slot->len = len;
+	slot->spill = spill;
+	if (spill == NULL)
+		(void) memcpy(slot->data, buf, len);
+	membar_producer();
+	bunyan_store_64(&slot->seq, pos + 1);
+
+	/* Make the record visible before we look at whether to wake */
+	membar_enter();
+	if (r->writer_idle) {
+		(void) pthread_mutex_lock(&r->lock);
+		(void) pthread_cond_signal(&r->work_cv);
+		(void) pthread_mutex_unlock(&r->lock);
+	}
+
+	return (0);
+}
+
+static void *
+bunyan_writer(void *arg)
+{
+	bunyan_ring_t *r = arg;
+	bunyan_slot_t *slot = NULL;
+	struct iovec iov[BUNYAN_IOV_MAX];
+	struct timespec ts;
+	int n, i;
+
+	for (;;) {
+		for (n = 0; n < BUNYAN_IOV_MAX &&
+		    bunyan_ring_ready(r, r->head + n); n++) {
+			slot = &r->slots[(r->head + n) & r->mask];
+			iov[n].iov_base = (slot->spill != NULL ?
+			    slot->spill : slot->data);
+			iov[n].iov_len = slot->len;
+		}
+
+		if (n == 0) {
+			if (r->stopping)
+				break;
+			(void) pthread_mutex_lock(&r->lock);
+			r->writer_idle = 1;
+			membar_enter();
+			/*
+			 * A producer that published before seeing us idle
+			 * won't wake us, so look once more before sleeping.
+			 * The timeout is only a backstop.
+			 */
+			if (!bunyan_ring_ready(r, r->head) && !r->stopping) {
+				bunyan_timeout(&ts, 1000);
+				(void) pthread_cond_timedwait(&r->work_cv,
+				    &r->lock, &ts);
+			}
+			r->writer_idle = 0;
+			(void) pthread_mutex_unlock(&r->lock);
+			continue;
+		}
+
+		/* Nowhere to report a failed write, so carry on regardless */
+		(void) bunyan_output(iov, n);
+
+		for (i = 0; i < n; i++) {
+			slot = &r->slots[(r->head + i) & r->mask];
+			xfree(slot->spill);
+			slot->spill = NULL;
+			membar_producer();
+			bunyan_store_64(&slot->seq, r->head + i + r->mask + 1);
+		}
+		r->head += n;
+
+		(void) pthread_mutex_lock(&r->lock);
+		r->written = r->head;
+		(void) pthread_cond_broadcast(&r->written_cv);
+		if (r->waiting > 0)
+			(void) pthread_cond_broadcast(&r->space_cv);
+		(void) pthread_mutex_unlock(&r->lock);
+	}
+
+	return (NULL);
+}
+
+static int
+bunyan_write(const char *buf, size_t len)
+{
+	bunyan_ring_t *r = _bunyan_ring;
+
+	struct iovec iov;
+
+	if (r == NULL) {
+		iov.iov_base = (char *)buf;
+		iov.iov_len = len;
+		return (bunyan_output(&iov, 1));
+	}
+	return (bunyan_ring_put(r, buf, len));
+}
+
+int
+bunyan_async_start(unsigned int records, boolean_t block)
+{
+	bunyan_ring_t *r = NULL;
+	uint64_t size = 1;
+	uint64_t i;
+
+	if (_bunyan_ring != NULL || records == 0)
+		return (-1);
+
+	while (size < records)
+		size <<= 1;
+
+	r = xmalloc(sizeof (bunyan_ring_t));
+	if (r == NULL)
+		return (-1);
+	r->slots = xcalloc(size, sizeof (bunyan_slot_t));
+	if (r->slots == NULL) {
+		xfree(r);
 		return (-1);
 	}
+	for (i = 0; i < size; i++)
+		r->slots[i].seq = i;
+	r->mask = size - 1;
+	r->block = block;
+	(void) pthread_mutex_init(&r->lock, NULL);
+	(void) pthread_cond_init(&r->work_cv, NULL);
+	(void) pthread_cond_init(&r->space_cv, NULL);
+	(void) pthread_cond_init(&r->written_cv, NULL);
+
+	if (_bunyan_dropped == NULL)
+		_bunyan_dropped = stats_counter_create("log_records_dropped");
+
+	if (pthread_create(&r->writer, NULL, bunyan_writer, r) != 0) {
+		xfree(r->slots);
+		xfree(r);
+		return (-1);
+	}
+
+	membar_producer();
+	_bunyan_ring = r;
+	return (0);
+}
+
+void
+bunyan_flush(void)
+{
+	bunyan_ring_t *r = _bunyan_ring;
+	uint64_t target;
+	struct timespec ts;
+
+	if (r == NULL)
+		return;
+
+	target = bunyan_load_64(&r->tail);
+	(void) pthread_mutex_lock(&r->lock);
+	while (r->written < target) {
+		(void) pthread_cond_signal(&r->work_cv);
+		bunyan_timeout(&ts, 10);
+		(void) pthread_cond_timedwait(&r->written_cv, &r->lock, &ts);
+	}
+	(void) pthread_mutex_unlock(&r->lock);
+}
+
+void
+bunyan_async_stop(void)
+{
+	bunyan_ring_t *r = _bunyan_ring;
+
+	if (r == NULL)
+		return;
+
+	/*
+	 * New records go straight out from here on.  The ring itself is
+	 * never freed, since a thread may still be on its way into it.
+	 */
+	_bunyan_ring = NULL;
+	membar_producer();
+
+	(void) pthread_mutex_lock(&r->lock);
+	r->stopping = 1;
+	(void) pthread_cond_signal(&r->work_cv);
+	(void) pthread_mutex_unlock(&r->lock);
+	(void) pthread_join(r->writer, NULL);
+}
+
+/*
+ * Finds (or claims) the rate limiting slot for msg.  Returns NULL if the
+ * table is full, in which case msg just isn't limited.
+ */
+static bunyan_site_t *
+bunyan_site(const char *msg)
+{
+	uint64_t h = ((uintptr_t)msg >> 3) * 0x9e3779b97f4a7c15ULL;
+	bunyan_site_t *site = NULL;
+	const char *cur = NULL;
+	unsigned int i;
+
+	for (i = 0; i < BUNYAN_SITES; i++) {
+		site = &_bunyan_sites[((h >> 32) + i) & (BUNYAN_SITES - 1)];
+		cur = site->msg;
+		if (cur == NULL) {
+			cur = atomic_cas_ptr(&site->msg, NULL, (void *)msg);
+			if (cur == NULL)
+				return (site);
+		}
+		if (cur == msg)
+			return (site);
+	}
+
+	return (NULL);
+}
+
+static int bunyan_vlog(int level, char *msg, unsigned int sample_rate,
+    va_list *ap);
+
+/* Logs a record that isn't subject to bunyan_limits() */
+static void
+bunyan_log_unlimited(int level, char *msg, ...)
+{
+	va_list ap;
+
+	va_start(ap, msg);
+	(void) bunyan_vlog(level, msg, 1, &ap);
+	va_end(ap);
+}
+
+/*
+ * Once a second (whoever gets there first), says how many records each
+ * site had suppressed in the seconds since the last sweep.
+ */
+static void
+bunyan_sweep(uint64_t now)
+{
+	bunyan_site_t *site = NULL;
+	uint64_t swept = bunyan_load_64(&_bunyan_swept);
+	uint32_t suppressed;
+	unsigned int i;
+
+	if (swept == now || atomic_cas_64(&_bunyan_swept, swept, now) != swept)
+		return;
+
+	for (i = 0; i < BUNYAN_SITES; i++) {
+		site = &_bunyan_sites[i];
+		if (site->msg == NULL || site->suppressed == 0 ||
+		    bunyan_load_64(&site->window) == now)
+			continue;
+		suppressed = atomic_swap_32(&site->suppressed, 0);
+		if (suppressed == 0 || _bunyan_level > BUNYAN_INFO)
+			continue;
+		bunyan_log_unlimited(BUNYAN_INFO, "log records suppressed",
+		    BUNYAN_STRING, "suppressed_msg", site->msg,
+		    BUNYAN_INT32, "count", suppressed,
+		    BUNYAN_INT32, "per_sec", _bunyan_per_sec,
+		    BUNYAN_NONE);
+	}
+}
+
+/*
+ * Decides whether a record below BUNYAN_WARN from msg's call site should be
+ * logged.
+ */
+static boolean_t
+bunyan_admit(const char *msg, boolean_t sampled)
+{
+	bunyan_site_t *site = NULL;
+	uint64_t now = 0;
+	uint64_t window;
+
+	if (_bunyan_per_sec != 0) {
+		now = gethrtime() / 1000000000LL;
+		bunyan_sweep(now);
+	}
+
+	if (_bunyan_unlimited || msg == NULL)
+		return (B_TRUE);
+	if (sampled ? _bunyan_sample_rate <= 1 : _bunyan_per_sec == 0)
+		return (B_TRUE);
+
+	site = bunyan_site(msg);
+	if (site == NULL)
+		return (B_TRUE);
+
+	/* Audit records are only ever sampled, never rate limited */
+	if (sampled) {
+		return ((atomic_inc_32_nv(&site->calls) - 1) %
+		    _bunyan_sample_rate == 0);
+	}
 
 	/*
-	 * Get hostname for log record.
+	 * Whoever moves the window on resets the count.  Racing threads can
+	 * slip a record or two past the limit at the boundary, which is fine.
 	 */
+	window = bunyan_load_64(&site->window);
+	if (window != now && atomic_cas_64(&site->window, window, now) ==
+	    window)
+		site->count = 0;
+
+	if (atomic_inc_32_nv(&site->count) > _bunyan_per_sec) {
+		atomic_inc_32(&site->suppressed);
+		stats_incr(_bunyan_suppressed);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+void
+bunyan_limits(unsigned int per_sec, unsigned int sample_rate)
+{
+	if (_bunyan_suppressed == NULL) {
+		_bunyan_suppressed =
+		    stats_counter_create("log_records_suppressed");
+	}
+	_bunyan_per_sec = per_sec;
+	_bunyan_sample_rate = (sample_rate == 0 ? 1 : sample_rate);
+}
+
+void
+bunyan_req_id_set(const char *req_id)
+{
+	if (req_id == NULL)
+		_bunyan_req_id[0] = '\0';
+	else
+		(void) snprintf(_bunyan_req_id, sizeof (_bunyan_req_id), "%s",
+		    req_id);
+}
+
+const char *
+bunyan_req_id(void)
+{
+	return (_bunyan_req_id[0] != '\0' ? _bunyan_req_id : NULL);
+}
+
+boolean_t
+bunyan_unlimited(boolean_t unlimited)
+{
+	boolean_t old = _bunyan_unlimited;
+
+	_bunyan_unlimited = unlimited;
+
+	return (old);
+}
+
+/* Fills in a binary log entry header; see blog.h */
+static void
+bunyan_blog_header(char *hdr, int type, int level, uint32_t len,
+    uint64_t value)
+{
+	int i;
+
+	hdr[0] = type;
+	hdr[1] = level;
+	hdr[2] = BLOG_VERSION & 0xff;
+	hdr[3] = BLOG_VERSION >> 8;
+	for (i = 0; i < 4; i++)
+		hdr[4 + i] = (len >> (i * 8)) & 0xff;
+	for (i = 0; i < 8; i++)
+		hdr[8 + i] = (value >> (i * 8)) & 0xff;
+}
+
+static int
+bunyan_buf_varint(bunyan_buf_t *b, uint64_t v)
+{
+	unsigned char *p = NULL;
+
+	if (bunyan_buf_reserve(b, 10) != 0)
+		return (-1);
+
+	p = (unsigned char *)b->data + b->len;
+	while (v >= 0x80) {
+		*p++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	b->len = (char *)p - b->data;
+
+	return (0);
+}
+
+static int
+bunyan_buf_bytes(bunyan_buf_t *b, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (bunyan_buf_varint(b, len) != 0 ||
+	    bunyan_buf_append(b, str, len) != 0)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Gives str an id in the binary log, writing out its definition, and
+ * returns it; or returns 0 if it couldn't be written.  The id isn't
+ * published in the site until the definition has been written (or queued
+ * ahead of anything that could use it), so nobody refers to it first.
+ */
+static uint32_t
+bunyan_intern(bunyan_site_t *site, const char *str)
+{
+	size_t len = strlen(str);
+	char *entry = NULL;
+	uint32_t id;
+
+	(void) pthread_mutex_lock(&_bunyan_intern_lock);
+	id = site->id;
+	if (id != 0)
+		goto out;
+
+	entry = xmalloc(BLOG_HDR_LEN + len);
+	if (entry == NULL)
+		goto out;
+	bunyan_blog_header(entry, BLOG_STRING, 0, len, _bunyan_next_id);
+	(void) memcpy(entry + BLOG_HDR_LEN, str, len);
+
+	if (bunyan_write(entry, BLOG_HDR_LEN + len) == 0) {
+		id = _bunyan_next_id++;
+		membar_producer();
+		site->id = id;
+	}
+	xfree(entry);
+
+out:
+	(void) pthread_mutex_unlock(&_bunyan_intern_lock);
+	return (id);
+}
+
+/* Appends a string ref: str's id, or 0 and str itself */
+static int
+bunyan_buf_ref(bunyan_buf_t *b, const char *str)
+{
+	bunyan_site_t *site = bunyan_site(str);
+	uint32_t id = 0;
+
+	if (site != NULL) {
+		id = site->id;
+		membar_consumer();
+		if (id == 0)
+			id = bunyan_intern(site, str);
+	}
+
+	if (id != 0)
+		return (bunyan_buf_varint(b, id));
+	if (bunyan_buf_varint(b, 0) != 0 || bunyan_buf_bytes(b, str) != 0)
+		return (-1);
+	return (0);
+}
+
+/* Appends the start of a binary record field: its type and name */
+static int
+bunyan_buf_field(bunyan_buf_t *b, int type, const char *name)
+{
+	char t = type;
+
+	if (bunyan_buf_append(b, &t, 1) != 0 || bunyan_buf_ref(b, name) != 0)
+		return (-1);
+	return (0);
+}
+
+/* Appends a signed integer, zigzag encoded */
+static int
+bunyan_buf_zigzag(bunyan_buf_t *b, int64_t v)
+{
+	return (bunyan_buf_varint(b, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63)));
+}
+
+int
+bunyan_binary_start(const char *path, uint64_t max_size, unsigned int keep)
+{
+	char namebuf[MAXHOSTNAMELEN];
+	bunyan_buf_t b;
+	int fd = -1;
+	int rc = -1;
+
+	if (path == NULL) {
+		bunyan_debug("bunyan_binary_start: NULL arguments",
+		    BUNYAN_NONE);
+		return (-1);
+	}
+
 	(void) gethostname(namebuf, sizeof (namebuf));
 	namebuf[sizeof (namebuf) - 1] = '\0';
 
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return (-1);
+
+	b.data = _bunyan_tls_buf;
+	b.size = sizeof (_bunyan_tls_buf);
+	b.len = BLOG_HDR_LEN;
+	if (bunyan_buf_bytes(&b, LOGGER_NAME) != 0 ||
+	    bunyan_buf_bytes(&b, namebuf) != 0)
+		goto out;
+	bunyan_blog_header(b.data, BLOG_FILE, 0, b.len - BLOG_HDR_LEN,
+	    (uint64_t)getpid());
+
+	/* Ids from any earlier log don't mean anything in this one */
+	(void) memset(_bunyan_sites, 0, sizeof (_bunyan_sites));
+
+	_bunyan_blog_path = xstrdup(path);
+	_bunyan_blog_hdr = xmalloc(b.len);
+	if (_bunyan_blog_path == NULL || _bunyan_blog_hdr == NULL)
+		goto out;
+	(void) memcpy(_bunyan_blog_hdr, b.data, b.len);
+	_bunyan_blog_hdr_len = b.len;
+	_bunyan_blog_max = max_size;
+	_bunyan_blog_keep = keep;
+	_bunyan_blog_size = MAX(lseek(fd, 0, SEEK_END), 0);
+
+	_bunyan_fd = fd;
+	if (bunyan_write_sync(b.data, b.len) != 0) {
+		_bunyan_fd = STDOUT_FILENO;
+		goto out;
+	}
+	_bunyan_blog_size += b.len;
+	_bunyan_binary = B_TRUE;
+	rc = 0;
+
+out:
+	if (b.data != _bunyan_tls_buf)
+		xfree(b.data);
+	if (rc != 0) {
+		(void) close(fd);
+		xfree(_bunyan_blog_path);
+		xfree(_bunyan_blog_hdr);
+		_bunyan_blog_path = NULL;
+		_bunyan_blog_hdr = NULL;
+	}
+	return (rc);
+}
+
+/*
+ * Emit a bunyan log record in binary; see blog.h.
+ */
+static int
+bunyan_vlog_binary(int level, char *msg, unsigned int sample_rate,
+    va_list *ap)
+{
+	int rc = -1;
+	bunyan_buf_t b;
+	struct timeval tv;
+	int type;
+
+	if (gettimeofday(&tv, NULL) != 0)
+		return (-1);
+
+	b.data = _bunyan_tls_buf;
+	b.size = sizeof (_bunyan_tls_buf);
+	b.len = BLOG_HDR_LEN;
+
+	if (bunyan_buf_ref(&b, msg != NULL ? msg : "") != 0)
+		goto out;
+	if (_bunyan_req_id[0] != '\0' &&
+	    (bunyan_buf_field(&b, BUNYAN_STRING, "req_id") != 0 ||
+	    bunyan_buf_varint(&b, strlen(_bunyan_req_id) + 1) != 0 ||
+	    bunyan_buf_append(&b, _bunyan_req_id,
+	    strlen(_bunyan_req_id)) != 0))
+		goto out;
+	if (sample_rate > 1 &&
+	    (bunyan_buf_field(&b, BUNYAN_INT32, "sample_rate") != 0 ||
+	    bunyan_buf_zigzag(&b, sample_rate) != 0))
+		goto out;
+
+	while ((type = va_arg(*ap, int)) != (int)BUNYAN_NONE) {
+		char *name = va_arg(*ap, char *);
+
+		if (bunyan_buf_field(&b, type, name) != 0)
+			goto out;
+
+		switch (type) {
+		case BUNYAN_POINTER: {
+			void *ptr = va_arg(*ap, void *);
+			if (bunyan_buf_varint(&b, (uintptr_t)ptr) != 0) {
+				goto out;
+			}
+			break;
+		}
+
+		case BUNYAN_BOOLEAN: {
+			int v = va_arg(*ap, boolean_t);
+			if (bunyan_buf_append(&b, v ? "\1" : "\0", 1) != 0) {
+				goto out;
+			}
+			break;
+		}
+
+		case BUNYAN_STRING: {
+			char *str = va_arg(*ap, char *);
+			if (str == NULL) {
+				if (bunyan_buf_varint(&b, 0) != 0)
+					goto out;
+			} else if (bunyan_buf_varint(&b, strlen(str) + 1) !=
+			    0 || bunyan_buf_append(&b, str, strlen(str)) != 0) {
+				goto out;
+			}
+			break;
+		}
+
+		case BUNYAN_INT32: {
+			int32_t i = va_arg(*ap, int32_t);
+			if (bunyan_buf_zigzag(&b, i) != 0) {
+				goto out;
+			}
+			break;
+		}
+
+		case BUNYAN_INT64: {
+			int64_t i = va_arg(*ap, int64_t);
+			if (bunyan_buf_zigzag(&b, i) != 0) {
+				goto out;
+			}
+			break;
+		}
+
+		default:
+			fprintf(stderr, "UNKNOWN TYPE: %u\n", type);
+			abort();
+			break;
+		}
+	}
+
+	/* blog2json would refuse it, and everything after it */
+	if (b.len - BLOG_HDR_LEN > BLOG_MAX_LEN)
+		goto out;
+
+	bunyan_blog_header(b.data, BLOG_RECORD, level, b.len - BLOG_HDR_LEN,
+	    (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+	rc = bunyan_write(b.data, b.len);
+
+	/* Whatever happens next, a fatal record must make it out */
+	if (level >= BUNYAN_FATAL)
+		bunyan_flush();
+
+out:
+	if (b.data != _bunyan_tls_buf)
+		xfree(b.data);
+
+	return (rc);
+}
+
+/*
+ * Emit a bunyan log record.  sample_rate is added as a field when it says
+ * something (i.e., isn't 1).
+ */
+static int
+bunyan_vlog(int level, char *msg, unsigned int sample_rate, va_list *ap)
+{
+	int rc = -1;
+	bunyan_buf_t b;
+	char buf[ISO_TIME_BUF_LEN];
+	int type;
+
+	if (_bunyan_binary)
+		return (bunyan_vlog_binary(level, msg, sample_rate, ap));
+
+	(void) pthread_once(&_bunyan_once, bunyan_init_prefix);
+
+	b.data = _bunyan_tls_buf;
+	b.len = 0;
+	b.size = sizeof (_bunyan_tls_buf);
+
 	if (bunyan_iso_time(buf) != 0 ||
-	    nvlist_add_string(nvl, "time", buf) != 0 ||
-	    nvlist_add_string(nvl, "hostname", namebuf) != 0 ||
-	    nvlist_add_string(nvl, "name", LOGGER_NAME) != 0 ||
-	    nvlist_add_int32(nvl, "pid", (int32_t)getpid()) != 0 ||
-	    nvlist_add_int32(nvl, "level", level) != 0 ||
-	    nvlist_add_int32(nvl, "v", 0) != 0 ||
-	    nvlist_add_string(nvl, "msg", msg != NULL ? msg : "")) {
+	    bunyan_buf_append(&b, _bunyan_prefix, _bunyan_prefix_len) != 0 ||
+	    bunyan_buf_printf(&b, "\"level\":%d,\"time\":\"%s\",\"msg\":",
+	    level, buf) != 0 ||
+	    bunyan_buf_string(&b, msg != NULL ? msg : "") != 0) {
 		goto out;
 	}
 
+	if (_bunyan_req_id[0] != '\0' &&
+	    (bunyan_buf_key(&b, "req_id") != 0 ||
+	    bunyan_buf_string(&b, _bunyan_req_id) != 0))
+		goto out;
+	if (sample_rate > 1 && bunyan_buf_printf(&b, ",\"sample_rate\":%u",
+	    sample_rate) != 0)
+		goto out;
+
 	while ((type = va_arg(*ap, int)) != (int)BUNYAN_NONE) {
 		char *name = va_arg(*ap, char *);
 
+		if (bunyan_buf_key(&b, name) != 0)
+			goto out;
+
 		switch (type) {
 		case BUNYAN_POINTER: {
 			void *ptr = va_arg(*ap, void *);
 			char buf[100];
 			snprintf(buf, sizeof (buf), "0x%p", ptr);
-			if (nvlist_add_string(nvl, name, buf) != 0) {
+			if (bunyan_buf_string(&b, buf) != 0) {
 				goto out;
 			}
 			break;
 		}
 
 		case BUNYAN_BOOLEAN: {
-			int b = va_arg(*ap, boolean_t);
-			if (nvlist_add_boolean_value(nvl, name, b ? B_TRUE :
-			    B_FALSE) != 0) {
+			int v = va_arg(*ap, boolean_t);
+			if (bunyan_buf_append(&b, v ? "true" : "false",
+			    v ? 4 : 5) != 0) {
 				goto out;
 			}
 			break;
@@ -138,7 +1311,7 @@ bunyan_vlog(int level, char *msg, va_list *ap)
 
 		case BUNYAN_STRING: {
 			char *str = va_arg(*ap, char *);
-			if (nvlist_add_string(nvl, name, str) != 0) {
+			if (bunyan_buf_string(&b, str) != 0) {
 				goto out;
 			}
 			break;
@@ -146,7 +1319,15 @@ bunyan_vlog(int level, char *msg, va_list *ap)
 
 		case BUNYAN_INT32: {
 			int32_t i = va_arg(*ap, int32_t);
-			if (nvlist_add_int32(nvl, name, i) != 0) {
+			if (bunyan_buf_printf(&b, "%d", i) != 0) {
+				goto out;
+			}
+			break;
+		}
+
+		case BUNYAN_INT64: {
+			int64_t i = va_arg(*ap, int64_t);
+			if (bunyan_buf_printf(&b, "%lld", (long long)i) != 0) {
 				goto out;
 			}
 			break;
@@ -159,12 +1340,18 @@ bunyan_vlog(int level, char *msg, va_list *ap)
 		}
 	}
 
-	rc = bunyan_nvlist_print_json(stdout, nvl);
-	fprintf(stdout, "\n");
-	fflush(stdout);
+	if (bunyan_buf_append(&b, "}\n", 2) != 0)
+		goto out;
+
+	rc = bunyan_write(b.data, b.len);
+
+	/* Whatever happens next, a fatal record must make it out */
+	if (level >= BUNYAN_FATAL)
+		bunyan_flush();
 
 out:
-	(void) nvlist_free(nvl);
+	if (b.data != _bunyan_tls_buf)
+		xfree(b.data);
 
 	return (rc);
 }
@@ -175,11 +1362,12 @@ bunyan_trace(char *msg, ...)
 	va_list ap;
 	int err;
 
-	if (_bunyan_level > BUNYAN_TRACE)
+	if (_bunyan_level > BUNYAN_TRACE ||
+	    !bunyan_admit(msg, B_FALSE))
 		return (0);
 
 	va_start(ap, msg);
-	err = bunyan_vlog(BUNYAN_TRACE, msg, &ap);
+	err = bunyan_vlog(BUNYAN_TRACE, msg, 1, &ap);
 	va_end(ap);
 
 	return (err);
@@ -191,11 +1379,12 @@ bunyan_debug(char *msg, ...)
 	va_list ap;
 	int err;
 
-	if (_bunyan_level > BUNYAN_DEBUG)
+	if (_bunyan_level > BUNYAN_DEBUG ||
+	    !bunyan_admit(msg, B_FALSE))
 		return (0);
 
 	va_start(ap, msg);
-	err = bunyan_vlog(BUNYAN_DEBUG, msg, &ap);
+	err = bunyan_vlog(BUNYAN_DEBUG, msg, 1, &ap);
 	va_end(ap);
 
 	return (err);
@@ -207,11 +1396,30 @@ bunyan_info(char *msg, ...)
 	va_list ap;
 	int err;
 
-	if (_bunyan_level > BUNYAN_INFO)
+	if (_bunyan_level > BUNYAN_INFO ||
+	    !bunyan_admit(msg, B_FALSE))
+		return (0);
+
+	va_start(ap, msg);
+	err = bunyan_vlog(BUNYAN_INFO, msg, 1, &ap);
+	va_end(ap);
+
+	return (err);
+}
+
+int
+bunyan_info_sampled(char *msg, ...)
+{
+	va_list ap;
+	int err;
+
+	if (_bunyan_level > BUNYAN_INFO ||
+	    !bunyan_admit(msg, B_TRUE))
 		return (0);
 
 	va_start(ap, msg);
-	err = bunyan_vlog(BUNYAN_INFO, msg, &ap);
+	err = bunyan_vlog(BUNYAN_INFO, msg,
+	    _bunyan_unlimited ? 1 : _bunyan_sample_rate, &ap);
 	va_end(ap);
 
 	return (err);
@@ -227,7 +1435,7 @@ bunyan_warn(char *msg, ...)
 		return (0);
 
 	va_start(ap, msg);
-	err = bunyan_vlog(BUNYAN_WARN, msg, &ap);
+	err = bunyan_vlog(BUNYAN_WARN, msg, 1, &ap);
 	va_end(ap);
 
 	return (err);
@@ -243,7 +1451,7 @@ bunyan_error(char *msg, ...)
 		return (0);
 
 	va_start(ap, msg);
-	err = bunyan_vlog(BUNYAN_ERROR, msg, &ap);
+	err = bunyan_vlog(BUNYAN_ERROR, msg, 1, &ap);
 	va_end(ap);
 
 	return (err);
@@ -259,7 +1467,7 @@ bunyan_fatal(char *msg, ...)
 		return (0);
 
 	va_start(ap, msg);
-	err = bunyan_vlog(BUNYAN_FATAL, msg, &ap);
+	err = bunyan_vlog(BUNYAN_FATAL, msg, 1, &ap);
 	va_end(ap);
 
 	return (err);
@@ -6,6 +6,7 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #ifndef	BUNYAN_H_
@@ -29,16 +30,95 @@ extern "C" {
 #define	BUNYAN_STRING	((int)2)
 #define	BUNYAN_INT32	((int)3)
 #define	BUNYAN_BOOLEAN	((int)4)
+#define	BUNYAN_INT64	((int)5)
+
+/* Longest request id, including its NUL */
+#define	BUNYAN_REQ_ID_LEN	24
 
 extern int bunyan_trace(char *msg, ...) __SENTINEL;
 extern int bunyan_debug(char *msg, ...) __SENTINEL;
 extern int bunyan_info(char *msg, ...) __SENTINEL;
+extern int bunyan_info_sampled(char *msg, ...) __SENTINEL;
 extern int bunyan_warn(char *msg, ...) __SENTINEL;
 extern int bunyan_error(char *msg, ...) __SENTINEL;
 extern int bunyan_fatal(char *msg, ...) __SENTINEL;
 
 extern int bunyan_level(int level);
 
+/**
+ * Limits how much gets logged below BUNYAN_WARN.  Each call site (message)
+ * may log at most `per_sec` records a second; anything over that is counted
+ * in log_records_suppressed, and summed up per site in a "log records
+ * suppressed" record once the second is over.  bunyan_info_sampled()
+ * records aren't rate limited, only cut down to 1 in `sample_rate`.
+ *
+ * @param per_sec 0 for no limit
+ * @param sample_rate 1 (or 0) to log every sampled record
+ */
+extern void bunyan_limits(unsigned int per_sec, unsigned int sample_rate);
+
+/**
+ * Tags every record the calling thread logs from now on with a "req_id"
+ * field, until it's cleared.
+ *
+ * @param req_id copied, and truncated to BUNYAN_REQ_ID_LEN - 1 characters;
+ *	NULL clears it
+ */
+extern void bunyan_req_id_set(const char *req_id);
+
+/**
+ * @return the calling thread's request id, or NULL if it has none
+ */
+extern const char *bunyan_req_id(void);
+
+/**
+ * Exempts records logged by the calling thread from bunyan_limits(), or
+ * stops exempting them.
+ *
+ * @param unlimited
+ * @return the previous setting
+ */
+extern boolean_t bunyan_unlimited(boolean_t unlimited);
+
+/**
+ * Switches to writing records to `path` in the binary format described in
+ * blog.h, instead of to stdout as JSON.  Call before bunyan_async_start().
+ *
+ * Once the file reaches max_size bytes it is renamed to path.0 (path.0 to
+ * path.1, and so on, with the oldest beyond `keep` removed) and a new one
+ * started, which blog2json can read without the old ones.
+ *
+ * @param path appended to, or created
+ * @param max_size in bytes, or 0 to let the file grow without limit
+ * @param keep how many old files to keep
+ * @return 0 on success, -1 on error (records keep going to stdout)
+ */
+extern int bunyan_binary_start(const char *path, uint64_t max_size,
+			unsigned int keep);
+
+/**
+ * Switches to asynchronous output: records are queued in a ring of
+ * `records` entries (rounded up to a power of two) and written out by a
+ * background thread.  Fatal records are always flushed before returning.
+ *
+ * @param records
+ * @param block when the ring is full, wait for room (B_TRUE), or drop the
+ *	record and count it in log_records_dropped (B_FALSE)
+ * @return 0 on success, -1 on error (output stays synchronous)
+ */
+extern int bunyan_async_start(unsigned int records, boolean_t block);
+
+/**
+ * Waits until every record queued so far has been written.
+ */
+extern void bunyan_flush(void);
+
+/**
+ * Drains the ring, stops the writer thread, and goes back to writing
+ * records synchronously.
+ */
+extern void bunyan_async_stop(void);
+
 #ifdef __cplusplus
 }
 #endif
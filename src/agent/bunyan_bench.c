@@ -0,0 +1,139 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+/*
+ * Times logging with debug enabled, the way the agent logs an auth check:
+ * records of a few string and number fields, from one thread and from
+ * several, written synchronously and through the async ring.  Records go
+ * to /dev/null, so what's timed is building them.
+ *
+ * `make bench` builds this twice, once as the agent is built and once
+ * with BUNYAN_TIME_NOCACHE (every record formats its own timestamp), and
+ * runs both; the difference is what the per-thread timestamp cache saves.
+ *
+ *	make bench
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "bunyan.h"
+#include "util.h"
+
+#if defined(BUNYAN_TIME_NOCACHE)
+#define	VARIANT		"uncached"
+#else
+#define	VARIANT		"cached"
+#endif
+
+#define	RECORDS		1000000
+#define	THREADS_MAX	4
+#define	ASYNC_RECORDS	4096
+
+static FILE *g_out = NULL;
+
+/* What a typical debug record from the door path carries */
+static void *
+bench_thread(void *arg)
+{
+	unsigned int records = *(unsigned int *)arg;
+	unsigned int i;
+
+	bunyan_req_id_set("5b0f3c2e-bench");
+	for (i = 0; i < records; i++) {
+		(void) bunyan_debug("checking key",
+		    BUNYAN_STRING, "zone",
+		    "6a7d3c6e-e4f4-4d5e-9d1b-1c2b3a4d5e6f",
+		    BUNYAN_STRING, "fingerprint",
+		    "3b:4f:a1:9c:0e:77:12:d8:5a:6b:c3:f0:21:9e:44:aa",
+		    BUNYAN_INT32, "uid", 1000,
+		    BUNYAN_BOOLEAN, "allowed", B_TRUE,
+		    BUNYAN_NONE);
+	}
+	bunyan_req_id_set(NULL);
+
+	return (NULL);
+}
+
+/*
+ * Logs RECORDS records split across `threads` threads, and reports how
+ * long each took on average.
+ */
+static int
+bench(const char *what, unsigned int threads)
+{
+	pthread_t tids[THREADS_MAX];
+	unsigned int records = RECORDS / threads;
+	unsigned int i;
+	hrtime_t start, elapsed;
+	int err;
+
+	start = gethrtime();
+	for (i = 0; i < threads; i++) {
+		err = pthread_create(&tids[i], NULL, bench_thread, &records);
+		if (err != 0) {
+			(void) fprintf(stderr, "bunyan_bench: pthread_create: "
+			    "%s\n", strerror(err));
+			return (-1);
+		}
+	}
+	for (i = 0; i < threads; i++)
+		(void) pthread_join(tids[i], NULL);
+	bunyan_flush();
+	elapsed = gethrtime() - start;
+
+	(void) fprintf(g_out, "bunyan_bench (%s): %s, %u thread%s: "
+	    "%llu ns/record, %llu records/s\n", VARIANT, what, threads,
+	    threads == 1 ? "" : "s",
+	    (unsigned long long)(elapsed / (records * threads)),
+	    (unsigned long long)(NANOSEC * records * threads / elapsed));
+
+	return (0);
+}
+
+int
+main(void)
+{
+	int fd;
+
+	/* Keep stdout for the results, and send the records to /dev/null */
+	if ((fd = dup(STDOUT_FILENO)) < 0 ||
+	    (g_out = fdopen(fd, "w")) == NULL) {
+		perror("bunyan_bench: stdout");
+		return (1);
+	}
+	if ((fd = open("/dev/null", O_WRONLY)) < 0 ||
+	    dup2(fd, STDOUT_FILENO) < 0) {
+		perror("bunyan_bench: /dev/null");
+		return (1);
+	}
+	(void) close(fd);
+
+	(void) bunyan_level(BUNYAN_DEBUG);
+
+	if (bench("sync", 1) != 0 || bench("sync", THREADS_MAX) != 0)
+		return (1);
+
+	if (bunyan_async_start(ASYNC_RECORDS, B_TRUE) != 0) {
+		(void) fprintf(stderr, "bunyan_bench: bunyan_async_start "
+		    "failed\n");
+		return (1);
+	}
+	if (bench("async", 1) != 0 || bench("async", THREADS_MAX) != 0)
+		return (1);
+	bunyan_async_stop();
+
+	(void) fclose(g_out);
+
+	return (0);
+}
@@ -6,22 +6,109 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
+#include <atomic.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/time.h>
 
 #include <curl/curl.h>
 #include <curl/types.h>
 #include <curl/easy.h>
+#include <curl/multi.h>
 
+#include "batch.h"
 #include "bunyan.h"
 #include "capi.h"
+#include "endpoint.h"
+#include "latency.h"
+#include "limiter.h"
+#include "probes.h"
+#include "share.h"
+#include "span.h"
+#include "stats.h"
 #include "util.h"
 
 static const char *CAPI_URI = "%s/customers/%s/ssh_sessions";
 static const char *FORM_DATA = "fingerprint=%s&name=%s";
+static const char *CAPI_BATCH_URI = "%s/ssh_sessions/batch";
+static const char *BATCH_LINE = "customer_uuid=%s&fingerprint=%s&name=%s\n";
+
+/* Retry budget: one token is 1000 units, and we hold at most ten retries */
+#define	BUDGET_TOKEN		1000
+#define	BUDGET_MAX_TOKENS	10
+
+/* Don't judge the breaker's error rate on fewer attempts than this */
+#define	BREAKER_MIN_VOLUME	20
+#define	BREAKER_WINDOW		64
+
+static stats_counter_t *g_stat_breaker_opened = NULL;
+static stats_counter_t *g_stat_breaker_half_opened = NULL;
+static stats_counter_t *g_stat_breaker_closed = NULL;
+static stats_counter_t *g_stat_breaker_rejected = NULL;
+static stats_counter_t *g_stat_hedges = NULL;
+static stats_counter_t *g_stat_hedge_wins = NULL;
+static stats_counter_t *g_stat_batches = NULL;
+static stats_counter_t *g_stat_batch_items = NULL;
+static stats_counter_t *g_stat_batch_fallbacks = NULL;
+
+/* Don't hedge off a latency estimate built on fewer samples than this */
+#define	HEDGE_MIN_SAMPLES	50
+/* Window over which recent CAPI latency is tracked */
+#define	LATENCY_WINDOW_MS	60000
+/* Stick to the static timeouts until we have at least this much history */
+#define	ADAPTIVE_MIN_SAMPLES	100
+/* Longest we block in poll(2) without checking the clock */
+#define	CAPI_POLL_MS		100
+/* How long to stick to single requests once CAPI has refused a batch */
+#define	BATCH_RECHECK_MS	600000
+/* Room for one status line ("201\n", plus slack) per batched lookup */
+#define	BATCH_LINE_MAX		8
+/* Sockets we poll for one login; two legs need two, plus the resolver's */
+#define	CAPI_SOCKS_MAX		16
+
+/*
+ * One HTTP request within an attempt.  An attempt normally has a single
+ * leg; a hedged attempt has two racing each other.
+ */
+typedef struct capi_leg {
+	CURL *curl;
+	struct curl_slist *headers;
+	endpoint_t *endpoint;
+	char *url;
+	hrtime_t start;
+	hrtime_t end;
+	CURLcode res;
+	long http_code;
+	boolean_t running;
+	boolean_t limited;
+} capi_leg_t;
+
+/*
+ * The sockets curl wants watched for one login, kept up to date by
+ * capi_socket_callback().  We poll(2) these rather than select(2) on
+ * curl_multi_fdset(), since with two doors per zone our fds easily pass
+ * FD_SETSIZE.  If curl ever wants more than we have room for, we stop
+ * tracking and just nap and let curl check every socket itself.
+ */
+typedef struct capi_socks {
+	struct pollfd fds[CAPI_SOCKS_MAX];
+	int nfds;
+	boolean_t overflow;
+} capi_socks_t;
+
+/* Bounded buffer for a response body we actually read */
+typedef struct capi_buf {
+	char *data;
+	size_t len;
+	size_t size;
+} capi_buf_t;
 
 
 static char *
@@ -54,6 +141,46 @@ get_capi_form_data(const char *fp, const char *user)
 }
 
 
+static char *
+get_capi_batch_url(const char *url)
+{
+	char *buf = NULL;
+	int len = 0;
+
+	len = snprintf(NULL, 0, CAPI_BATCH_URI, url) + 1;
+	buf = xmalloc(len);
+	if (buf == NULL) {
+		return (NULL);
+	}
+	(void) snprintf(buf, len, CAPI_BATCH_URI, url);
+	return (buf);
+}
+
+
+static char *
+get_capi_batch_data(batch_item_t *items)
+{
+	batch_item_t *item = NULL;
+	char *buf = NULL;
+	size_t len = 0;
+	size_t off = 0;
+
+	for (item = items; item != NULL; item = item->next) {
+		len += snprintf(NULL, 0, BATCH_LINE, item->uuid, item->ssh_fp,
+		    item->user);
+	}
+	buf = xmalloc(len + 1);
+	if (buf == NULL) {
+		return (NULL);
+	}
+	for (item = items; item != NULL; item = item->next) {
+		off += snprintf(buf + off, len + 1 - off, BATCH_LINE,
+		    item->uuid, item->ssh_fp, item->user);
+	}
+	return (buf);
+}
+
+
 static size_t
 curl_callback(void *ptr, size_t size, size_t nmemb, void *data)
 {
@@ -61,23 +188,376 @@ curl_callback(void *ptr, size_t size, size_t nmemb, void *data)
 }
 
 
+/*
+ * Anything that doesn't fit can't be a well-formed answer, so returning
+ * short here (which makes curl fail the request) is what we want.
+ */
+static size_t
+capi_buf_callback(void *ptr, size_t size, size_t nmemb, void *data)
+{
+	capi_buf_t *buf = data;
+	size_t len = size * nmemb;
+
+	if (buf->len + len >= buf->size)
+		return (0);
+
+	(void) memcpy(buf->data + buf->len, ptr, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+	return (len);
+}
+
+
+static void
+capi_budget_init(capi_budget_t *budget, unsigned int pct)
+{
+	(void) pthread_mutex_init(&budget->lock, NULL);
+	budget->pct = pct;
+	budget->max = BUDGET_MAX_TOKENS * BUDGET_TOKEN;
+	budget->tokens = budget->max;
+}
+
+
+static void
+capi_budget_deposit(capi_budget_t *budget)
+{
+	(void) pthread_mutex_lock(&budget->lock);
+	budget->tokens += budget->pct * BUDGET_TOKEN / 100;
+	if (budget->tokens > budget->max)
+		budget->tokens = budget->max;
+	(void) pthread_mutex_unlock(&budget->lock);
+}
+
+
+static boolean_t
+capi_budget_withdraw(capi_budget_t *budget)
+{
+	boolean_t ok = B_FALSE;
+
+	(void) pthread_mutex_lock(&budget->lock);
+	if (budget->tokens >= BUDGET_TOKEN) {
+		budget->tokens -= BUDGET_TOKEN;
+		ok = B_TRUE;
+	}
+	(void) pthread_mutex_unlock(&budget->lock);
+
+	return (ok);
+}
+
+
+static void
+capi_breaker_init(capi_breaker_t *breaker)
+{
+	(void) pthread_mutex_init(&breaker->lock, NULL);
+	breaker->state = CAPI_BREAKER_CLOSED;
+	breaker->max_failures = 5;
+	breaker->error_pct = 50;
+	breaker->open_ms = 5000;
+}
+
+
+/* Caller holds breaker->lock */
+static void
+capi_breaker_open(capi_breaker_t *breaker)
+{
+	bunyan_warn("CAPI circuit breaker opened",
+	    BUNYAN_STRING, "from", (breaker->state == CAPI_BREAKER_HALF_OPEN ?
+	    "half-open" : "closed"),
+	    BUNYAN_INT32, "consecutive_failures", breaker->failures,
+	    BUNYAN_INT32, "window_failures",
+	    __builtin_popcountll(breaker->window),
+	    BUNYAN_INT32, "window_size", breaker->nwindow,
+	    BUNYAN_INT32, "open_ms", breaker->open_ms,
+	    BUNYAN_NONE);
+	stats_incr(g_stat_breaker_opened);
+
+	breaker->state = CAPI_BREAKER_OPEN;
+	breaker->opened = gethrtime();
+	breaker->probing = B_FALSE;
+}
+
+
+/*
+ * Decides whether a request may go to CAPI.  When the breaker has been open
+ * long enough, the first caller to get here becomes the half-open probe and
+ * has *probe set; everyone else keeps failing fast until it reports back.
+ */
+static boolean_t
+capi_breaker_allow(capi_breaker_t *breaker, boolean_t *probe)
+{
+	boolean_t allow = B_TRUE;
+
+	if (breaker->max_failures == 0 || *probe)
+		return (B_TRUE);
+
+	(void) pthread_mutex_lock(&breaker->lock);
+	switch (breaker->state) {
+	case CAPI_BREAKER_CLOSED:
+		break;
+	case CAPI_BREAKER_OPEN:
+		if (HR_MSEC(gethrtime() - breaker->opened) <
+		    breaker->open_ms) {
+			allow = B_FALSE;
+			break;
+		}
+		bunyan_info("CAPI circuit breaker half-open, probing",
+		    BUNYAN_NONE);
+		stats_incr(g_stat_breaker_half_opened);
+		breaker->state = CAPI_BREAKER_HALF_OPEN;
+		breaker->probing = B_TRUE;
+		*probe = B_TRUE;
+		break;
+	case CAPI_BREAKER_HALF_OPEN:
+		if (breaker->probing) {
+			allow = B_FALSE;
+			break;
+		}
+		breaker->probing = B_TRUE;
+		*probe = B_TRUE;
+		break;
+	}
+	(void) pthread_mutex_unlock(&breaker->lock);
+
+	return (allow);
+}
+
+
+/*
+ * Records the outcome of one attempt.  Results from requests that were
+ * already in flight when the breaker opened are ignored; only the probe
+ * decides how we leave half-open.
+ */
+static void
+capi_breaker_record(capi_breaker_t *breaker, boolean_t ok, boolean_t probe)
+{
+	unsigned int window_failures;
+
+	if (breaker->max_failures == 0)
+		return;
+
+	(void) pthread_mutex_lock(&breaker->lock);
+	if (probe) {
+		if (ok) {
+			bunyan_info("CAPI circuit breaker closed",
+			    BUNYAN_NONE);
+			stats_incr(g_stat_breaker_closed);
+			breaker->state = CAPI_BREAKER_CLOSED;
+			breaker->probing = B_FALSE;
+			breaker->failures = 0;
+			breaker->window = 0;
+			breaker->nwindow = 0;
+		} else {
+			capi_breaker_open(breaker);
+		}
+		goto out;
+	}
+
+	if (breaker->state != CAPI_BREAKER_CLOSED)
+		goto out;
+
+	breaker->window <<= 1;
+	if (breaker->nwindow < BREAKER_WINDOW)
+		breaker->nwindow++;
+	if (ok) {
+		breaker->failures = 0;
+		goto out;
+	}
+	breaker->window |= 1;
+	breaker->failures++;
+
+	window_failures = __builtin_popcountll(breaker->window);
+	if (breaker->failures >= breaker->max_failures ||
+	    (breaker->nwindow >= BREAKER_MIN_VOLUME &&
+	    window_failures * 100 >= breaker->error_pct * breaker->nwindow)) {
+		capi_breaker_open(breaker);
+	}
+
+out:
+	(void) pthread_mutex_unlock(&breaker->lock);
+}
+
+
+/*
+ * Milliseconds to wait before the given (1-based) retry.  This is "full
+ * jitter" backoff, so concurrent logins that failed together don't all come
+ * back at CAPI in the same instant.
+ */
+static long
+capi_backoff_ms(capi_handle_t *handle, int retry)
+{
+	long cap = (long)handle->retry_sleep * 1000;
+	long ceiling = handle->retry_backoff_ms;
+
+	while (--retry > 0 && ceiling < cap)
+		ceiling <<= 1;
+	if (ceiling > cap)
+		ceiling = cap;
+	if (ceiling <= 0)
+		return (0);
+
+	return (lrand48() % (ceiling + 1));
+}
+
+
+static void
+capi_sleep_ms(long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		continue;
+}
+
+
+/*
+ * Works out a timeout from recent latency: the p99 scaled by
+ * timeout_multiplier_pct and clamped to [timeout_floor_ms, ceiling_ms].
+ * Without enough history (or with adaptation disabled) it's just the
+ * ceiling, which is the old static behaviour.
+ */
+static long
+capi_timeout_ms(capi_handle_t *handle, latency_t *latency, long ceiling_ms)
+{
+	hrtime_t p99;
+	long timeout_ms;
+
+	if (handle->timeout_multiplier_pct == 0)
+		return (ceiling_ms);
+
+	p99 = latency_percentile(latency, 99, ADAPTIVE_MIN_SAMPLES);
+	if (p99 == 0)
+		return (ceiling_ms);
+
+	timeout_ms = (long)(HR_MSEC(p99) * handle->timeout_multiplier_pct /
+	    100);
+	if (timeout_ms < (long)handle->timeout_floor_ms)
+		timeout_ms = handle->timeout_floor_ms;
+	if (timeout_ms > ceiling_ms)
+		timeout_ms = ceiling_ms;
+
+	return (timeout_ms);
+}
+
+
+/*
+ * Records how long a successful leg took to connect.  Requests that reused
+ * a connection didn't connect at all, and are left out so they don't drag
+ * the connect timeout down to nothing.  curl says how many new connections
+ * the transfer made; CONNECT_TIME isn't a safe tell, since a reused
+ * connection can still report the (tiny) time it took curl to pick it.
+ */
+static void
+capi_record_connect(capi_handle_t *handle, capi_leg_t *leg)
+{
+	double connect = 0;
+	double appconnect = 0;
+	long connects = 0;
+
+	if (curl_easy_getinfo(leg->curl, CURLINFO_NUM_CONNECTS,
+	    &connects) != CURLE_OK || connects <= 0)
+		return;
+
+	curl_easy_getinfo(leg->curl, CURLINFO_CONNECT_TIME, &connect);
+	curl_easy_getinfo(leg->curl, CURLINFO_APPCONNECT_TIME, &appconnect);
+	if (appconnect > connect)
+		connect = appconnect;
+	latency_record(handle->connect_latency,
+	    (hrtime_t)(connect * 1000000000.0));
+}
+
+
+/*
+ * Records where an attempt's time went.  curl's timings all run from the
+ * start of the request, so each phase is the difference from the last one
+ * that happened; whatever's left of the total (sending, CAPI thinking, and
+ * reading the answer) is transfer.
+ */
+static void
+capi_span_attempt(span_t *span, capi_leg_t *leg, hrtime_t backoff,
+		boolean_t hedged)
+{
+	span_attempt_t *attempt = span_attempt(span);
+	double namelookup = 0;
+	double connect = 0;
+	double appconnect = 0;
+	double prev;
+
+	if (attempt == NULL)
+		return;
+
+	curl_easy_getinfo(leg->curl, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+	curl_easy_getinfo(leg->curl, CURLINFO_CONNECT_TIME, &connect);
+	curl_easy_getinfo(leg->curl, CURLINFO_APPCONNECT_TIME, &appconnect);
+
+	attempt->backoff = backoff;
+	attempt->total = leg->end - leg->start;
+	attempt->dns = (hrtime_t)(namelookup * 1000000000.0);
+	prev = namelookup;
+	if (connect > prev) {
+		attempt->connect = (hrtime_t)((connect - prev) * 1000000000.0);
+		prev = connect;
+	}
+	if (appconnect > prev) {
+		attempt->tls = (hrtime_t)((appconnect - prev) * 1000000000.0);
+		prev = appconnect;
+	}
+	attempt->transfer = attempt->total - (hrtime_t)(prev * 1000000000.0);
+	if (attempt->transfer < 0)
+		attempt->transfer = 0;
+	attempt->res = leg->res;
+	attempt->http_code = leg->http_code;
+	attempt->hedged = hedged;
+}
+
+
+/*
+ * Clamps a per-attempt timeout to whatever is left before the deadline.
+ * curl treats a zero timeout as "forever", so never hand it one.
+ */
+static long
+capi_clamp_ms(long timeout_ms, long remaining_ms)
+{
+	if (remaining_ms >= 0 && remaining_ms < timeout_ms)
+		timeout_ms = remaining_ms;
+
+	return (timeout_ms > 0 ? timeout_ms : 1);
+}
+
+
+/*
+ * Creates a handle for a CAPI request.  If the calling thread is working on
+ * a request with an id, it goes to CAPI as x-request-id, and *headers must
+ * be freed with curl_slist_free_all() once the handle is done with.
+ */
 static CURL *
-get_curl_handle(capi_handle_t *handle, const char *url, const char *form_data)
+get_curl_handle(capi_handle_t *handle, const char *form_data,
+		struct curl_slist **headers)
 {
 	CURL * curl = NULL;
+	const char *req_id = bunyan_req_id();
+	char header[sizeof ("x-request-id: ") + BUNYAN_REQ_ID_LEN];
 
+	*headers = NULL;
 	curl = curl_easy_init();
 	if (curl == NULL)
 		return (NULL);
 
-	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, handle->connect_timeout);
-	curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, -1);
+	if (req_id != NULL) {
+		(void) snprintf(header, sizeof (header), "x-request-id: %s",
+		    req_id);
+		*headers = curl_slist_append(NULL, header);
+		if (*headers != NULL)
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *headers);
+	}
+
+	/* With no prober running, nothing else keeps DNS entries fresh */
+	share_attach(curl, handle->endpoints->probe_ms == 0);
 	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 0);
 	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, form_data);
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, handle->timeout);
-	curl_easy_setopt(curl, CURLOPT_URL, url);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_callback);
 	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
 
@@ -85,6 +565,501 @@ get_curl_handle(capi_handle_t *handle, const char *url, const char *form_data)
 }
 
 
+static boolean_t
+capi_leg_failed(capi_leg_t *leg)
+{
+	return (leg->res != 0 || leg->http_code == 0 || leg->http_code >= 500);
+}
+
+
+/*
+ * Sends one request to an endpoint (other than `avoid`, if possible) and
+ * adds it to the multi handle.  If `limited`, the leg holds a limiter slot,
+ * which it gives back when it's cleaned up (or here, if it can't start).
+ */
+static boolean_t
+capi_leg_start(capi_handle_t *handle, CURLM *multi, capi_leg_t *leg,
+		endpoint_t *avoid, const char *uuid, const char *form_data,
+		hrtime_t deadline, boolean_t limited)
+{
+	long remaining_ms = -1;
+	long connect_ms;
+	long timeout_ms;
+
+	(void) memset(leg, 0, sizeof (capi_leg_t));
+	leg->limited = limited;
+	leg->endpoint = endpoint_acquire(handle->endpoints, avoid);
+	leg->url = get_capi_url(leg->endpoint->url, uuid);
+	leg->curl = get_curl_handle(handle, form_data, &leg->headers);
+	if (leg->url == NULL || leg->curl == NULL)
+		goto err;
+
+	if (deadline != 0)
+		remaining_ms = HR_MSEC(deadline - gethrtime());
+	timeout_ms = (long)handle->timeout * 1000;
+	if (handle->timeout_ceiling_ms != 0)
+		timeout_ms = handle->timeout_ceiling_ms;
+	timeout_ms = capi_clamp_ms(capi_timeout_ms(handle, handle->latency,
+	    timeout_ms), remaining_ms);
+	connect_ms = capi_clamp_ms(capi_timeout_ms(handle,
+	    handle->connect_latency, (long)handle->connect_timeout * 1000),
+	    remaining_ms);
+	curl_easy_setopt(leg->curl, CURLOPT_URL, leg->url);
+	curl_easy_setopt(leg->curl, CURLOPT_CONNECTTIMEOUT_MS, connect_ms);
+	curl_easy_setopt(leg->curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+
+	if (curl_multi_add_handle(multi, leg->curl) != CURLM_OK)
+		goto err;
+
+	bunyan_trace("capi_is_allowed: POSTing",
+	    BUNYAN_STRING, "form_data", form_data,
+	    BUNYAN_STRING, "url", leg->url,
+	    BUNYAN_INT32, "connect_timeout_ms", connect_ms,
+	    BUNYAN_INT32, "timeout_ms", timeout_ms,
+	    BUNYAN_NONE);
+
+	SMARTLOGIN_CAPI_ATTEMPT_START(leg->url, uuid);
+	leg->start = gethrtime();
+	leg->running = B_TRUE;
+	return (B_TRUE);
+
+err:
+	if (leg->limited)
+		limiter_release(handle->limiter, 0, B_FALSE);
+	leg->limited = B_FALSE;
+	endpoint_release(handle->endpoints, leg->endpoint, 0, B_FALSE);
+	leg->endpoint = NULL;
+	xfree(leg->url);
+	leg->url = NULL;
+	if (leg->curl != NULL)
+		curl_easy_cleanup(leg->curl);
+	leg->curl = NULL;
+	curl_slist_free_all(leg->headers);
+	leg->headers = NULL;
+	return (B_FALSE);
+}
+
+
+/*
+ * Tears down a leg, aborting it if it's still in flight.  An abandoned leg
+ * isn't held against its endpoint, but its elapsed time still is.  It
+ * says nothing about CAPI's round trip time, though, so the limiter only
+ * learns from legs that finished.
+ */
+static void
+capi_leg_cleanup(capi_handle_t *handle, CURLM *multi, capi_leg_t *leg)
+{
+	if (leg->curl == NULL)
+		return;
+
+	if (leg->limited) {
+		limiter_release(handle->limiter,
+		    (leg->running ? 0 : leg->end - leg->start),
+		    !capi_leg_failed(leg));
+	}
+	if (leg->running)
+		leg->end = gethrtime();
+	endpoint_release(handle->endpoints, leg->endpoint,
+	    leg->end - leg->start, leg->running || !capi_leg_failed(leg));
+
+	(void) curl_multi_remove_handle(multi, leg->curl);
+	curl_easy_cleanup(leg->curl);
+	curl_slist_free_all(leg->headers);
+	xfree(leg->url);
+	(void) memset(leg, 0, sizeof (capi_leg_t));
+}
+
+
+/* CURLMOPT_SOCKETFUNCTION: curl telling us what to watch a socket for */
+static int
+capi_socket_callback(CURL *curl, curl_socket_t s, int what, void *userp,
+		void *socketp)
+{
+	capi_socks_t *socks = userp;
+	short events = 0;
+	int i;
+
+	for (i = 0; i < socks->nfds && socks->fds[i].fd != s; i++)
+		continue;
+
+	if (what == CURL_POLL_REMOVE) {
+		if (i < socks->nfds)
+			socks->fds[i] = socks->fds[--socks->nfds];
+		return (0);
+	}
+
+	if (what == CURL_POLL_IN || what == CURL_POLL_INOUT)
+		events |= POLLIN;
+	if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT)
+		events |= POLLOUT;
+
+	if (i == socks->nfds) {
+		if (socks->nfds == CAPI_SOCKS_MAX) {
+			bunyan_debug("capi_socket_callback: too many sockets, "
+			    "polling instead",
+			    BUNYAN_INT32, "max", CAPI_SOCKS_MAX,
+			    BUNYAN_NONE);
+			socks->overflow = B_TRUE;
+			return (0);
+		}
+		socks->nfds++;
+		socks->fds[i].fd = s;
+	}
+	socks->fds[i].events = events;
+	socks->fds[i].revents = 0;
+
+	return (0);
+}
+
+
+/*
+ * Lets curl get on with whatever the last capi_wait() found for it to do:
+ * the sockets that are ready, or its timers if none are.
+ */
+static void
+capi_socks_action(CURLM *multi, capi_socks_t *socks)
+{
+	curl_socket_t ready[CAPI_SOCKS_MAX];
+	int masks[CAPI_SOCKS_MAX];
+	int nready = 0;
+	int running = 0;
+	int i;
+
+	if (socks->overflow) {
+		while (curl_multi_socket_all(multi, &running) ==
+		    CURLM_CALL_MULTI_PERFORM)
+			continue;
+		return;
+	}
+
+	/*
+	 * Acting on a socket can change the set, so take a copy first.  A
+	 * socket curl closed without telling us only ever polls as invalid,
+	 * so stop watching it.
+	 */
+	for (i = socks->nfds - 1; i >= 0; i--) {
+		if (socks->fds[i].revents & POLLNVAL) {
+			socks->fds[i] = socks->fds[--socks->nfds];
+			continue;
+		}
+		if (socks->fds[i].revents == 0)
+			continue;
+		ready[nready] = socks->fds[i].fd;
+		masks[nready] = 0;
+		if (socks->fds[i].revents & (POLLIN | POLLHUP))
+			masks[nready] |= CURL_CSELECT_IN;
+		if (socks->fds[i].revents & POLLOUT)
+			masks[nready] |= CURL_CSELECT_OUT;
+		if (socks->fds[i].revents & POLLERR)
+			masks[nready] |= CURL_CSELECT_ERR;
+		socks->fds[i].revents = 0;
+		nready++;
+	}
+
+	for (i = 0; i < nready; i++) {
+		while (curl_multi_socket_action(multi, ready[i], masks[i],
+		    &running) == CURLM_CALL_MULTI_PERFORM)
+			continue;
+	}
+
+	while (curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0,
+	    &running) == CURLM_CALL_MULTI_PERFORM)
+		continue;
+}
+
+
+/*
+ * Blocks until one of curl's sockets is ready, curl wants to be called
+ * back, or `until` (if non-zero) arrives.
+ */
+static void
+capi_wait(CURLM *multi, capi_socks_t *socks, hrtime_t until)
+{
+	long timeout_ms = -1;
+	long until_ms;
+
+	(void) curl_multi_timeout(multi, &timeout_ms);
+	if (timeout_ms < 0 || timeout_ms > CAPI_POLL_MS)
+		timeout_ms = CAPI_POLL_MS;
+	if (until != 0) {
+		until_ms = (long)((until - gethrtime() + 999999) / 1000000);
+		if (until_ms < timeout_ms)
+			timeout_ms = until_ms > 0 ? until_ms : 0;
+	}
+	if (timeout_ms == 0)
+		return;
+
+	if (socks->nfds == 0 || socks->overflow) {
+		/*
+		 * curl is between sockets (e.g. resolving), or has more than
+		 * we can watch; just nap.
+		 */
+		capi_sleep_ms(timeout_ms < 10 ? timeout_ms : 10);
+		return;
+	}
+
+	(void) poll(socks->fds, socks->nfds, (int)timeout_ms);
+}
+
+
+/*
+ * Runs one attempt to completion and returns the leg that answered, or the
+ * last one to fail (NULL if we couldn't send anything at all).  If
+ * `limited`, the caller has taken a limiter slot for the first leg.
+ *
+ * When hedging is on and there's enough history, we wait for the configured
+ * percentile of recent latency.  If nothing has come back by then, and the
+ * hedge budget allows, a duplicate goes to a second endpoint (or, if there is
+ * only one, over a second connection) and the first answer wins.  The hedge
+ * is a second connection to CAPI, so it needs a slot of its own, and goes
+ * without rather than wait for one.
+ */
+static capi_leg_t *
+capi_attempt(capi_handle_t *handle, CURLM *multi, capi_socks_t *socks,
+		capi_leg_t legs[2], endpoint_t *avoid, const char *uuid,
+		const char *form_data, hrtime_t deadline, boolean_t limited)
+{
+	capi_leg_t *leg = NULL;
+	capi_leg_t *winner = NULL;
+	CURLMsg *msg = NULL;
+	hrtime_t hedge_at = 0;
+	hrtime_t delay;
+	int nlegs = 0;
+	int left = 0;
+	int i;
+
+	if (!capi_leg_start(handle, multi, &legs[0], avoid, uuid, form_data,
+	    deadline, limited))
+		return (NULL);
+	nlegs = 1;
+
+	if (handle->hedge_pct != 0) {
+		delay = latency_percentile(handle->latency, handle->hedge_pct,
+		    HEDGE_MIN_SAMPLES);
+		if (delay > 0)
+			hedge_at = legs[0].start + delay;
+		if (deadline != 0 && hedge_at >= deadline)
+			hedge_at = 0;
+	}
+
+	while (winner == NULL) {
+		capi_socks_action(multi, socks);
+
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			leg = (msg->easy_handle == legs[0].curl ?
+			    &legs[0] : &legs[1]);
+			leg->end = gethrtime();
+			leg->res = msg->data.result;
+			leg->running = B_FALSE;
+			if (leg->res == 0) {
+				curl_easy_getinfo(leg->curl,
+				    CURLINFO_RESPONSE_CODE, &leg->http_code);
+			}
+			SMARTLOGIN_CAPI_ATTEMPT_DONE(leg->url, leg->res,
+			    leg->http_code, leg->end - leg->start);
+
+			bunyan_trace("capi_is_allowed request performed",
+			    BUNYAN_STRING, "url", leg->url,
+			    BUNYAN_STRING, "reachable?",
+			    (leg->res == 0 ? "yes" : "no"),
+			    BUNYAN_INT32, "timing_us",
+			    HR_USEC(leg->end - leg->start),
+			    BUNYAN_NONE);
+
+			if (!capi_leg_failed(leg) && winner == NULL)
+				winner = leg;
+		}
+		if (winner != NULL)
+			break;
+
+		/* Everything we sent has failed */
+		for (i = 0; i < nlegs && !legs[i].running; i++)
+			continue;
+		if (i == nlegs) {
+			winner = &legs[0];
+			if (nlegs == 2 && legs[1].end > legs[0].end)
+				winner = &legs[1];
+			break;
+		}
+
+		if (hedge_at != 0 && gethrtime() >= hedge_at) {
+			hedge_at = 0;
+			if (limited && !limiter_try_acquire(handle->limiter))
+				continue;
+			if (!capi_budget_withdraw(&handle->hedge_budget)) {
+				if (limited) {
+					limiter_release(handle->limiter, 0,
+					    B_FALSE);
+				}
+				continue;
+			}
+			if (capi_leg_start(handle, multi, &legs[1],
+			    legs[0].endpoint, uuid, form_data, deadline,
+			    limited)) {
+				bunyan_debug("hedging CAPI request",
+				    BUNYAN_STRING, "url", legs[0].url,
+				    BUNYAN_STRING, "hedge_url", legs[1].url,
+				    BUNYAN_NONE);
+				stats_incr(g_stat_hedges);
+				nlegs = 2;
+			}
+			continue;
+		}
+
+		capi_wait(multi, socks, hedge_at);
+	}
+
+	if (winner == &legs[1] && !capi_leg_failed(winner))
+		stats_incr(g_stat_hedge_wins);
+
+	return (winner);
+}
+
+
+/*
+ * Parses a batch response: one status code per line, in request order.
+ * Items we can't find an answer for are left as BATCH_FALLBACK.
+ */
+static void
+capi_batch_parse(batch_item_t *items, const char *body)
+{
+	batch_item_t *item = NULL;
+	const char *p = body;
+	char *end = NULL;
+	long code;
+
+	for (item = items; item != NULL; item = item->next) {
+		code = strtol(p, &end, 10);
+		if (end == p)
+			break;
+
+		if (code == 201)
+			item->result = CAPI_ALLOWED;
+		else if (code > 0 && code < 500)
+			item->result = CAPI_DENIED;
+
+		p = strchr(end, '\n');
+		if (p == NULL)
+			break;
+		p++;
+	}
+}
+
+
+/*
+ * batch_send_t for the handle's batcher.  Batches get exactly one try: if it
+ * fails, every lookup in it falls back to its own single request, with the
+ * usual retries.
+ *
+ * This runs on the batch leader's thread, so the batch goes out with the
+ * leader's request id.
+ */
+static void
+capi_batch_send(void *arg, batch_item_t *items, unsigned int count,
+		hrtime_t deadline)
+{
+	capi_handle_t *handle = arg;
+	batch_item_t *item = NULL;
+	endpoint_t *endpoint = NULL;
+	CURL *curl = NULL;
+	struct curl_slist *headers = NULL;
+	char *url = NULL;
+	char *body = NULL;
+	capi_buf_t buf;
+	CURLcode res = 0;
+	long http_code = 0;
+	long remaining_ms = -1;
+	hrtime_t start = 0;
+	hrtime_t end = 0;
+	boolean_t ok = B_FALSE;
+
+	(void) memset(&buf, 0, sizeof (buf));
+
+	stats_incr(g_stat_batches);
+	stats_add(g_stat_batch_items, count);
+
+	endpoint = endpoint_acquire(handle->endpoints, NULL);
+	url = get_capi_batch_url(endpoint->url);
+	body = get_capi_batch_data(items);
+	buf.size = (size_t)count * BATCH_LINE_MAX + 1;
+	buf.data = xmalloc(buf.size);
+	if (url == NULL || body == NULL || buf.data == NULL)
+		goto out;
+	curl = get_curl_handle(handle, body, &headers);
+	if (curl == NULL)
+		goto out;
+
+	if (deadline != 0)
+		remaining_ms = HR_MSEC(deadline - gethrtime());
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, capi_buf_callback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+	    capi_clamp_ms((long)handle->connect_timeout * 1000, remaining_ms));
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
+	    capi_clamp_ms((long)handle->timeout * 1000, remaining_ms));
+
+	bunyan_trace("capi_batch_send: POSTing",
+	    BUNYAN_STRING, "url", url,
+	    BUNYAN_INT32, "count", count,
+	    BUNYAN_NONE);
+
+	/*
+	 * The whole batch is one request, so it takes one slot, held just
+	 * for the round trip.  If there isn't one, everyone goes it alone.
+	 */
+	if (!limiter_acquire(handle->limiter, deadline))
+		goto out;
+	SMARTLOGIN_CAPI_ATTEMPT_START(url, NULL);
+	start = gethrtime();
+	res = curl_easy_perform(curl);
+	end = gethrtime();
+	if (res == 0)
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	SMARTLOGIN_CAPI_ATTEMPT_DONE(url, res, http_code, end - start);
+
+	ok = (res == 0 && http_code != 0 && http_code < 500);
+	limiter_release(handle->limiter, end - start, ok);
+	capi_breaker_record(&handle->breaker, ok, B_FALSE);
+
+	if (http_code == 404 || http_code == 405 || http_code == 501) {
+		bunyan_info("CAPI doesn't support batched lookups, "
+		    "using single requests",
+		    BUNYAN_STRING, "url", url,
+		    BUNYAN_INT32, "http_code", http_code,
+		    BUNYAN_INT32, "recheck_ms", BATCH_RECHECK_MS,
+		    BUNYAN_NONE);
+		(void) atomic_swap_64(&handle->batch_retry_at,
+		    (uint64_t)(end + BATCH_RECHECK_MS * 1000000LL));
+	} else if (http_code != 200) {
+		bunyan_info("CAPI batch failed",
+		    BUNYAN_STRING, "url", url,
+		    BUNYAN_INT32, "count", count,
+		    BUNYAN_INT32, "res", res,
+		    BUNYAN_INT32, "http_code", http_code,
+		    BUNYAN_NONE);
+	} else {
+		capi_batch_parse(items, buf.data);
+	}
+
+out:
+	endpoint_release(handle->endpoints, endpoint, end - start, ok);
+	for (item = items; item != NULL; item = item->next) {
+		if (item->result == BATCH_FALLBACK)
+			stats_incr(g_stat_batch_fallbacks);
+	}
+
+	if (curl != NULL)
+		curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
+	xfree(url);
+	xfree(body);
+	xfree(buf.data);
+}
+
+
 capi_handle_t *
 capi_handle_create(const char *url)
 {
@@ -103,10 +1078,46 @@ capi_handle_create(const char *url)
 	handle->connect_timeout = 1;
 	handle->retries = 1;
 	handle->retry_sleep = 1;
+	handle->retry_backoff_ms = 100;
 	handle->timeout = 3;
+	handle->batch_max = 32;
+	handle->dns_ttl = 60;
+	handle->limit_min = 2;
+	handle->limit_max = 64;
+	handle->limit_queue_max = 256;
+	capi_budget_init(&handle->retry_budget, 20);
+	capi_budget_init(&handle->hedge_budget, 10);
+	capi_breaker_init(&handle->breaker);
 
-	handle->url = xstrdup(url);
-	if (handle->url == NULL) {
+	handle->timeout_floor_ms = 250;
+	handle->timeout_multiplier_pct = 300;
+
+	handle->latency = latency_create(LATENCY_WINDOW_MS);
+	handle->connect_latency = latency_create(LATENCY_WINDOW_MS);
+	if (handle->latency == NULL || handle->connect_latency == NULL) {
+		capi_handle_destroy(handle);
+		return (NULL);
+	}
+
+	if (g_stat_breaker_opened == NULL) {
+		g_stat_breaker_opened =
+		    stats_counter_create("capi_breaker_opened");
+		g_stat_breaker_half_opened =
+		    stats_counter_create("capi_breaker_half_opened");
+		g_stat_breaker_closed =
+		    stats_counter_create("capi_breaker_closed");
+		g_stat_breaker_rejected =
+		    stats_counter_create("capi_breaker_rejected");
+		g_stat_hedges = stats_counter_create("capi_hedges");
+		g_stat_hedge_wins = stats_counter_create("capi_hedge_wins");
+		g_stat_batches = stats_counter_create("capi_batches");
+		g_stat_batch_items = stats_counter_create("capi_batch_items");
+		g_stat_batch_fallbacks =
+		    stats_counter_create("capi_batch_fallbacks");
+	}
+
+	handle->endpoints = endpoint_pool_create(url);
+	if (handle->endpoints == NULL) {
 		capi_handle_destroy(handle);
 		return (NULL);
 	}
@@ -119,29 +1130,81 @@ void
 capi_handle_destroy(capi_handle_t *handle)
 {
 	if (handle != NULL) {
-		xfree(handle->url);
+		(void) pthread_mutex_destroy(&handle->retry_budget.lock);
+		(void) pthread_mutex_destroy(&handle->hedge_budget.lock);
+		(void) pthread_mutex_destroy(&handle->breaker.lock);
+		batcher_destroy(handle->batcher);
+		limiter_destroy(handle->limiter);
+		latency_destroy(handle->latency);
+		latency_destroy(handle->connect_latency);
+		endpoint_pool_destroy(handle->endpoints);
+		share_fini();
 		xfree(handle);
 	}
 }
 
 
 boolean_t
+capi_handle_start(capi_handle_t *handle)
+{
+	if (handle == NULL) {
+		bunyan_debug("capi_handle_start: NULL arguments",
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	if (!share_init(handle->dns_ttl))
+		return (B_FALSE);
+
+	if (handle->limit_max != 0) {
+		handle->limiter = limiter_create(handle->limit_min,
+		    handle->limit_max, handle->limit_queue_max);
+		if (handle->limiter == NULL)
+			return (B_FALSE);
+	}
+
+	if (handle->batch_window_ms != 0 && handle->batch_max > 1) {
+		handle->batcher = batcher_create(handle->batch_window_ms,
+		    handle->batch_max, capi_batch_send, handle);
+		if (handle->batcher == NULL)
+			return (B_FALSE);
+	}
+
+	return (endpoint_pool_start(handle->endpoints));
+}
+
+
+capi_result_t
 capi_is_allowed(capi_handle_t *handle, const char *uuid,
-		const char *ssh_fp, const char *user)
+		const char *ssh_fp, const char *user, hrtime_t deadline,
+		span_t *span)
 {
-	boolean_t allowed = B_FALSE;
+	capi_result_t result = CAPI_UNAVAILABLE;
 	char *form_data = NULL;
-	char *url = NULL;
-	CURL *curl = NULL;
+	CURLM *multi = NULL;
+	capi_socks_t socks;
+	capi_leg_t legs[2];
+	capi_leg_t *leg = NULL;
+	batch_item_t item;
 	CURLcode res = 0;
 	int attempts = 0;
-	hrtime_t start, end;
 	long http_code = 0;
+	long backoff_ms = 0;
+	hrtime_t backoff = 0;
+	hrtime_t attempt_deadline;
+	hrtime_t now;
+	boolean_t probe = B_FALSE;
+	boolean_t limited = B_FALSE;
+	boolean_t failed = B_FALSE;
+	endpoint_t *endpoint = NULL;
+
+	(void) memset(legs, 0, sizeof (legs));
+	(void) memset(&socks, 0, sizeof (socks));
 
 	if (handle == NULL || uuid == NULL || ssh_fp == NULL || user == NULL) {
 		bunyan_debug("capi_is_allowed: NULL arguments",
 		    BUNYAN_NONE);
-		return (B_FALSE);
+		return (CAPI_UNAVAILABLE);
 	}
 
 	bunyan_debug("capi_is_allowed",
@@ -151,62 +1214,180 @@ capi_is_allowed(capi_handle_t *handle, const char *uuid,
 	    BUNYAN_STRING, "user", user,
 	    BUNYAN_NONE);
 
-	url = get_capi_url(handle->url, uuid);
-	if (url == NULL)
-		goto out;
+	if (!capi_breaker_allow(&handle->breaker, &probe)) {
+		bunyan_debug("capi_is_allowed: circuit open, failing fast",
+		    BUNYAN_NONE);
+		stats_incr(g_stat_breaker_rejected);
+		return (CAPI_UNAVAILABLE);
+	}
+
+	/* The half-open probe always goes on its own */
+	if (handle->batcher != NULL && !probe &&
+	    gethrtime() >= (hrtime_t)atomic_add_64_nv(&handle->batch_retry_at,
+	    0)) {
+		item.uuid = uuid;
+		item.ssh_fp = ssh_fp;
+		item.user = user;
+		if (batcher_submit(handle->batcher, &item, deadline) !=
+		    BATCH_FALLBACK) {
+			result = item.result;
+			if (span != NULL)
+				span->batched = B_TRUE;
+			goto out;
+		}
+	}
+
 	form_data = get_capi_form_data(ssh_fp, user);
 	if (form_data == NULL)
 		goto out;
 
-	curl = get_curl_handle(handle, url, form_data);
-	if (curl == NULL)
+	multi = curl_multi_init();
+	if (multi == NULL)
 		goto out;
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, capi_socket_callback);
+	curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, &socks);
 
-	do {
-		bunyan_trace("capi_is_allowed: POSTing",
-		    BUNYAN_STRING, "form_data", form_data,
-		    BUNYAN_STRING, "url", url,
-		    BUNYAN_NONE);
+	capi_budget_deposit(&handle->retry_budget);
+	capi_budget_deposit(&handle->hedge_budget);
 
-		start = gethrtime();
-		res = curl_easy_perform(curl);
-		end = gethrtime();
+	for (;;) {
+		if (deadline != 0 && deadline <= gethrtime()) {
+			bunyan_info("CAPI deadline exceeded",
+			    BUNYAN_INT32, "attempts", attempts,
+			    BUNYAN_NONE);
+			break;
+		}
 
-		bunyan_trace("capi_is_allowed request performed",
-		    BUNYAN_STRING, "reachable?", (res == 0 ? "yes" : "no"),
-		    BUNYAN_INT32, "timing_us", HR_USEC(end - start),
-		    BUNYAN_NONE);
+		/*
+		 * Wait our turn rather than piling onto CAPI.  The slot is
+		 * only held while the request is in flight, not across the
+		 * backoff, so the limiter learns CAPI's round trip time.  The
+		 * half-open probe skips the queue: it's one request, and the
+		 * breaker needs its answer.
+		 */
+		if (!probe) {
+			now = gethrtime();
+			limited = limiter_acquire(handle->limiter, deadline);
+			if (span != NULL)
+				span->limit_wait += gethrtime() - now;
+			if (!limited) {
+				bunyan_info("CAPI concurrency limit reached",
+				    BUNYAN_STRING, "uuid", uuid,
+				    BUNYAN_INT32, "attempts", attempts,
+				    BUNYAN_NONE);
+				break;
+			}
+		}
 
-		if (res == 0)
+		/*
+		 * If we could still retry, only give this attempt half of
+		 * what's left, so a slow instance doesn't eat the whole
+		 * login budget before the retry gets its chance.
+		 */
+		attempt_deadline = deadline;
+		if (deadline != 0 && attempts + 1 < handle->retries) {
+			now = gethrtime();
+			attempt_deadline = now + (deadline - now) / 2;
+			if (HR_MSEC(attempt_deadline - now) <
+			    handle->timeout_floor_ms) {
+				attempt_deadline = now +
+				    handle->timeout_floor_ms * 1000000LL;
+			}
+			if (attempt_deadline > deadline)
+				attempt_deadline = deadline;
+		}
+
+		/* Retries go to a different instance whenever there is one */
+		leg = capi_attempt(handle, multi, &socks, legs, endpoint,
+		    uuid, form_data, attempt_deadline, !probe);
+		if (leg == NULL)
 			break;
 
-		bunyan_info("CAPI network error",
-		    BUNYAN_INT32, "res", res,
-		    BUNYAN_STRING, "error", curl_easy_strerror(res),
-		    BUNYAN_NONE);
+		endpoint = leg->endpoint;
+		res = leg->res;
+		http_code = leg->http_code;
+		failed = capi_leg_failed(leg);
+		if (!failed) {
+			latency_record(handle->latency, leg->end - leg->start);
+			capi_record_connect(handle, leg);
+		}
+		capi_span_attempt(span, leg, backoff, legs[1].curl != NULL);
+		capi_leg_cleanup(handle, multi, &legs[0]);
+		capi_leg_cleanup(handle, multi, &legs[1]);
 
-		if (++attempts < handle->retries)
-			(void) sleep(handle->retry_sleep);
-	} while (attempts < handle->retries);
+		capi_breaker_record(&handle->breaker, !failed, probe);
+		if (!failed) {
+			result = (http_code == 201 ? CAPI_ALLOWED :
+			    CAPI_DENIED);
+			break;
+		}
+
+		if (res != 0) {
+			bunyan_info("CAPI network error",
+			    BUNYAN_STRING, "url", endpoint->url,
+			    BUNYAN_INT32, "res", res,
+			    BUNYAN_STRING, "error", curl_easy_strerror(res),
+			    BUNYAN_NONE);
+		} else {
+			bunyan_info("CAPI server error",
+			    BUNYAN_STRING, "url", endpoint->url,
+			    BUNYAN_INT32, "http_code", http_code,
+			    BUNYAN_NONE);
+		}
+
+		if (++attempts >= handle->retries)
+			break;
+
+		/* A failed probe has already re-opened the breaker */
+		if (probe || !capi_breaker_allow(&handle->breaker, &probe)) {
+			bunyan_info("CAPI circuit open, not retrying",
+			    BUNYAN_INT32, "attempts", attempts,
+			    BUNYAN_NONE);
+			break;
+		}
+
+		if (!capi_budget_withdraw(&handle->retry_budget)) {
+			bunyan_info("CAPI retry budget exhausted",
+			    BUNYAN_INT32, "attempts", attempts,
+			    BUNYAN_NONE);
+			break;
+		}
+
+		backoff_ms = capi_backoff_ms(handle, attempts);
+		if (deadline != 0 &&
+		    backoff_ms >= HR_MSEC(deadline - gethrtime())) {
+			bunyan_info("CAPI backoff would pass deadline",
+			    BUNYAN_INT32, "attempts", attempts,
+			    BUNYAN_INT32, "backoff_ms", backoff_ms,
+			    BUNYAN_NONE);
+			break;
+		}
+		SMARTLOGIN_CAPI_RETRY(uuid, attempts, backoff_ms);
+		backoff = gethrtime();
+		capi_sleep_ms(backoff_ms);
+		backoff = gethrtime() - backoff;
+	}
 
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-	allowed = (http_code == 201 ? B_TRUE : B_FALSE);
 	bunyan_debug("capi_is_allowed HTTP response",
 	    BUNYAN_INT32, "http_code", http_code,
-	    BUNYAN_BOOLEAN, "allowed", allowed,
+	    BUNYAN_BOOLEAN, "allowed", result == CAPI_ALLOWED,
 	    BUNYAN_NONE);
 
 out:
-	xfree(url);
+	/*
+	 * If we bailed out before (or between) attempts while holding the
+	 * half-open probe slot, hand it back so the breaker doesn't wedge.
+	 */
+	if (probe && result == CAPI_UNAVAILABLE && !failed)
+		capi_breaker_record(&handle->breaker, B_FALSE, probe);
+
 	xfree(form_data);
-	if (curl != NULL) {
-		curl_easy_cleanup(curl);
-		curl = NULL;
-	}
+	if (multi != NULL)
+		(void) curl_multi_cleanup(multi);
 
 	bunyan_debug("capi_is_allowed return",
-	    BUNYAN_BOOLEAN, "allowed", allowed,
+	    BUNYAN_INT32, "result", result,
 	    BUNYAN_NONE);
 
-	return (allowed);
+	return (result);
 }
@@ -6,41 +6,166 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #ifndef CAPI_H_
 #define	CAPI_H_
 
 #include <curl/curl.h>
+#include <pthread.h>
 #include <sys/types.h>
 
+#include "batch.h"
+#include "endpoint.h"
+#include "latency.h"
+#include "limiter.h"
+#include "span.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Process-wide retry budget.
+ *
+ * This is a token bucket shared by every request: each call into
+ * capi_is_allowed() deposits `pct` percent of a token, and every redrive
+ * withdraws a whole one.  When CAPI is down the bucket drains quickly and
+ * we stop multiplying our request rate by the retry count.  Tokens are
+ * counted in thousandths.
+ */
+typedef struct capi_budget {
+	pthread_mutex_t lock;
+	unsigned int pct;
+	unsigned int tokens;
+	unsigned int max;
+} capi_budget_t;
+
+/**
+ * Outcome of a CAPI lookup.
+ *
+ * CAPI_UNAVAILABLE means we never got an answer (network error, 5xx, open
+ * circuit breaker or deadline), so the caller decides what to fall back to.
+ */
+typedef enum capi_result {
+	CAPI_DENIED = 0,
+	CAPI_ALLOWED,
+	CAPI_UNAVAILABLE
+} capi_result_t;
+
+typedef enum capi_breaker_state {
+	CAPI_BREAKER_CLOSED = 0,
+	CAPI_BREAKER_OPEN,
+	CAPI_BREAKER_HALF_OPEN
+} capi_breaker_state_t;
+
+/**
+ * Circuit breaker in front of CAPI.
+ *
+ * The breaker opens after `max_failures` consecutive failed attempts, or
+ * when at least `error_pct` percent of the last 64 attempts failed.  While
+ * open, lookups fail immediately with CAPI_UNAVAILABLE.  After `open_ms`
+ * the breaker goes half-open and lets exactly one probe through: success
+ * closes it again, failure re-opens it.  Setting max_failures to 0 disables
+ * the breaker.
+ */
+typedef struct capi_breaker {
+	pthread_mutex_t lock;
+	capi_breaker_state_t state;
+	unsigned int failures;
+	uint64_t window;
+	unsigned int nwindow;
+	hrtime_t opened;
+	boolean_t probing;
+	unsigned int max_failures;
+	unsigned int error_pct;
+	unsigned int open_ms;
+} capi_breaker_t;
+
 /**
  * Holder for CAPI connection information.
  *
- * Every time CAPI is invoked a new CURL handle is setup/destroyed.
+ * Every time CAPI is invoked a new CURL handle is setup/destroyed, but all
+ * of them share one DNS, TLS session and connection cache (see share.h);
+ * cached addresses are re-resolved in the background every dns_ttl
+ * seconds.  Each attempt goes to an instance picked from `endpoints`.
+ *
+ * Failed calls are redriven with exponential backoff and "full jitter":
+ * before retry N we sleep a random time in [0, retry_backoff_ms * 2^(N-1)]
+ * milliseconds, capped at retry_sleep seconds.
+ *
+ * Per-attempt timeouts adapt to what CAPI is doing: once there's enough
+ * history, they're the p99 of recent request (or connect) latency times
+ * timeout_multiplier_pct percent, no less than timeout_floor_ms and no more
+ * than the static timeout (connect_timeout, and timeout_ceiling_ms or else
+ * timeout).  Setting timeout_multiplier_pct to 0 keeps them static.
+ *
+ * If hedge_pct is non-zero, an attempt that has had no answer by that
+ * percentile of recent latency is duplicated to a second endpoint, and the
+ * first response wins.  hedge_budget caps the share of requests hedged.
+ *
+ * Unless limit_max is 0, requests in flight to CAPI are capped by an
+ * adaptive limit between limit_min and limit_max (see limiter.h); up to
+ * limit_queue_max more wait, until their deadline, for a slot.
+ *
+ * If batch_window_ms is non-zero, lookups arriving within that many
+ * milliseconds of each other (up to batch_max of them) are sent together as
+ * one POST to <url>/ssh_sessions/batch.  The body has one
+ * "customer_uuid=..&fingerprint=..&name=..\n" line per lookup, and CAPI is
+ * expected to answer 200 with one status code per line, in the same order,
+ * meaning what it would for the single request.  If CAPI answers the batch
+ * with 404, 405 or 501, we go back to single requests and try batching
+ * again after batch_retry_at (a gethrtime(), read and written atomically,
+ * since any request thread may do either).
  */
 typedef struct capi_handle {
-	char *url;
+	endpoint_pool_t *endpoints;
 	unsigned int connect_timeout;
 	unsigned int retries;
 	unsigned int retry_sleep;
+	unsigned int retry_backoff_ms;
 	unsigned int timeout;
+	capi_budget_t retry_budget;
+	unsigned int hedge_pct;
+	capi_budget_t hedge_budget;
+	unsigned int timeout_floor_ms;
+	unsigned int timeout_ceiling_ms;
+	unsigned int timeout_multiplier_pct;
+	latency_t *latency;
+	latency_t *connect_latency;
+	capi_breaker_t breaker;
+	unsigned int batch_window_ms;
+	unsigned int batch_max;
+	batcher_t *batcher;
+	volatile uint64_t batch_retry_at;
+	unsigned int dns_ttl;
+	unsigned int limit_min;
+	unsigned int limit_max;
+	unsigned int limit_queue_max;
+	limiter_t *limiter;
 } capi_handle_t;
 
 /**
  * Creates a CAPI handle
  *
- * Caller needs to read the params in out of config.
+ * Caller needs to read the params in out of config, and then call
+ * capi_handle_start().
  *
- * @param url
+ * @param url one CAPI base URL, or a comma-separated list of them
  * @return capi_handle_t
  */
 extern capi_handle_t *capi_handle_create(const char *url);
 
+/**
+ * Starts background work for the handle (endpoint health probing, DNS
+ * refresh), and sets up connection sharing and batching.
+ *
+ * @param handle
+ * @return boolean
+ */
+extern boolean_t capi_handle_start(capi_handle_t *handle);
+
 /**
  * Frees up memory associated to CAPI handle.
  *
@@ -54,17 +179,23 @@ extern void capi_handle_destroy(capi_handle_t *handle);
  * This method checks the fingerprint'd SSH key in CAPI, and determines
  * whether or not the user is allowed to use that SSH key.  CAPI returns
  * 201 on success, 403/409 on failure, so we don't have to do anything silly
- * like parse JSON in C.  This method will redrive failed calls to CAPI using
- * the params set up in the handle.
+ * like parse JSON in C.  Any other response, or none at all, is reported as
+ * CAPI_UNAVAILABLE.  This method will redrive failed calls to CAPI using
+ * the params set up in the handle, but never past `deadline`: each attempt's
+ * timeouts are clamped to the time remaining, and we give up rather than
+ * sleep through it.
  *
  * @param handle
  * @param uuid (owner_uuid -> customer-uuid in CAPI)
  * @param ssh_fp the MD5 fingerprint of an SSH key
  * @param user the current unix user trying to log in
- * @return boolean
+ * @param deadline gethrtime() by which we must answer, or 0 for none
+ * @param span where to record how long each attempt took, or NULL
+ * @return capi_result_t
  */
-extern boolean_t capi_is_allowed(capi_handle_t *handle, const char *uuid,
-			const char *ssh_fp, const char *user);
+extern capi_result_t capi_is_allowed(capi_handle_t *handle,
+			const char *uuid, const char *ssh_fp, const char *user,
+			hrtime_t deadline, span_t *span);
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,7 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #ifndef CONFIG_H_
@@ -20,11 +21,51 @@ extern "C" {
 #define	CFG_CAPI_PW			"capi-pw"
 #define	CFG_CAPI_CACHE_SIZE		"capi-cache-size"
 #define	CFG_CAPI_CACHE_AGE		"capi-cache-age"
+#define	CFG_CAPI_CACHE_OWNER_PCT	"capi-cache-owner-pct"
+#define	CFG_CAPI_ALLOWED_USERS		"capi-allowed-users"
 #define	CFG_CAPI_RETRIES		"capi-retry-attempts"
 #define	CFG_CAPI_RETRY_SLEEP		"capi-retry-sleep"
+#define	CFG_CAPI_RETRY_BACKOFF		"capi-retry-backoff-ms"
+#define	CFG_CAPI_RETRY_BUDGET		"capi-retry-budget"
+#define	CFG_CAPI_LOGIN_DEADLINE		"capi-login-deadline-ms"
 #define	CFG_CAPI_RECHECK_DENIES		"capi-recheck-denies"
+#define	CFG_CAPI_SERVE_STALE		"capi-serve-stale"
+#define	CFG_CAPI_BREAKER_FAILURES	"capi-breaker-failures"
+#define	CFG_CAPI_BREAKER_ERROR_PCT	"capi-breaker-error-pct"
+#define	CFG_CAPI_BREAKER_OPEN		"capi-breaker-open-ms"
+#define	CFG_CAPI_PROBE_INTERVAL		"capi-probe-interval-ms"
+#define	CFG_CAPI_EJECT_FAILURES		"capi-eject-failures"
+#define	CFG_CAPI_EJECT_TIME		"capi-eject-ms"
+#define	CFG_CAPI_HEDGE_PERCENTILE	"capi-hedge-percentile"
+#define	CFG_CAPI_HEDGE_BUDGET		"capi-hedge-budget"
+#define	CFG_CAPI_BATCH_WINDOW		"capi-batch-window-ms"
+#define	CFG_CAPI_BATCH_MAX		"capi-batch-max"
+#define	CFG_CAPI_DNS_TTL		"capi-dns-ttl"
+#define	CFG_CAPI_LIMIT_MIN		"capi-min-concurrency"
+#define	CFG_CAPI_LIMIT_MAX		"capi-max-concurrency"
+#define	CFG_CAPI_LIMIT_QUEUE_MAX	"capi-concurrency-queue-max"
 #define	CFG_CAPI_CONNECT_TIMEOUT	"capi-connect-timeout"
 #define	CFG_CAPI_TIMEOUT		"capi-timeout"
+#define	CFG_CAPI_TIMEOUT_FLOOR		"capi-timeout-floor-ms"
+#define	CFG_CAPI_TIMEOUT_CEILING	"capi-timeout-ceiling-ms"
+#define	CFG_CAPI_TIMEOUT_MULTIPLIER	"capi-timeout-multiplier-pct"
+#define	CFG_CAPI_WORKERS		"capi-workers"
+#define	CFG_CAPI_QUEUE_MAX		"capi-queue-max"
+#define	CFG_SHED_WAITERS		"shed-capi-waiters"
+#define	CFG_SHED_QUEUE_MS		"shed-queue-ms"
+#define	CFG_LOGIN_RATE_ZONE		"login-rate-per-zone"
+#define	CFG_LOGIN_BURST_ZONE		"login-burst-per-zone"
+#define	CFG_LOGIN_RATE_OWNER		"login-rate-per-owner"
+#define	CFG_LOGIN_BURST_OWNER		"login-burst-per-owner"
+#define	CFG_LOG_RING_RECORDS		"log-ring-records"
+#define	CFG_LOG_OVERFLOW		"log-overflow"
+#define	CFG_LOG_RATE_LIMIT		"log-rate-limit"
+#define	CFG_LOG_SAMPLE_RATE		"log-sample-rate"
+#define	CFG_LOG_BINARY_FILE		"log-binary-file"
+#define	CFG_LOG_BINARY_MAX_SIZE		"log-binary-max-size"
+#define	CFG_LOG_BINARY_KEEP		"log-binary-keep"
+#define	CFG_SLOW_REQUEST_MS		"slow-request-ms"
+#define	CFG_LOCK_PROFILING		"lock-profiling"
 
 /**
  * Reads the value for the given key out of the specified file
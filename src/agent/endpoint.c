@@ -0,0 +1,427 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <curl/curl.h>
+#include <curl/types.h>
+#include <curl/easy.h>
+
+#include "bunyan.h"
+#include "endpoint.h"
+#include "share.h"
+#include "stats.h"
+#include "util.h"
+
+/* Weight of the newest sample in the latency EWMA, in tenths */
+#define	EWMA_WEIGHT	3
+
+static stats_counter_t *g_stat_ejections = NULL;
+static stats_counter_t *g_stat_readmissions = NULL;
+
+
+static boolean_t
+endpoint_healthy(endpoint_t *endpoint, hrtime_t now)
+{
+	return (endpoint->ejected_until <= now);
+}
+
+
+/* Caller holds pool->lock */
+static void
+endpoint_update(endpoint_pool_t *pool, endpoint_t *endpoint,
+		hrtime_t latency, boolean_t ok)
+{
+	hrtime_t now = gethrtime();
+
+	if (endpoint->ewma == 0) {
+		endpoint->ewma = latency;
+	} else {
+		endpoint->ewma += (latency - endpoint->ewma) * EWMA_WEIGHT / 10;
+	}
+
+	if (ok) {
+		if (!endpoint_healthy(endpoint, now)) {
+			bunyan_info("CAPI endpoint readmitted",
+			    BUNYAN_STRING, "url", endpoint->url,
+			    BUNYAN_NONE);
+			stats_incr(g_stat_readmissions);
+		}
+		endpoint->failures = 0;
+		endpoint->ejected_until = 0;
+		return;
+	}
+
+	endpoint->errors++;
+	if (++endpoint->failures < pool->eject_failures ||
+	    !endpoint_healthy(endpoint, now))
+		return;
+
+	bunyan_warn("CAPI endpoint ejected",
+	    BUNYAN_STRING, "url", endpoint->url,
+	    BUNYAN_INT32, "failures", endpoint->failures,
+	    BUNYAN_INT32, "eject_ms", pool->eject_ms,
+	    BUNYAN_NONE);
+	stats_incr(g_stat_ejections);
+	endpoint->ejections++;
+	endpoint->ejected_until = now + (hrtime_t)pool->eject_ms * 1000000LL;
+}
+
+
+static size_t
+endpoint_probe_callback(void *ptr, size_t size, size_t nmemb, void *data)
+{
+	return (size * nmemb);
+}
+
+
+/*
+ * Any HTTP response at all means the instance is up; we're only interested
+ * in reachability and round-trip time here.
+ */
+static void
+endpoint_probe(endpoint_pool_t *pool, CURL *curl, endpoint_t *endpoint)
+{
+	CURLcode res;
+	long http_code = 0;
+	hrtime_t start, end;
+	boolean_t ok;
+
+	curl_easy_setopt(curl, CURLOPT_URL, endpoint->url);
+
+	start = gethrtime();
+	res = curl_easy_perform(curl);
+	end = gethrtime();
+
+	if (res == 0)
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+	ok = (res == 0 && http_code != 0 && http_code < 500);
+
+	bunyan_trace("CAPI endpoint probed",
+	    BUNYAN_STRING, "url", endpoint->url,
+	    BUNYAN_INT32, "http_code", http_code,
+	    BUNYAN_INT32, "timing_us", HR_USEC(end - start),
+	    BUNYAN_NONE);
+
+	(void) pthread_mutex_lock(&pool->lock);
+	endpoint_update(pool, endpoint, end - start, ok);
+	(void) pthread_mutex_unlock(&pool->lock);
+}
+
+
+static void *
+endpoint_prober(void *arg)
+{
+	endpoint_pool_t *pool = arg;
+	CURL *curl = NULL;
+	struct timespec ts;
+	unsigned int i;
+
+	curl = curl_easy_init();
+	if (curl == NULL) {
+		bunyan_error("endpoint_prober: unable to create curl handle",
+		    BUNYAN_NONE);
+		return (NULL);
+	}
+
+	/*
+	 * Probes always open a fresh connection, so they re-resolve any DNS
+	 * entry past its TTL and leave a warm connection behind for logins.
+	 */
+	share_attach(curl, B_TRUE);
+	curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+	    (long)pool->probe_timeout_ms);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
+	    (long)pool->probe_timeout_ms);
+	curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 0);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, endpoint_probe_callback);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+
+	(void) pthread_mutex_lock(&pool->lock);
+	while (pool->probing) {
+		(void) pthread_mutex_unlock(&pool->lock);
+		for (i = 0; i < pool->count; i++)
+			endpoint_probe(pool, curl, &pool->endpoints[i]);
+		(void) pthread_mutex_lock(&pool->lock);
+
+		(void) clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += pool->probe_ms / 1000;
+		ts.tv_nsec += (long)(pool->probe_ms % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		while (pool->probing &&
+		    pthread_cond_timedwait(&pool->prober_cv, &pool->lock,
+		    &ts) == 0)
+			continue;
+	}
+	(void) pthread_mutex_unlock(&pool->lock);
+
+	curl_easy_cleanup(curl);
+	return (NULL);
+}
+
+
+static void
+endpoint_pool_report(void *arg)
+{
+	endpoint_pool_t *pool = arg;
+	endpoint_t *endpoint;
+	hrtime_t now = gethrtime();
+	unsigned int i;
+
+	(void) pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < pool->count; i++) {
+		endpoint = &pool->endpoints[i];
+		bunyan_info("stats: CAPI endpoint",
+		    BUNYAN_STRING, "url", endpoint->url,
+		    BUNYAN_INT32, "ewma_us", HR_USEC(endpoint->ewma),
+		    BUNYAN_INT32, "outstanding", endpoint->outstanding,
+		    BUNYAN_BOOLEAN, "ejected", !endpoint_healthy(endpoint, now),
+		    BUNYAN_INT64, "requests", (int64_t)endpoint->requests,
+		    BUNYAN_INT64, "errors", (int64_t)endpoint->errors,
+		    BUNYAN_INT64, "ejections", (int64_t)endpoint->ejections,
+		    BUNYAN_NONE);
+	}
+	(void) pthread_mutex_unlock(&pool->lock);
+}
+
+
+endpoint_pool_t *
+endpoint_pool_create(const char *urls)
+{
+	endpoint_pool_t *pool = NULL;
+	char *copy = NULL;
+	char *ptr = NULL;
+	char *rest = NULL;
+	char *token = NULL;
+	unsigned int n = 1;
+	const char *c;
+
+	if (urls == NULL) {
+		bunyan_debug("endpoint_pool_create: NULL arguments",
+		    BUNYAN_NONE);
+		return (NULL);
+	}
+
+	for (c = urls; *c != '\0'; c++) {
+		if (*c == ',')
+			n++;
+	}
+
+	pool = xmalloc(sizeof (endpoint_pool_t));
+	if (pool == NULL)
+		return (NULL);
+
+	(void) pthread_mutex_init(&pool->lock, NULL);
+	(void) pthread_cond_init(&pool->prober_cv, NULL);
+	pool->eject_failures = 2;
+	pool->eject_ms = 10000;
+	pool->probe_ms = 5000;
+	pool->probe_timeout_ms = 1000;
+
+	pool->endpoints = xcalloc(n, sizeof (endpoint_t));
+	copy = xstrdup(urls);
+	if (pool->endpoints == NULL || copy == NULL)
+		goto err;
+
+	ptr = copy;
+	while ((token = strtok_r(ptr, ", \t", &rest)) != NULL) {
+		pool->endpoints[pool->count].url = xstrdup(token);
+		if (pool->endpoints[pool->count].url == NULL)
+			goto err;
+		pool->count++;
+		ptr = rest;
+	}
+
+	if (pool->count == 0) {
+		bunyan_error("no CAPI endpoints configured", BUNYAN_NONE);
+		goto err;
+	}
+	xfree(copy);
+
+	if (g_stat_ejections == NULL) {
+		g_stat_ejections =
+		    stats_counter_create("capi_endpoint_ejected");
+		g_stat_readmissions =
+		    stats_counter_create("capi_endpoint_readmitted");
+	}
+	stats_register_reporter(endpoint_pool_report, pool);
+
+	return (pool);
+
+err:
+	xfree(copy);
+	endpoint_pool_destroy(pool);
+	return (NULL);
+}
+
+
+void
+endpoint_pool_destroy(endpoint_pool_t *pool)
+{
+	unsigned int i;
+	boolean_t join;
+
+	if (pool == NULL)
+		return;
+
+	(void) pthread_mutex_lock(&pool->lock);
+	join = pool->probing;
+	pool->probing = B_FALSE;
+	(void) pthread_cond_signal(&pool->prober_cv);
+	(void) pthread_mutex_unlock(&pool->lock);
+	if (join)
+		(void) pthread_join(pool->prober, NULL);
+
+	if (pool->endpoints != NULL) {
+		for (i = 0; i < pool->count; i++)
+			xfree(pool->endpoints[i].url);
+		xfree(pool->endpoints);
+	}
+	(void) pthread_cond_destroy(&pool->prober_cv);
+	(void) pthread_mutex_destroy(&pool->lock);
+	xfree(pool);
+}
+
+
+boolean_t
+endpoint_pool_start(endpoint_pool_t *pool)
+{
+	int err;
+
+	if (pool == NULL) {
+		bunyan_debug("endpoint_pool_start: NULL arguments",
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	if (pool->probe_ms == 0 || pool->probing)
+		return (B_TRUE);
+
+	pool->probing = B_TRUE;
+	if ((err = pthread_create(&pool->prober, NULL, endpoint_prober,
+	    pool)) != 0) {
+		bunyan_error("unable to start CAPI endpoint prober",
+		    BUNYAN_STRING, "error", strerror(err),
+		    BUNYAN_NONE);
+		pool->probing = B_FALSE;
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+
+/* Caller holds pool->lock */
+static endpoint_t *
+endpoint_pick(endpoint_pool_t *pool, endpoint_t *avoid, hrtime_t now)
+{
+	endpoint_t *a = NULL;
+	endpoint_t *b = NULL;
+	endpoint_t *candidates[2];
+	unsigned int healthy = 0;
+	unsigned int i, pick;
+
+	/*
+	 * Count what we can choose from without walking the list twice in the
+	 * common (small pool) case: the two picks are reservoir-sampled.
+	 */
+	for (i = 0; i < pool->count; i++) {
+		endpoint_t *e = &pool->endpoints[i];
+
+		if (e == avoid || !endpoint_healthy(e, now))
+			continue;
+
+		healthy++;
+		if (healthy <= 2) {
+			candidates[healthy - 1] = e;
+			continue;
+		}
+		pick = lrand48() % healthy;
+		if (pick < 2)
+			candidates[pick] = e;
+	}
+
+	if (healthy == 0)
+		return (NULL);
+	if (healthy == 1)
+		return (candidates[0]);
+
+	a = candidates[0];
+	b = candidates[1];
+	if (a->ewma * (a->outstanding + 1) <= b->ewma * (b->outstanding + 1))
+		return (a);
+	return (b);
+}
+
+
+endpoint_t *
+endpoint_acquire(endpoint_pool_t *pool, endpoint_t *avoid)
+{
+	endpoint_t *endpoint = NULL;
+	hrtime_t now = gethrtime();
+	unsigned int i;
+
+	if (pool == NULL) {
+		bunyan_debug("endpoint_acquire: NULL arguments", BUNYAN_NONE);
+		return (NULL);
+	}
+
+	(void) pthread_mutex_lock(&pool->lock);
+	endpoint = endpoint_pick(pool, avoid, now);
+	if (endpoint == NULL && avoid != NULL &&
+	    endpoint_healthy(avoid, now))
+		endpoint = avoid;
+
+	/*
+	 * Everything is ejected.  Rather than refuse outright, go to whichever
+	 * endpoint is due back soonest; the circuit breaker is what decides
+	 * whether to try CAPI at all.
+	 */
+	if (endpoint == NULL) {
+		endpoint = &pool->endpoints[0];
+		for (i = 1; i < pool->count; i++) {
+			if (pool->endpoints[i].ejected_until <
+			    endpoint->ejected_until)
+				endpoint = &pool->endpoints[i];
+		}
+	}
+
+	endpoint->outstanding++;
+	endpoint->requests++;
+	(void) pthread_mutex_unlock(&pool->lock);
+
+	return (endpoint);
+}
+
+
+void
+endpoint_release(endpoint_pool_t *pool, endpoint_t *endpoint,
+		hrtime_t latency, boolean_t ok)
+{
+	if (pool == NULL || endpoint == NULL) {
+		bunyan_debug("endpoint_release: NULL arguments", BUNYAN_NONE);
+		return;
+	}
+
+	(void) pthread_mutex_lock(&pool->lock);
+	endpoint->outstanding--;
+	if (latency > 0)
+		endpoint_update(pool, endpoint, latency, ok);
+	(void) pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,115 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef ENDPOINT_H_
+#define	ENDPOINT_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * One CAPI instance.
+ *
+ * ewma is an exponentially weighted moving average of request latency
+ * (nanoseconds), fed by both real requests and background probes.
+ * outstanding is the number of requests currently in flight to it.  All
+ * fields are protected by the owning pool's lock.
+ */
+typedef struct endpoint {
+	char *url;
+	hrtime_t ewma;
+	unsigned int outstanding;
+	unsigned int failures;
+	hrtime_t ejected_until;
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t ejections;
+} endpoint_t;
+
+/**
+ * The set of CAPI instances we balance over.
+ *
+ * Requests pick an endpoint with "power of two choices": two random healthy
+ * endpoints are compared and the one with the lower ewma * (outstanding + 1)
+ * wins.  An endpoint that fails `eject_failures` times in a row is ejected
+ * for `eject_ms`; if a background probe (every `probe_ms`) gets through to it
+ * before then, it's readmitted early.
+ */
+typedef struct endpoint_pool {
+	pthread_mutex_t lock;
+	endpoint_t *endpoints;
+	unsigned int count;
+	unsigned int eject_failures;
+	unsigned int eject_ms;
+	unsigned int probe_ms;
+	unsigned int probe_timeout_ms;
+	pthread_t prober;
+	pthread_cond_t prober_cv;
+	boolean_t probing;
+} endpoint_pool_t;
+
+/**
+ * Creates a pool from a comma-separated list of base URLs.
+ *
+ * @param urls
+ * @return endpoint_pool_t on success, NULL on error (or an empty list)
+ */
+extern endpoint_pool_t *endpoint_pool_create(const char *urls);
+
+/**
+ * Stops the prober, if running, and frees the pool.
+ *
+ * @param pool
+ */
+extern void endpoint_pool_destroy(endpoint_pool_t *pool);
+
+/**
+ * Starts the background health/latency prober.
+ *
+ * A no-op if probe_ms is 0.
+ *
+ * @param pool
+ * @return boolean
+ */
+extern boolean_t endpoint_pool_start(endpoint_pool_t *pool);
+
+/**
+ * Picks an endpoint for a request and counts it as outstanding.
+ *
+ * Every successful call must be paired with endpoint_release().
+ *
+ * @param pool
+ * @param avoid endpoint to skip if there's any other choice (e.g., the one
+ *	the previous attempt failed against), or NULL
+ * @return endpoint
+ */
+extern endpoint_t *endpoint_acquire(endpoint_pool_t *pool, endpoint_t *avoid);
+
+/**
+ * Reports the outcome of a request to an endpoint.
+ *
+ * @param pool
+ * @param endpoint
+ * @param latency time the request took, in nanoseconds; 0 means nothing
+ *	was actually sent, and only the outstanding count is adjusted
+ * @param ok whether CAPI answered
+ */
+extern void endpoint_release(endpoint_pool_t *pool, endpoint_t *endpoint,
+			hrtime_t latency, boolean_t ok);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ENDPOINT_H_ */
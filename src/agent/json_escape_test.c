@@ -0,0 +1,354 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+/*
+ * Checks bunyan_json_escape(), which copies runs of plain ASCII in bulk,
+ * against the per-character escaper it replaced.  Every input is escaped
+ * both ways and the output (and the length it reports, at every buffer
+ * size) has to match exactly.
+ *
+ * The inputs put each kind of byte the bulk copy has to stop for (control
+ * characters, '"', '\\', DEL, UTF-8 sequences, invalid and cut off ones)
+ * at every offset within and across a 16 byte block, at every alignment,
+ * and then a long run of random strings built from the same bytes.  It
+ * all runs in the C locale and again in a UTF-8 one, if there is one.
+ *
+ * `make test` builds this twice, with and without SSE2, so both versions
+ * of the bulk copy get checked.
+ *
+ *	make test
+ */
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+#include <wchar.h>
+
+#include "nvpair_json.h"
+#include "util.h"
+
+#define	FPRINTF(fp, ...)				\
+	do {						\
+		if (fprintf(fp, __VA_ARGS__) < 0)	\
+			return (-1);			\
+	} while (0)
+
+/* Longest input we build, and room for any alignment in front of it */
+#define	INPUT_MAX	256
+#define	ALIGN_MAX	16
+/* Worst case output: every byte a \uXXXX, and the quotes */
+#define	OUTPUT_MAX	(INPUT_MAX * 6 + 2)
+
+#define	RANDOM_CASES	100000
+#define	FAILURES_SHOWN	10
+
+/* Bytes the bulk copy has to stop at, alone and as sequences */
+static const char *g_specials[] = {
+	"\"", "\\", "\x01", "\x1f", "\x7f", "\n", "\r", "\t", "\b", "\f",
+	"\xc3\xa9",			/* e acute */
+	"\xe2\x82\xac",			/* euro sign */
+	"\xf0\x9f\x98\x80",		/* outside the BMP: dropped */
+	"\x80",				/* stray continuation byte */
+	"\xc3",				/* cut off sequence */
+	"\xff",
+	NULL
+};
+
+/* What random inputs are made of */
+static const unsigned char g_alphabet[] = {
+	'a', 'Z', '0', ':', '-', ' ', '|', '~', '"', '\\', '\n', '\t', '\r',
+	'\b', '\f', 0x01, 0x1f, 0x7f, 0x80, 0xc3, 0xa9, 0xe2, 0x82, 0xac,
+	0xf0, 0x9f, 0x98, 0xff
+};
+
+#if defined(__SSE2__)
+#define	VARIANT		"sse2"
+#else
+#define	VARIANT		"word"
+#endif
+
+static unsigned long g_cases = 0;
+static unsigned long g_failures = 0;
+
+/*
+ * The escaper as it was before the bulk copy, writing to a FILE as it
+ * used to.  The one change is the loop condition: mbrtowc() returns a
+ * size_t, so the old "> 0" kept going on an invalid sequence's
+ * (size_t)-1 and stepped input backwards.  The new escaper stops there
+ * and returns -1, as the old one clearly meant to.
+ */
+static int
+ref_print_json_string(FILE *fp, const char *input)
+{
+	mbstate_t mbr;
+	wchar_t c;
+	size_t sz;
+
+	bzero(&mbr, sizeof (mbr));
+
+	FPRINTF(fp, "\"");
+	while ((sz = mbrtowc(&c, input, MB_CUR_MAX, &mbr)) != 0 &&
+	    sz != (size_t)-1 && sz != (size_t)-2) {
+		switch (c) {
+		case '"':
+			FPRINTF(fp, "\\\"");
+			break;
+		case '\n':
+			FPRINTF(fp, "\\n");
+			break;
+		case '\r':
+			FPRINTF(fp, "\\r");
+			break;
+		case '\\':
+			FPRINTF(fp, "\\\\");
+			break;
+		case '\f':
+			FPRINTF(fp, "\\f");
+			break;
+		case '\t':
+			FPRINTF(fp, "\\t");
+			break;
+		case '\b':
+			FPRINTF(fp, "\\b");
+			break;
+		default:
+			if ((c >= 0x00 && c <= 0x1f) ||
+			    (c > 0x7f && c <= 0xffff)) {
+				FPRINTF(fp, "\\u%04x", (int)(0xffff & c));
+			} else if (c >= 0x20 && c <= 0x7f) {
+				FPRINTF(fp, "%c", (int)(0xff & c));
+			}
+			break;
+		}
+		input += sz;
+	}
+
+	if (sz == (size_t)-1 || sz == (size_t)-2)
+		return (-1);
+
+	FPRINTF(fp, "\"");
+	return (0);
+}
+
+/*
+ * Escapes input the old way into out (at least OUTPUT_MAX bytes).
+ * Returns the length, or -1 for an invalid sequence.
+ */
+static ssize_t
+ref_escape(char *out, const char *input)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *fp = NULL;
+	int rc;
+
+	fp = open_memstream(&buf, &size);
+	if (fp == NULL) {
+		perror("open_memstream");
+		exit(2);
+	}
+	rc = ref_print_json_string(fp, input);
+	(void) fclose(fp);
+
+	if (rc == 0)
+		(void) memcpy(out, buf, size);
+	free(buf);
+
+	return (rc == 0 ? (ssize_t)size : -1);
+}
+
+static void
+show(const char *what, const char *str, ssize_t len)
+{
+	ssize_t i;
+
+	(void) fprintf(stderr, "  %s:", what);
+	for (i = 0; i < len; i++)
+		(void) fprintf(stderr, " %02x", (unsigned char)str[i]);
+	(void) fprintf(stderr, "\n");
+}
+
+static void
+fail(const char *why, const char *input, const char *want, ssize_t want_len,
+    const char *got, ssize_t got_len)
+{
+	if (++g_failures > FAILURES_SHOWN)
+		return;
+
+	(void) fprintf(stderr, "json_escape_test: %s (locale %s)\n", why,
+	    setlocale(LC_CTYPE, NULL));
+	show("input", input, strlen(input));
+	show("want", want, MAX(want_len, 0));
+	show("got", got, MAX(got_len, 0));
+}
+
+/*
+ * Runs the new one with a buffer of `size` bytes, too small for the
+ * answer: it must still report the full length, and write nothing past
+ * size.  An escape that doesn't fit is left out whole, so not every byte
+ * below size need be written, but any that are must match the answer.
+ */
+static boolean_t
+check_short(const char *input, const char *want, ssize_t want_len,
+    size_t size)
+{
+	char got[OUTPUT_MAX + 1];
+	ssize_t got_len;
+	size_t i;
+
+	(void) memset(got, '\0', sizeof (got));
+	got_len = bunyan_json_escape(got, size, input);
+	for (i = 0; i < size; i++) {
+		if (got[i] != '\0' && got[i] != want[i])
+			break;
+	}
+	if (got_len != want_len || i < size || got[size] != '\0') {
+		fail("output differs with a short buffer", input, want, size,
+		    got, size + 1);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Escapes input both ways and compares, then checks the new one with
+ * smaller buffers: every size if `every`, otherwise a few.
+ */
+static void
+check(const char *input, boolean_t every)
+{
+	char want[OUTPUT_MAX];
+	char got[OUTPUT_MAX + 1];
+	ssize_t want_len, got_len;
+	size_t size;
+
+	g_cases++;
+
+	want_len = ref_escape(want, input);
+	got_len = bunyan_json_escape(got, sizeof (got), input);
+	if (got_len != want_len ||
+	    (want_len > 0 && memcmp(got, want, want_len) != 0)) {
+		fail("output differs", input, want, want_len, got, got_len);
+		return;
+	}
+	if (want_len < 0)
+		return;
+
+	if (!every) {
+		(void) (check_short(input, want, want_len, 0) &&
+		    check_short(input, want, want_len, rand() % want_len) &&
+		    check_short(input, want, want_len, want_len - 1));
+		return;
+	}
+	for (size = 0; size < want_len; size++) {
+		if (!check_short(input, want, want_len, size))
+			return;
+	}
+}
+
+/*
+ * Each special, at every alignment, with every length of plain ASCII
+ * either side of it up to two blocks' worth.
+ */
+static void
+check_boundaries(void)
+{
+	char buf[ALIGN_MAX + INPUT_MAX];
+	char *input = NULL;
+	unsigned int i, align, pre, post;
+	size_t len;
+
+	for (i = 0; g_specials[i] != NULL; i++) {
+		len = strlen(g_specials[i]);
+		for (align = 0; align < ALIGN_MAX; align++) {
+			input = buf + align;
+			for (pre = 0; pre <= 2 * ALIGN_MAX; pre++) {
+				for (post = 0; post <= 2 * ALIGN_MAX; post++) {
+					(void) memset(input, 'a', pre);
+					(void) memcpy(input + pre,
+					    g_specials[i], len);
+					(void) memset(input + pre + len, 'b',
+					    post);
+					input[pre + len + post] = '\0';
+					check(input, B_TRUE);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Random strings, mostly plain with specials sprinkled in at some rate,
+ * at random alignments.  The seed is fixed, so a failure is repeatable.
+ */
+static void
+check_random(void)
+{
+	char buf[ALIGN_MAX + INPUT_MAX];
+	char *input = NULL;
+	unsigned int i, j, len, rate;
+
+	srand(1);
+	for (i = 0; i < RANDOM_CASES; i++) {
+		input = buf + rand() % ALIGN_MAX;
+		len = rand() % (INPUT_MAX - 1);
+		rate = 1 + rand() % 64;
+		for (j = 0; j < len; j++) {
+			if (rand() % rate == 0) {
+				input[j] = g_alphabet[rand() %
+				    sizeof (g_alphabet)];
+			} else {
+				input[j] = 'a' + rand() % 26;
+			}
+		}
+		input[len] = '\0';
+		check(input, B_FALSE);
+	}
+}
+
+static void
+check_locale(const char *locale)
+{
+	check("", B_TRUE);
+	check_boundaries();
+	check_random();
+	(void) printf("json_escape_test (%s): %s: %lu cases\n", VARIANT,
+	    locale, g_cases);
+	g_cases = 0;
+}
+
+int
+main(void)
+{
+	const char *utf8[] = { "en_US.UTF-8", "C.UTF-8", NULL };
+	unsigned int i;
+
+	(void) setlocale(LC_ALL, "C");
+	check_locale("C");
+
+	for (i = 0; utf8[i] != NULL; i++) {
+		if (setlocale(LC_ALL, utf8[i]) != NULL)
+			break;
+	}
+	if (utf8[i] != NULL)
+		check_locale(utf8[i]);
+	else
+		(void) printf("json_escape_test: no UTF-8 locale, skipped\n");
+
+	if (g_failures != 0) {
+		(void) printf("json_escape_test: %lu failures\n", g_failures);
+		return (1);
+	}
+
+	return (0);
+}
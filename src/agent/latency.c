@@ -0,0 +1,152 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <string.h>
+
+#include "bunyan.h"
+#include "latency.h"
+#include "util.h"
+
+
+static int
+latency_bucket(uint64_t us)
+{
+	int msb;
+
+	if (us < 8)
+		return ((int)us);
+
+	msb = 63 - __builtin_clzll(us);
+	return ((msb - 2) * 8 + (int)((us >> (msb - 3)) & 7));
+}
+
+
+/* Exclusive upper bound of a bucket, in microseconds */
+static uint64_t
+latency_bucket_max(int bucket)
+{
+	int msb;
+
+	if (bucket < 8)
+		return ((uint64_t)bucket + 1);
+
+	msb = bucket / 8 + 2;
+	return ((uint64_t)(9 + bucket % 8) << (msb - 3));
+}
+
+
+/* Caller holds latency->lock */
+static void
+latency_rotate(latency_t *latency, hrtime_t now)
+{
+	int prev;
+
+	if (now - latency->rotated < latency->window)
+		return;
+
+	/*
+	 * If we've been idle for more than two windows everything we have is
+	 * stale, so clear both.
+	 */
+	prev = latency->cur ^ 1;
+	if (now - latency->rotated >= 2 * latency->window) {
+		(void) memset(latency->counts[latency->cur], 0,
+		    sizeof (latency->counts[0]));
+		latency->total[latency->cur] = 0;
+	}
+	(void) memset(latency->counts[prev], 0, sizeof (latency->counts[0]));
+	latency->total[prev] = 0;
+	latency->cur = prev;
+	latency->rotated = now;
+}
+
+
+latency_t *
+latency_create(unsigned int window_ms)
+{
+	latency_t *latency = NULL;
+
+	if (window_ms == 0) {
+		bunyan_debug("latency_create: zero window", BUNYAN_NONE);
+		return (NULL);
+	}
+
+	latency = xmalloc(sizeof (latency_t));
+	if (latency == NULL)
+		return (NULL);
+
+	(void) pthread_mutex_init(&latency->lock, NULL);
+	latency->window = (hrtime_t)window_ms * 1000000LL;
+	latency->rotated = gethrtime();
+
+	return (latency);
+}
+
+
+void
+latency_destroy(latency_t *latency)
+{
+	if (latency != NULL) {
+		(void) pthread_mutex_destroy(&latency->lock);
+		xfree(latency);
+	}
+}
+
+
+void
+latency_record(latency_t *latency, hrtime_t ns)
+{
+	int bucket;
+
+	if (latency == NULL)
+		return;
+
+	bucket = latency_bucket(ns > 0 ? (uint64_t)ns / 1000 : 0);
+
+	(void) pthread_mutex_lock(&latency->lock);
+	latency_rotate(latency, gethrtime());
+	latency->counts[latency->cur][bucket]++;
+	latency->total[latency->cur]++;
+	(void) pthread_mutex_unlock(&latency->lock);
+}
+
+
+hrtime_t
+latency_percentile(latency_t *latency, unsigned int pct, uint64_t min_samples)
+{
+	uint64_t total, target, seen = 0;
+	hrtime_t result = 0;
+	int i;
+
+	if (latency == NULL || pct == 0)
+		return (0);
+	if (pct > 100)
+		pct = 100;
+
+	(void) pthread_mutex_lock(&latency->lock);
+	latency_rotate(latency, gethrtime());
+
+	total = latency->total[0] + latency->total[1];
+	if (total == 0 || total < min_samples)
+		goto out;
+
+	target = (total * pct + 99) / 100;
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += latency->counts[0][i] + latency->counts[1][i];
+		if (seen >= target) {
+			result = (hrtime_t)latency_bucket_max(i) * 1000LL;
+			break;
+		}
+	}
+
+out:
+	(void) pthread_mutex_unlock(&latency->lock);
+	return (result);
+}
@@ -0,0 +1,83 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef LATENCY_H_
+#define	LATENCY_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Log-linear buckets over microseconds: values below 8us get a bucket each,
+ * above that every power of two is split into 8 linear sub-buckets, so any
+ * reported percentile is within 12.5% of the true value.
+ */
+#define	LATENCY_BUCKETS	496
+
+/**
+ * A sliding-window latency distribution.
+ *
+ * Samples land in the current window; when it is older than `window` the
+ * previous one is dropped and the current one takes its place, so queries
+ * always see between one and two windows' worth of recent history.
+ */
+typedef struct latency {
+	pthread_mutex_t lock;
+	hrtime_t window;
+	hrtime_t rotated;
+	int cur;
+	uint64_t total[2];
+	uint32_t counts[2][LATENCY_BUCKETS];
+} latency_t;
+
+/**
+ * Creates a latency distribution.
+ *
+ * @param window_ms how long each of the two windows lasts
+ * @return latency_t on success, NULL on error
+ */
+extern latency_t *latency_create(unsigned int window_ms);
+
+/**
+ * Frees a latency distribution.
+ *
+ * @param latency
+ */
+extern void latency_destroy(latency_t *latency);
+
+/**
+ * Records one sample.
+ *
+ * @param latency
+ * @param ns sample, in nanoseconds
+ */
+extern void latency_record(latency_t *latency, hrtime_t ns);
+
+/**
+ * Estimates a percentile of recent samples.
+ *
+ * @param latency
+ * @param pct percentile, 1-100
+ * @param min_samples don't answer on less history than this
+ * @return upper bound of the bucket holding the percentile, in nanoseconds,
+ *	or 0 if there isn't enough history
+ */
+extern hrtime_t latency_percentile(latency_t *latency, unsigned int pct,
+			uint64_t min_samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,244 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include "bunyan.h"
+#include "limiter.h"
+#include "stats.h"
+#include "util.h"
+
+/* Where the limit starts, before we've learned anything */
+#define	LIMITER_INITIAL		8
+
+static stats_counter_t *g_stat_rejected = NULL;
+static stats_counter_t *g_stat_timeouts = NULL;
+
+
+static void
+limiter_report(void *arg)
+{
+	limiter_t *limiter = arg;
+
+	(void) pthread_mutex_lock(&limiter->lock);
+	bunyan_info("stats: CAPI limiter",
+	    BUNYAN_INT32, "limit", limiter->limit,
+	    BUNYAN_INT32, "inflight", limiter->inflight,
+	    BUNYAN_INT32, "waiting", limiter->waiting,
+	    BUNYAN_INT32, "ewma_us", HR_USEC(limiter->ewma),
+	    BUNYAN_INT32, "queue_ewma_us", HR_USEC(limiter->queue_ewma),
+	    BUNYAN_NONE);
+	(void) pthread_mutex_unlock(&limiter->lock);
+}
+
+
+limiter_t *
+limiter_create(unsigned int min_limit, unsigned int max_limit,
+		unsigned int queue_max)
+{
+	limiter_t *limiter = NULL;
+
+	if (min_limit == 0 || max_limit < min_limit) {
+		bunyan_error("limiter_create: bad limits",
+		    BUNYAN_INT32, "min", min_limit,
+		    BUNYAN_INT32, "max", max_limit,
+		    BUNYAN_NONE);
+		return (NULL);
+	}
+
+	limiter = xmalloc(sizeof (limiter_t));
+	if (limiter == NULL)
+		return (NULL);
+
+	(void) pthread_mutex_init(&limiter->lock, NULL);
+	(void) pthread_cond_init(&limiter->cv, NULL);
+	limiter->min_limit = min_limit;
+	limiter->max_limit = max_limit;
+	limiter->queue_max = queue_max;
+	limiter->limit = LIMITER_INITIAL;
+	if (limiter->limit < min_limit)
+		limiter->limit = min_limit;
+	if (limiter->limit > max_limit)
+		limiter->limit = max_limit;
+
+	if (g_stat_rejected == NULL) {
+		g_stat_rejected = stats_counter_create("capi_limiter_rejected");
+		g_stat_timeouts = stats_counter_create("capi_limiter_timeouts");
+	}
+	stats_register_reporter(limiter_report, limiter);
+
+	return (limiter);
+}
+
+
+void
+limiter_destroy(limiter_t *limiter)
+{
+	if (limiter != NULL) {
+		(void) pthread_cond_destroy(&limiter->cv);
+		(void) pthread_mutex_destroy(&limiter->lock);
+		xfree(limiter);
+	}
+}
+
+
+boolean_t
+limiter_acquire(limiter_t *limiter, hrtime_t deadline)
+{
+	struct timespec ts;
+	hrtime_t remaining;
+	hrtime_t start;
+	int rc = 0;
+
+	if (limiter == NULL)
+		return (B_TRUE);
+
+	(void) pthread_mutex_lock(&limiter->lock);
+	if (limiter->inflight < limiter->limit) {
+		limiter->queue_ewma -= limiter->queue_ewma / 8;
+		goto out;
+	}
+
+	if (limiter->waiting >= limiter->queue_max) {
+		(void) pthread_mutex_unlock(&limiter->lock);
+		stats_incr(g_stat_rejected);
+		return (B_FALSE);
+	}
+
+	if (deadline != 0) {
+		remaining = deadline - gethrtime();
+		if (remaining < 0)
+			remaining = 0;
+		(void) clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += remaining / 1000000000LL;
+		ts.tv_nsec += (long)(remaining % 1000000000LL);
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+
+	start = gethrtime();
+	limiter->waiting++;
+	while (limiter->inflight >= limiter->limit && rc != ETIMEDOUT) {
+		if (deadline != 0) {
+			rc = pthread_cond_timedwait(&limiter->cv,
+			    &limiter->lock, &ts);
+		} else {
+			(void) pthread_cond_wait(&limiter->cv, &limiter->lock);
+		}
+	}
+	limiter->waiting--;
+	limiter->queue_ewma += (gethrtime() - start - limiter->queue_ewma) / 8;
+
+	if (limiter->inflight >= limiter->limit) {
+		(void) pthread_mutex_unlock(&limiter->lock);
+		stats_incr(g_stat_timeouts);
+		return (B_FALSE);
+	}
+
+out:
+	limiter->inflight++;
+	(void) pthread_mutex_unlock(&limiter->lock);
+	return (B_TRUE);
+}
+
+
+boolean_t
+limiter_try_acquire(limiter_t *limiter)
+{
+	boolean_t acquired = B_FALSE;
+
+	if (limiter == NULL)
+		return (B_TRUE);
+
+	(void) pthread_mutex_lock(&limiter->lock);
+	if (limiter->inflight < limiter->limit) {
+		limiter->inflight++;
+		acquired = B_TRUE;
+	}
+	(void) pthread_mutex_unlock(&limiter->lock);
+
+	return (acquired);
+}
+
+
+void
+limiter_release(limiter_t *limiter, hrtime_t latency, boolean_t ok)
+{
+	unsigned int limit;
+	hrtime_t now;
+
+	if (limiter == NULL)
+		return;
+
+	(void) pthread_mutex_lock(&limiter->lock);
+	limit = limiter->limit;
+	limiter->inflight--;
+	if (latency <= 0)
+		goto out;
+
+	if (ok && (limiter->ewma == 0 || latency <= 2 * limiter->ewma)) {
+		/* Only grow if we were anywhere near using what we have */
+		if (limiter->inflight + 1 >= limiter->limit / 2 &&
+		    ++limiter->credit >= limiter->limit) {
+			limiter->credit = 0;
+			if (limiter->limit < limiter->max_limit)
+				limiter->limit++;
+		}
+	} else {
+		now = gethrtime();
+		if (now - limiter->decreased >= limiter->ewma) {
+			limiter->limit = limiter->limit * 3 / 4;
+			if (limiter->limit < limiter->min_limit)
+				limiter->limit = limiter->min_limit;
+			limiter->credit = 0;
+			limiter->decreased = now;
+			bunyan_debug("CAPI concurrency limit lowered",
+			    BUNYAN_INT32, "limit", limiter->limit,
+			    BUNYAN_INT32, "latency_us", HR_USEC(latency),
+			    BUNYAN_BOOLEAN, "ok", ok,
+			    BUNYAN_NONE);
+		}
+	}
+
+	/* Failures would drag the average toward the timeout, so skip them */
+	if (ok) {
+		if (limiter->ewma == 0)
+			limiter->ewma = latency;
+		else
+			limiter->ewma += (latency - limiter->ewma) / 32;
+	}
+
+out:
+	if (limiter->limit > limit)
+		(void) pthread_cond_broadcast(&limiter->cv);
+	else
+		(void) pthread_cond_signal(&limiter->cv);
+	(void) pthread_mutex_unlock(&limiter->lock);
+}
+
+
+hrtime_t
+limiter_queue_time(limiter_t *limiter)
+{
+	hrtime_t queue_time = 0;
+
+	if (limiter == NULL)
+		return (0);
+
+	(void) pthread_mutex_lock(&limiter->lock);
+	if (limiter->waiting != 0)
+		queue_time = limiter->queue_ewma;
+	(void) pthread_mutex_unlock(&limiter->lock);
+
+	return (queue_time);
+}
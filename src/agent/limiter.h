@@ -0,0 +1,112 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef LIMITER_H_
+#define	LIMITER_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Adaptive cap on the number of requests in flight to CAPI.
+ *
+ * The limit moves AIMD-style between min_limit and max_limit: every
+ * `limit` good completions while the limit was actually in use raise it by
+ * one, and a failure, or latency over twice the long-run average, cuts it
+ * to three quarters (at most once per average round trip, so one slow
+ * burst doesn't collapse it to the floor).
+ *
+ * Callers over the limit queue (at most queue_max of them) until a slot
+ * frees up or their deadline passes.
+ */
+typedef struct limiter {
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+	unsigned int limit;
+	unsigned int min_limit;
+	unsigned int max_limit;
+	unsigned int queue_max;
+	unsigned int inflight;
+	unsigned int waiting;
+	unsigned int credit;
+	hrtime_t ewma;
+	hrtime_t decreased;
+	hrtime_t queue_ewma;
+} limiter_t;
+
+/**
+ * Creates a limiter.
+ *
+ * @param min_limit
+ * @param max_limit
+ * @param queue_max most callers allowed to wait for a slot
+ * @return limiter_t on success, NULL on error
+ */
+extern limiter_t *limiter_create(unsigned int min_limit,
+			unsigned int max_limit, unsigned int queue_max);
+
+/**
+ * Frees a limiter.
+ *
+ * @param limiter
+ */
+extern void limiter_destroy(limiter_t *limiter);
+
+/**
+ * Takes a slot, waiting for one if we're at the limit.
+ *
+ * Every successful call must be paired with limiter_release().
+ *
+ * @param limiter
+ * @param deadline gethrtime() after which we give up, or 0 to wait forever
+ * @return B_TRUE if we got a slot, B_FALSE if the queue was full or the
+ *	deadline passed
+ */
+extern boolean_t limiter_acquire(limiter_t *limiter, hrtime_t deadline);
+
+/**
+ * Takes a slot only if one is free right now.
+ *
+ * Every successful call must be paired with limiter_release().
+ *
+ * @param limiter
+ * @return B_TRUE if we got a slot
+ */
+extern boolean_t limiter_try_acquire(limiter_t *limiter);
+
+/**
+ * Gives a slot back and adjusts the limit.
+ *
+ * @param limiter
+ * @param latency how long the request took, in nanoseconds; 0 means we
+ *	never got as far as asking CAPI, and the limit is left alone
+ * @param ok whether CAPI answered
+ */
+extern void limiter_release(limiter_t *limiter, hrtime_t latency,
+			boolean_t ok);
+
+/**
+ * How long callers have recently been waiting for a slot.
+ *
+ * @param limiter
+ * @return average queueing time in nanoseconds, or 0 if nobody is queued
+ *	right now
+ */
+extern hrtime_t limiter_queue_time(limiter_t *limiter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIMITER_H_ */
@@ -0,0 +1,256 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+/*
+ * Checks the CAPI concurrency limiter: its bounds, slots and queueing,
+ * and how the limit moves with good completions, failures and slow ones.
+ *
+ *	make test
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "limiter.h"
+#include "util.h"
+
+#define	CHECK(cond)	check((cond), #cond, __LINE__)
+
+#define	MSEC		1000000LL
+
+static unsigned long g_failures = 0;
+
+static void
+check(boolean_t ok, const char *what, int line)
+{
+	if (!ok) {
+		(void) fprintf(stderr, "limiter_test:%d: %s\n", line, what);
+		g_failures++;
+	}
+}
+
+/* Takes every free slot, and returns how many that was */
+static unsigned int
+fill(limiter_t *limiter)
+{
+	unsigned int n = 0;
+
+	while (limiter_try_acquire(limiter))
+		n++;
+
+	return (n);
+}
+
+static void
+drain(limiter_t *limiter, unsigned int n)
+{
+	while (n-- > 0)
+		limiter_release(limiter, 0, B_TRUE);
+}
+
+static void
+check_create(void)
+{
+	limiter_t *limiter = NULL;
+
+	CHECK(limiter_create(0, 8, 0) == NULL);
+	CHECK(limiter_create(8, 4, 0) == NULL);
+
+	/* The limit starts at 8, within the bounds */
+	limiter = limiter_create(2, 4, 0);
+	CHECK(limiter != NULL && limiter->limit == 4);
+	limiter_destroy(limiter);
+	limiter = limiter_create(16, 64, 0);
+	CHECK(limiter != NULL && limiter->limit == 16);
+	limiter_destroy(limiter);
+	limiter = limiter_create(1, 64, 0);
+	CHECK(limiter != NULL && limiter->limit == 8);
+	limiter_destroy(limiter);
+
+	/* No limiter means no limit */
+	CHECK(limiter_acquire(NULL, 0));
+	CHECK(limiter_try_acquire(NULL));
+	limiter_release(NULL, MSEC, B_TRUE);
+}
+
+static void
+check_slots(void)
+{
+	limiter_t *limiter = limiter_create(1, 4, 0);
+	hrtime_t start;
+
+	CHECK(fill(limiter) == 4);
+	CHECK(limiter->inflight == 4);
+
+	/* With no queue, acquire gives up at once rather than waiting */
+	start = gethrtime();
+	CHECK(!limiter_acquire(limiter, start + 1000 * MSEC));
+	CHECK(gethrtime() - start < 500 * MSEC);
+
+	/* Releases that never reached CAPI leave the limit alone */
+	drain(limiter, 4);
+	CHECK(limiter->inflight == 0 && limiter->limit == 4);
+
+	limiter_destroy(limiter);
+}
+
+static void
+check_deadline(void)
+{
+	limiter_t *limiter = limiter_create(1, 2, 1);
+	hrtime_t start, waited;
+
+	CHECK(fill(limiter) == 2);
+
+	start = gethrtime();
+	CHECK(!limiter_acquire(limiter, start + 50 * MSEC));
+	waited = gethrtime() - start;
+	CHECK(waited >= 40 * MSEC && waited < 2000 * MSEC);
+	CHECK(limiter->waiting == 0 && limiter->inflight == 2);
+
+	drain(limiter, 2);
+	limiter_destroy(limiter);
+}
+
+static void *
+waiter(void *arg)
+{
+	limiter_t *limiter = arg;
+
+	return (limiter_acquire(limiter, gethrtime() + 5000 * MSEC) ?
+	    arg : NULL);
+}
+
+static void
+check_wakeup(void)
+{
+	limiter_t *limiter = limiter_create(1, 2, 1);
+	pthread_t tid;
+	void *got = NULL;
+	hrtime_t start;
+	int i;
+
+	CHECK(fill(limiter) == 2);
+	CHECK(pthread_create(&tid, NULL, waiter, limiter) == 0);
+
+	/* Wait for it to queue, then check the queue is full */
+	for (i = 0; i < 1000 && limiter->waiting == 0; i++)
+		(void) usleep(1000);
+	CHECK(limiter->waiting == 1);
+	start = gethrtime();
+	CHECK(!limiter_acquire(limiter, start + 1000 * MSEC));
+	CHECK(gethrtime() - start < 500 * MSEC);
+
+	limiter_release(limiter, 0, B_TRUE);
+	(void) pthread_join(tid, &got);
+	CHECK(got == limiter);
+	CHECK(limiter->inflight == 2 && limiter->waiting == 0);
+
+	drain(limiter, 2);
+	limiter_destroy(limiter);
+}
+
+/*
+ * Completes one request while the limiter is full, then takes the slot
+ * back, so it stays fully used.
+ */
+static void
+complete(limiter_t *limiter, hrtime_t latency, boolean_t ok)
+{
+	limiter_release(limiter, latency, ok);
+	(void) limiter_try_acquire(limiter);
+}
+
+static void
+check_aimd(void)
+{
+	limiter_t *limiter = limiter_create(2, 10, 0);
+	unsigned int i, held;
+
+	/* `limit` good completions under load raise it by one */
+	held = fill(limiter);
+	CHECK(held == 8);
+	for (i = 0; i < 7; i++)
+		complete(limiter, 100 * MSEC, B_TRUE);
+	CHECK(limiter->limit == 8);
+	complete(limiter, 100 * MSEC, B_TRUE);
+	CHECK(limiter->limit == 9);
+	held += fill(limiter);
+	CHECK(held == 9);
+
+	/* ... and never past max_limit */
+	for (i = 0; i < 100; i++) {
+		complete(limiter, 100 * MSEC, B_TRUE);
+		held += fill(limiter);
+	}
+	CHECK(limiter->limit == 10);
+
+	/* A failure cuts it to three quarters */
+	limiter_release(limiter, 100 * MSEC, B_FALSE);
+	held--;
+	CHECK(limiter->limit == 7);
+
+	/* but only once per average round trip (100ms here) */
+	limiter_release(limiter, 100 * MSEC, B_FALSE);
+	held--;
+	CHECK(limiter->limit == 7);
+
+	/* A good answer over twice the average counts as a failure too */
+	(void) usleep(150 * 1000);
+	limiter_release(limiter, 500 * MSEC, B_TRUE);
+	held--;
+	CHECK(limiter->limit == 5);
+
+	/* and it goes no lower than min_limit */
+	for (i = 0; i < 3 && held > 0; i++) {
+		(void) usleep(150 * 1000);
+		limiter_release(limiter, 100 * MSEC, B_FALSE);
+		held--;
+	}
+	CHECK(limiter->limit == 2);
+
+	drain(limiter, held);
+	limiter_destroy(limiter);
+}
+
+static void
+check_idle(void)
+{
+	limiter_t *limiter = limiter_create(1, 64, 0);
+	unsigned int i;
+
+	/* One request at a time is nowhere near a limit of 8: no growth */
+	for (i = 0; i < 100; i++) {
+		CHECK(limiter_try_acquire(limiter));
+		limiter_release(limiter, MSEC, B_TRUE);
+	}
+	CHECK(limiter->limit == 8);
+
+	limiter_destroy(limiter);
+}
+
+int
+main(void)
+{
+	check_create();
+	check_slots();
+	check_deadline();
+	check_wakeup();
+	check_aimd();
+	check_idle();
+
+	if (g_failures != 0) {
+		(void) printf("limiter_test: %lu failures\n", g_failures);
+		return (1);
+	}
+
+	(void) printf("limiter_test: ok\n");
+	return (0);
+}
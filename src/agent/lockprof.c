@@ -0,0 +1,205 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <atomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bunyan.h"
+#include "lockprof.h"
+#include "stats.h"
+#include "util.h"
+
+/* Room for a full histogram, "<1us:N 1us:N 2us:N ..." */
+#define	LOCKPROF_HIST_LEN	640
+
+static boolean_t g_lockprof_enabled = B_FALSE;
+
+
+static int
+lockprof_bucket(hrtime_t ns)
+{
+	uint64_t us = (uint64_t)ns / 1000;
+	int bucket;
+
+	if (us == 0)
+		return (0);
+
+	bucket = 64 - __builtin_clzll(us);
+	return (bucket < LOCKPROF_BUCKETS ? bucket : LOCKPROF_BUCKETS - 1);
+}
+
+
+/* Caller holds the lock */
+static void
+lockprof_record_hold(lockprof_t *lp, hrtime_t hold)
+{
+	lockprof_stats_t *stats = &lp->stats;
+	lockprof_site_t *site = &stats->other;
+	int i;
+
+	stats->hold += hold;
+	stats->hold_hist[lockprof_bucket(hold)]++;
+
+	for (i = 0; i < LOCKPROF_SITES; i++) {
+		if (stats->sites[i].site == NULL ||
+		    stats->sites[i].site == lp->holder) {
+			site = &stats->sites[i];
+			site->site = lp->holder;
+			break;
+		}
+	}
+	site->count++;
+	site->hold += hold;
+}
+
+
+/* Writes the non-empty buckets, labelled by their lower bounds */
+static void
+lockprof_format_hist(char *buf, size_t len, const uint64_t *hist)
+{
+	size_t off = 0;
+	int n;
+	int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < LOCKPROF_BUCKETS && off < len; i++) {
+		if (hist[i] == 0)
+			continue;
+		if (i == 0) {
+			n = snprintf(buf + off, len - off, "%s<1us:%llu",
+			    (off == 0 ? "" : " "), (unsigned long long)hist[i]);
+		} else {
+			n = snprintf(buf + off, len - off, "%s%lluus:%llu",
+			    (off == 0 ? "" : " "), 1ULL << (i - 1),
+			    (unsigned long long)hist[i]);
+		}
+		if (n < 0)
+			break;
+		off += n;
+	}
+}
+
+
+/* Longest total hold first */
+static int
+lockprof_site_compare(const void *a, const void *b)
+{
+	const lockprof_site_t *sa = a;
+	const lockprof_site_t *sb = b;
+
+	if (sa->hold != sb->hold)
+		return (sa->hold > sb->hold ? -1 : 1);
+	return (0);
+}
+
+
+static void
+lockprof_report_site(const lockprof_t *lp, const char *name,
+    const lockprof_site_t *site)
+{
+	bunyan_info("stats: lock holder",
+	    BUNYAN_STRING, "lock", lp->name,
+	    BUNYAN_STRING, "site", name,
+	    BUNYAN_INT64, "acquisitions", (int64_t)site->count,
+	    BUNYAN_INT64, "hold_us", (int64_t)(site->hold / 1000),
+	    BUNYAN_NONE);
+}
+
+
+static void
+lockprof_report(void *arg)
+{
+	lockprof_t *lp = arg;
+	lockprof_stats_t stats;
+	char wait_hist[LOCKPROF_HIST_LEN];
+	char hold_hist[LOCKPROF_HIST_LEN];
+	int i;
+
+	/* Not lockprof_lock(): the report shouldn't show up in itself */
+	(void) pthread_mutex_lock(&lp->mutex);
+	(void) memcpy(&stats, &lp->stats, sizeof (stats));
+	(void) pthread_mutex_unlock(&lp->mutex);
+
+	lockprof_format_hist(wait_hist, sizeof (wait_hist), stats.wait_hist);
+	lockprof_format_hist(hold_hist, sizeof (hold_hist), stats.hold_hist);
+	bunyan_info("stats: lock",
+	    BUNYAN_STRING, "lock", lp->name,
+	    BUNYAN_INT64, "acquisitions", (int64_t)stats.acquisitions,
+	    BUNYAN_INT64, "contended", (int64_t)stats.contended,
+	    BUNYAN_INT64, "wait_us", (int64_t)(stats.wait / 1000),
+	    BUNYAN_INT64, "hold_us", (int64_t)(stats.hold / 1000),
+	    BUNYAN_STRING, "wait_hist", wait_hist,
+	    BUNYAN_STRING, "hold_hist", hold_hist,
+	    BUNYAN_NONE);
+
+	qsort(stats.sites, LOCKPROF_SITES, sizeof (lockprof_site_t),
+	    lockprof_site_compare);
+	for (i = 0; i < LOCKPROF_TOP_SITES && stats.sites[i].count != 0; i++)
+		lockprof_report_site(lp, stats.sites[i].site, &stats.sites[i]);
+	if (stats.other.count != 0)
+		lockprof_report_site(lp, "other", &stats.other);
+}
+
+
+void
+lockprof_enable(void)
+{
+	g_lockprof_enabled = B_TRUE;
+}
+
+
+void
+lockprof_lock(lockprof_t *lp, const char *site)
+{
+	hrtime_t start;
+	hrtime_t wait = 0;
+
+	if (!g_lockprof_enabled) {
+		(void) pthread_mutex_lock(&lp->mutex);
+		return;
+	}
+
+	/*
+	 * Join the report the first time we're used.  Not under the lock,
+	 * since stats_report() takes it with the stats lock held.
+	 */
+	if (lp->registered == 0 && atomic_cas_32(&lp->registered, 0, 1) == 0)
+		stats_register_reporter(lockprof_report, lp);
+
+	/* Only look at the clock twice if we actually have to wait */
+	if (pthread_mutex_trylock(&lp->mutex) == 0) {
+		lp->acquired = gethrtime();
+	} else {
+		start = gethrtime();
+		(void) pthread_mutex_lock(&lp->mutex);
+		lp->acquired = gethrtime();
+		wait = lp->acquired - start;
+		lp->stats.contended++;
+	}
+
+	lp->holder = site;
+	lp->stats.acquisitions++;
+	lp->stats.wait += wait;
+	lp->stats.wait_hist[lockprof_bucket(wait)]++;
+}
+
+
+void
+lockprof_unlock(lockprof_t *lp)
+{
+	if (g_lockprof_enabled) {
+		lockprof_record_hold(lp, gethrtime() - lp->acquired);
+		lp->holder = NULL;
+	}
+
+	(void) pthread_mutex_unlock(&lp->mutex);
+}
@@ -0,0 +1,96 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef LOCKPROF_H_
+#define	LOCKPROF_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Power-of-two buckets over microseconds: bucket 0 is under 1us, and bucket
+ * i (from 1) is [2^(i-1), 2^i) us, with the last taking everything longer.
+ */
+#define	LOCKPROF_BUCKETS	24
+/* Call sites we keep hold times for; any more are lumped together */
+#define	LOCKPROF_SITES		16
+/* Call sites reported, longest total hold first */
+#define	LOCKPROF_TOP_SITES	5
+
+typedef struct lockprof_site {
+	const char *site;
+	uint64_t count;
+	hrtime_t hold;
+} lockprof_site_t;
+
+/* Only ever touched by whoever holds the lock */
+typedef struct lockprof_stats {
+	uint64_t acquisitions;
+	uint64_t contended;
+	hrtime_t wait;
+	hrtime_t hold;
+	uint64_t wait_hist[LOCKPROF_BUCKETS];
+	uint64_t hold_hist[LOCKPROF_BUCKETS];
+	lockprof_site_t sites[LOCKPROF_SITES];
+	lockprof_site_t other;
+} lockprof_stats_t;
+
+/**
+ * A mutex that can profile itself.
+ *
+ * Until lockprof_enable() is called this is a plain mutex with one extra
+ * branch.  After that every acquisition records how long it waited, and
+ * every release how long the lock was held and by which call site, and
+ * stats_report() logs the lot for each lock that has been used.
+ */
+typedef struct lockprof {
+	pthread_mutex_t mutex;
+	const char *name;
+	volatile uint32_t registered;
+	hrtime_t acquired;
+	const char *holder;
+	lockprof_stats_t stats;
+} lockprof_t;
+
+/**
+ * Static initializer.  The name is not copied, so pass a string literal.
+ */
+#define	LOCKPROF_INITIALIZER(name)	{ PTHREAD_MUTEX_INITIALIZER, (name) }
+
+/**
+ * Turns profiling on for every lockprof_t in the process.  Call once, at
+ * startup, before there are other threads.
+ */
+extern void lockprof_enable(void);
+
+/**
+ * Takes the lock.
+ *
+ * @param lp
+ * @param site who is taking it (a string literal), for the holder report
+ */
+extern void lockprof_lock(lockprof_t *lp, const char *site);
+
+/**
+ * Drops the lock.
+ *
+ * @param lp
+ */
+extern void lockprof_unlock(lockprof_t *lp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOCKPROF_H_ */
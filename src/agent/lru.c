@@ -6,16 +6,29 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #include <assert.h>
 #include "bunyan.h"
 #include "lru.h"
+#include "probes.h"
 #include "util.h"
 
+/* An owner's share of the cache */
+typedef struct lru_owner {
+	char *owner;
+	size_t count;
+	list_handle_t *list;
+	list_node_t *node;
+} lru_owner_t;
+
 typedef struct lru_entry {
 	char *key;
 	void *value;
+	list_node_t *node;
+	lru_owner_t *owner;
+	list_node_t *owner_node;
 } lru_entry_t;
 
 static lru_entry_t *
@@ -25,8 +38,10 @@ lru_entry_create(const char *key, void *value)
 	if (entry != NULL) {
 		entry->value = value;
 		entry->key = xstrdup(key);
-		if (entry->key == NULL)
+		if (entry->key == NULL) {
 			xfree(entry);
+			entry = NULL;
+		}
 	}
 
 	return (entry);
@@ -46,6 +61,76 @@ lru_entry_destroy(lru_entry_t *entry)
 }
 
 
+static lru_owner_t *
+lru_owner_get(lru_cache_t *lru, const char *owner)
+{
+	lru_owner_t *o = NULL;
+
+	o = (lru_owner_t *)hash_get(lru->owner_hash, owner);
+	if (o != NULL)
+		return (o);
+
+	o = xmalloc(sizeof (lru_owner_t));
+	if (o == NULL)
+		return (NULL);
+	o->owner = xstrdup(owner);
+	o->list = list_create();
+	o->node = list_node_create(o);
+	if (o->owner == NULL || o->list == NULL || o->node == NULL) {
+		xfree(o->owner);
+		list_destroy(o->list);
+		xfree(o->node);
+		xfree(o);
+		return (NULL);
+	}
+
+	hash_add(lru->owner_hash, owner, o);
+	list_push(lru->owners, o->node);
+	return (o);
+}
+
+
+static void
+lru_owner_destroy(lru_cache_t *lru, lru_owner_t *o)
+{
+	(void) hash_del(lru->owner_hash, o->owner);
+	list_del(lru->owners, o->node);
+	list_node_destroy(o->node);
+	list_destroy(o->list);
+	xfree(o->owner);
+	xfree(o);
+}
+
+
+/* Removes an entry from everything that tracks it, returning its value */
+static void *
+lru_evict(lru_cache_t *lru, lru_entry_t *entry)
+{
+	lru_owner_t *o = entry->owner;
+
+	bunyan_debug("lru_add: at capacity, evicting key",
+	    BUNYAN_INT32, "capacity", (o != NULL &&
+	    o->count > lru->owner_max ? lru->owner_max : lru->size),
+	    BUNYAN_STRING, "key", entry->key,
+	    BUNYAN_STRING, "owner", (o != NULL ? o->owner : "none"),
+	    BUNYAN_NONE);
+	SMARTLOGIN_CACHE_EVICT(entry->key, (o != NULL ? o->owner : NULL));
+
+	(void) hash_del(lru->hash, entry->key);
+	list_del(lru->list, entry->node);
+	list_node_destroy(entry->node);
+	if (o != NULL) {
+		list_del(o->list, entry->owner_node);
+		list_node_destroy(entry->owner_node);
+		if (--o->count == 0)
+			lru_owner_destroy(lru, o);
+	}
+	lru->count--;
+
+	return (lru_entry_destroy(entry));
+}
+
+
 lru_cache_t *
 lru_cache_create(size_t size)
 {
@@ -54,7 +139,7 @@ lru_cache_create(size_t size)
 	if (size == 0)
 		return (NULL);
 
-	lru = xmalloc(size);
+	lru = xmalloc(sizeof (lru_cache_t));
 	if (lru == NULL) {
 		return (NULL);
 	}
@@ -84,17 +169,50 @@ lru_cache_destroy(lru_cache_t *lru)
 
 	list_destroy(lru->list);
 	hash_handle_destroy(lru->hash);
+	list_destroy(lru->owners);
+	hash_handle_destroy(lru->owner_hash);
 	lru->count = 0;
 	lru->size = 0;
 	xfree(lru);
 }
 
+
+boolean_t
+lru_set_owner_quota(lru_cache_t *lru, size_t owner_max)
+{
+	if (lru == NULL) {
+		bunyan_debug("lru_set_owner_quota: NULL arguments",
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	if (owner_max != 0 && lru->owner_hash == NULL) {
+		lru->owner_hash = hash_handle_create(lru->size);
+		lru->owners = list_create();
+		if (lru->owner_hash == NULL || lru->owners == NULL)
+			return (B_FALSE);
+	}
+	lru->owner_max = owner_max;
+
+	return (B_TRUE);
+}
+
+
 void *
 lru_add(lru_cache_t *lru, const char *key, void *value)
+{
+	return (lru_add_owned(lru, NULL, key, value));
+}
+
+
+void *
+lru_add_owned(lru_cache_t *lru, const char *owner, const char *key,
+		void *value)
 {
 	list_node_t *node = NULL;
 	list_node_t *tmp = NULL;
 	lru_entry_t *entry = NULL;
+	lru_owner_t *o = NULL;
 	void *existing_value = NULL;
 
 	if (lru == NULL || key == NULL || value == NULL) {
@@ -119,23 +237,36 @@ lru_add(lru_cache_t *lru, const char *key, void *value)
 		lru_entry_destroy(entry);
 		goto out;
 	}
+	entry->node = node;
+
+	/*
+	 * If we can't track the owner we still cache the entry; it just
+	 * doesn't count against anyone's quota.
+	 */
+	if (owner != NULL && lru->owner_max != 0) {
+		o = lru_owner_get(lru, owner);
+		if (o != NULL)
+			entry->owner_node = list_node_create(entry);
+		if (entry->owner_node != NULL) {
+			entry->owner = o;
+			list_push(o->list, entry->owner_node);
+			o->count++;
+		} else if (o != NULL && o->count == 0) {
+			lru_owner_destroy(lru, o);
+		}
+	}
 
 	hash_add(lru->hash, key, node);
 	list_push(lru->list, node);
+	lru->count++;
 
-	if (lru->count++ >= lru->size) {
-		tmp = list_pop(lru->list);
-		if (tmp != NULL) {
-			entry = (lru_entry_t *)tmp->data;
-			assert(entry != NULL);
-			bunyan_debug("lru_add: at capacity, evicting key",
-			    BUNYAN_INT32, "capacity", lru->size,
-			    BUNYAN_STRING, "key", key,
-			    BUNYAN_NONE);
-			hash_del(lru->hash, entry->key);
-			existing_value = lru_entry_destroy(entry);
-			list_node_destroy(tmp);
-		}
+	o = entry->owner;
+	if (o != NULL && o->count > lru->owner_max) {
+		tmp = o->list->tail;
+		existing_value = lru_evict(lru, (lru_entry_t *)tmp->data);
+	} else if (lru->count > lru->size) {
+		tmp = lru->list->tail;
+		existing_value = lru_evict(lru, (lru_entry_t *)tmp->data);
 	}
 out:
 	return (existing_value);
@@ -151,6 +282,7 @@ lru_get(lru_cache_t *lru, const char *key)
 
 	if (lru == NULL || key == NULL) {
 		bunyan_debug("lru_get: NULL arguments", BUNYAN_NONE);
+		return (NULL);
 	}
 
 	node = (list_node_t *)hash_get(lru->hash, key);
@@ -158,8 +290,10 @@ lru_get(lru_cache_t *lru, const char *key)
 		bunyan_debug("lru_get: key not in cache",
 		    BUNYAN_STRING, "key", key,
 		    BUNYAN_NONE);
+		SMARTLOGIN_CACHE_MISS(key);
 		goto out;
 	}
+	SMARTLOGIN_CACHE_HIT(key);
 
 	entry = (lru_entry_t *)node->data;
 	assert(entry != NULL);
@@ -168,7 +302,51 @@ lru_get(lru_cache_t *lru, const char *key)
 
 	list_del(lru->list, node);
 	list_push(lru->list, node);
+	if (entry->owner != NULL) {
+		list_del(entry->owner->list, entry->owner_node);
+		list_push(entry->owner->list, entry->owner_node);
+	}
 
 out:
 	return (value);
 }
+
+
+void
+lru_walk(lru_cache_t *lru, lru_walk_cb_t cb, void *arg)
+{
+	list_node_t *node = NULL;
+	lru_entry_t *entry = NULL;
+
+	if (lru == NULL || cb == NULL) {
+		bunyan_debug("lru_walk: NULL arguments", BUNYAN_NONE);
+		return;
+	}
+
+	for (node = lru->list->head; node != NULL; node = node->next) {
+		entry = (lru_entry_t *)node->data;
+		assert(entry != NULL);
+		cb(entry->key, entry->value, arg);
+	}
+}
+
+
+void
+lru_walk_owners(lru_cache_t *lru, lru_owner_cb_t cb, void *arg)
+{
+	list_node_t *node = NULL;
+	lru_owner_t *o = NULL;
+
+	if (lru == NULL || cb == NULL) {
+		bunyan_debug("lru_walk_owners: NULL arguments", BUNYAN_NONE);
+		return;
+	}
+
+	if (lru->owners == NULL)
+		return;
+
+	for (node = lru->owners->head; node != NULL; node = node->next) {
+		o = (lru_owner_t *)node->data;
+		cb(o->owner, o->count, arg);
+	}
+}
@@ -6,6 +6,7 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #ifndef LRU_H_
@@ -24,14 +25,32 @@ extern "C" {
  * It's just a hashtable with a "queue" for choosing what to evict. Time is
  * not used for eviction, so if a caller wants anything to do with time, it
  * needs to be done outside this LRU logic.
+ *
+ * Entries can optionally belong to an owner.  With an owner quota set, no
+ * owner holds more than owner_max entries: once it's at quota, its new
+ * entries evict its own least recently used one rather than someone
+ * else's.
  */
 typedef struct lru_cache {
 	hash_handle_t *hash;
 	list_handle_t *list;
 	size_t size;
 	size_t count;
+	hash_handle_t *owner_hash;
+	list_handle_t *owners;
+	size_t owner_max;
 } lru_cache_t;
 
+/**
+ * Callback for lru_walk().  It must not modify the cache.
+ */
+typedef void (*lru_walk_cb_t)(const char *key, void *value, void *arg);
+
+/**
+ * Callback for lru_walk_owners().  It must not modify the cache.
+ */
+typedef void (*lru_owner_cb_t)(const char *owner, size_t count, void *arg);
+
 /**
  * Creates a new LRU cache of the given size.
  *
@@ -64,6 +83,32 @@ extern void lru_cache_destroy(lru_cache_t *lru);
  */
 extern void *lru_add(lru_cache_t *lru, const char *key, void *value);
 
+/**
+ * Adds a new entry on behalf of an owner, if it doesn't exist.
+ *
+ * Like lru_add(), but if an owner quota is set and the owner is already
+ * at it, the owner's own least recently used entry is the one evicted.
+ *
+ * @param lru
+ * @param owner (NULL is the same as lru_add())
+ * @param key
+ * @param value
+ * @return the evicted value, if any
+ */
+extern void *lru_add_owned(lru_cache_t *lru, const char *owner,
+			const char *key, void *value);
+
+/**
+ * Caps how many entries any one owner may hold.
+ *
+ * Only entries added after this are counted, so set it before use.
+ *
+ * @param lru
+ * @param owner_max (0 for no quota)
+ * @return boolean
+ */
+extern boolean_t lru_set_owner_quota(lru_cache_t *lru, size_t owner_max);
+
 /**
  * Retrieves an entry from the cache
  *
@@ -75,6 +120,25 @@ extern void *lru_add(lru_cache_t *lru, const char *key, void *value);
  */
 extern void *lru_get(lru_cache_t *lru, const char *key);
 
+/**
+ * Calls cb for every entry, most recently used first, without changing
+ * their order.
+ *
+ * @param lru
+ * @param cb
+ * @param arg passed to cb
+ */
+extern void lru_walk(lru_cache_t *lru, lru_walk_cb_t cb, void *arg);
+
+/**
+ * Calls cb for every owner currently holding entries, with how many.
+ *
+ * @param lru
+ * @param cb
+ * @param arg passed to cb
+ */
+extern void lru_walk_owners(lru_cache_t *lru, lru_owner_cb_t cb, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
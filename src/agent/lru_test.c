@@ -0,0 +1,211 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+/*
+ * Checks the LRU cache's eviction order, and that per-owner quotas make an
+ * owner at its quota evict its own entries instead of anyone else's.
+ *
+ *	make test
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "lru.h"
+#include "util.h"
+
+#define	CHECK(cond)	check((cond), #cond, __LINE__)
+
+#define	OWNERS_MAX	8
+
+static unsigned long g_failures = 0;
+
+typedef struct owner_counts {
+	unsigned int n;
+	const char *owner[OWNERS_MAX];
+	size_t count[OWNERS_MAX];
+} owner_counts_t;
+
+static void
+check(boolean_t ok, const char *what, int line)
+{
+	if (!ok) {
+		(void) fprintf(stderr, "lru_test:%d: %s\n", line, what);
+		g_failures++;
+	}
+}
+
+/* Values are copies of their keys, so we can tell what was evicted */
+static boolean_t
+add(lru_cache_t *lru, const char *owner, const char *key, const char *want)
+{
+	char *evicted = NULL;
+	boolean_t ok;
+
+	evicted = lru_add_owned(lru, owner, key, xstrdup(key));
+	if (want == NULL)
+		ok = (evicted == NULL);
+	else
+		ok = (evicted != NULL && strcmp(evicted, want) == 0);
+	if (!ok) {
+		(void) fprintf(stderr, "lru_test: adding %s evicted %s, "
+		    "not %s\n", key, evicted != NULL ? evicted : "nothing",
+		    want != NULL ? want : "nothing");
+	}
+	xfree(evicted);
+
+	return (ok);
+}
+
+static boolean_t
+cached(lru_cache_t *lru, const char *key)
+{
+	return (lru_get(lru, key) != NULL);
+}
+
+static void
+count_owner(const char *owner, size_t count, void *arg)
+{
+	owner_counts_t *oc = arg;
+
+	if (oc->n < OWNERS_MAX) {
+		oc->owner[oc->n] = owner;
+		oc->count[oc->n] = count;
+	}
+	oc->n++;
+}
+
+/* How many entries lru_walk_owners() says owner holds, or 0 */
+static size_t
+owner_count(lru_cache_t *lru, const char *owner, unsigned int *owners)
+{
+	owner_counts_t oc;
+	unsigned int i;
+
+	(void) memset(&oc, 0, sizeof (oc));
+	lru_walk_owners(lru, count_owner, &oc);
+	if (owners != NULL)
+		*owners = oc.n;
+	for (i = 0; i < oc.n && i < OWNERS_MAX; i++) {
+		if (strcmp(oc.owner[i], owner) == 0)
+			return (oc.count[i]);
+	}
+
+	return (0);
+}
+
+static void
+free_value(const char *key, void *value, void *arg)
+{
+	xfree(value);
+}
+
+static void
+destroy(lru_cache_t *lru)
+{
+	lru_walk(lru, free_value, NULL);
+	lru_cache_destroy(lru);
+}
+
+static void
+check_lru(void)
+{
+	lru_cache_t *lru = lru_cache_create(4);
+
+	CHECK(add(lru, NULL, "a", NULL));
+	CHECK(add(lru, NULL, "b", NULL));
+	CHECK(add(lru, NULL, "c", NULL));
+	CHECK(add(lru, NULL, "d", NULL));
+	CHECK(lru->count == 4);
+
+	/* Using "a" makes "b" the least recently used */
+	CHECK(cached(lru, "a"));
+	CHECK(add(lru, NULL, "e", "b"));
+	CHECK(!cached(lru, "b"));
+	CHECK(add(lru, NULL, "f", "c"));
+
+	/* Adding a key that's there already changes nothing */
+	CHECK(lru_add(lru, "a", "other") == NULL);
+	CHECK(strcmp(lru_get(lru, "a"), "a") == 0);
+	CHECK(lru->count == 4);
+
+	/* Without a quota, owners are ignored */
+	CHECK(add(lru, "alice", "g", "d"));
+	CHECK(owner_count(lru, "alice", NULL) == 0);
+
+	destroy(lru);
+}
+
+static void
+check_quota(void)
+{
+	lru_cache_t *lru = lru_cache_create(8);
+	unsigned int owners;
+
+	CHECK(lru_set_owner_quota(lru, 3));
+
+	CHECK(add(lru, "alice", "a1", NULL));
+	CHECK(add(lru, "bob", "b1", NULL));
+	CHECK(add(lru, "alice", "a2", NULL));
+	CHECK(add(lru, "alice", "a3", NULL));
+	CHECK(add(lru, "bob", "b2", NULL));
+	CHECK(owner_count(lru, "alice", &owners) == 3);
+	CHECK(owners == 2);
+	CHECK(owner_count(lru, "bob", NULL) == 2);
+
+	/*
+	 * At her quota, alice's next entry evicts her own oldest, even though
+	 * bob's b1 is older and the cache isn't full.
+	 */
+	CHECK(add(lru, "alice", "a4", "a1"));
+	CHECK(cached(lru, "b1"));
+	CHECK(owner_count(lru, "alice", NULL) == 3);
+
+	/* Her least recently used, that is */
+	CHECK(cached(lru, "a2"));
+	CHECK(add(lru, "alice", "a5", "a3"));
+	CHECK(cached(lru, "a2") && cached(lru, "a4") && cached(lru, "a5"));
+
+	/* Entries with no owner count against nobody's quota */
+	CHECK(add(lru, NULL, "n1", NULL));
+	CHECK(add(lru, NULL, "n2", NULL));
+	CHECK(lru->count == 7);
+
+	/*
+	 * Once the cache itself is full, an owner under quota evicts the
+	 * least recently used entry overall.  Here that's b2 (the lookups
+	 * above refreshed b1 and alice's), which leaves bob one.
+	 */
+	CHECK(add(lru, "carol", "c1", NULL));
+	CHECK(add(lru, "carol", "c2", "b2"));
+	CHECK(owner_count(lru, "bob", NULL) == 1);
+
+	/* An owner whose last entry goes is forgotten */
+	CHECK(add(lru, "carol", "c3", "b1"));
+	CHECK(owner_count(lru, "bob", &owners) == 0);
+	CHECK(owners == 2);
+	CHECK(owner_count(lru, "carol", NULL) == 3);
+
+	destroy(lru);
+}
+
+int
+main(void)
+{
+	check_lru();
+	check_quota();
+
+	if (g_failures != 0) {
+		(void) printf("lru_test: %lu failures\n", g_failures);
+		return (1);
+	}
+
+	(void) printf("lru_test: ok\n");
+	return (0);
+}
@@ -6,22 +6,115 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <wchar.h>
 #include <sys/debug.h>
+#include <sys/sysmacros.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <libnvpair.h>
 
+#include "nvpair_json.h"
+#include "util.h"
+
 #define	FPRINTF(fp, ...)				\
 	do {						\
 		if (fprintf(fp, __VA_ARGS__) < 0)	\
 			return (-1);			\
 	} while (0)
 
+/*
+ * Most of what we log (uuids, fingerprints, zone names) is plain printable
+ * ASCII that comes out exactly as it went in.  These find how long such a
+ * run is, a word or a vector at a time, so it can be copied in one go and
+ * only the bytes that need escaping (or decoding) go through mbrtowc(3C).
+ *
+ * A byte is safe when it's 0x20-0x7f and neither '"' nor '\\'.  The NUL
+ * terminator is unsafe, so runs never extend past the end of the string;
+ * and since we only read whole aligned blocks, we never read from a page
+ * the string doesn't touch.  json_escape_test.c (`make test`) holds the
+ * result to the old byte-at-a-time escaper.
+ */
+#define	JSON_SAFE(c)	\
+	((c) >= 0x20 && (c) < 0x80 && (c) != '"' && (c) != '\\')
+
+#if defined(__SSE2__)
+
+static size_t
+json_safe_run(const char *input)
+{
+	const unsigned char *p = (const unsigned char *)input;
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	__m128i v, bad;
+	int mask;
+
+	for (; ((uintptr_t)p & 15) != 0; p++) {
+		if (!JSON_SAFE(*p))
+			return (p - (const unsigned char *)input);
+	}
+
+	for (;;) {
+		v = _mm_load_si128((const __m128i *)p);
+		/* Signed compare: 0x80-0xff are negative, so "< 0x20" too */
+		bad = _mm_or_si128(_mm_cmplt_epi8(v, space),
+		    _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+		    _mm_cmpeq_epi8(v, bslash)));
+		mask = _mm_movemask_epi8(bad);
+		if (mask != 0)
+			break;
+		p += 16;
+	}
+
+	return (p + __builtin_ctz(mask) - (const unsigned char *)input);
+}
+
+#else	/* !__SSE2__ */
+
+#define	ONES	((uint64_t)0x0101010101010101ULL)
+#define	HIGHS	((uint64_t)0x8080808080808080ULL)
+
+/* Non-zero if any byte of x is zero (never misses one) */
+#define	HAS_ZERO(x)	(((x) - ONES) & ~(x) & HIGHS)
+
+static size_t
+json_safe_run(const char *input)
+{
+	const unsigned char *p = (const unsigned char *)input;
+	uint64_t x;
+
+	for (; ((uintptr_t)p & 7) != 0; p++) {
+		if (!JSON_SAFE(*p))
+			return (p - (const unsigned char *)input);
+	}
+
+	for (;;) {
+		(void) memcpy(&x, p, sizeof (x));
+		/* A high bit set, a byte < 0x20, a '"' or a '\\' */
+		if (((x | (x - ONES * 0x20)) & HIGHS) != 0 ||
+		    HAS_ZERO(x ^ (ONES * '"')) ||
+		    HAS_ZERO(x ^ (ONES * '\\')))
+			break;
+		p += 8;
+	}
+
+	/* Something in this word is unsafe; find it */
+	for (; JSON_SAFE(*p); p++)
+		continue;
+	return (p - (const unsigned char *)input);
+}
+
+#endif	/* __SSE2__ */
+
 /*
  * When formatting a string for JSON output we must escape certain characters,
  * as described in RFC4627.  This applies to both member names and
@@ -37,39 +130,69 @@
  *
  * The output will be entirely 7-bit ASCII (as a subset of UTF-8) with all
  * representable Unicode characters included in their escaped numeric form.
+ *
+ * Like snprintf(3C), this writes no more than size bytes into dst and returns
+ * the length the whole (quoted) string needs, so the caller can tell when to
+ * retry with more room.  Unlike snprintf, it doesn't NUL terminate.
  */
-static int
-bunyan_nvlist_print_json_string(FILE *fp, const char *input)
+ssize_t
+bunyan_json_escape(char *dst, size_t size, const char *input)
 {
 	mbstate_t mbr;
 	wchar_t c;
 	size_t sz;
+	size_t len = 0;
+	size_t n;
+	char esc[8];
+	const char *out = NULL;
 
 	bzero(&mbr, sizeof (mbr));
 
-	FPRINTF(fp, "\"");
-	while ((sz = mbrtowc(&c, input, MB_CUR_MAX, &mbr)) > 0) {
+	if (len < size)
+		dst[len] = '"';
+	len++;
+	for (;;) {
+		/*
+		 * Copy the plain ASCII in bulk.  mbrtowc() leaves mbr in the
+		 * initial state after each whole character, so skipping
+		 * ahead like this doesn't upset it.
+		 */
+		n = json_safe_run(input);
+		if (n > 0) {
+			if (len < size)
+				(void) memcpy(dst + len, input,
+				    MIN(n, size - len));
+			len += n;
+			input += n;
+		}
+
+		sz = mbrtowc(&c, input, MB_CUR_MAX, &mbr);
+		if (sz == 0 || sz == (size_t)-1 || sz == (size_t)-2)
+			break;
+
+		out = esc;
+		n = 2;
 		switch (c) {
 		case '"':
-			FPRINTF(fp, "\\\"");
+			out = "\\\"";
 			break;
 		case '\n':
-			FPRINTF(fp, "\\n");
+			out = "\\n";
 			break;
 		case '\r':
-			FPRINTF(fp, "\\r");
+			out = "\\r";
 			break;
 		case '\\':
-			FPRINTF(fp, "\\\\");
+			out = "\\\\";
 			break;
 		case '\f':
-			FPRINTF(fp, "\\f");
+			out = "\\f";
 			break;
 		case '\t':
-			FPRINTF(fp, "\\t");
+			out = "\\t";
 			break;
 		case '\b':
-			FPRINTF(fp, "\\b");
+			out = "\\b";
 			break;
 		default:
 			if ((c >= 0x00 && c <= 0x1f) ||
@@ -79,16 +202,24 @@ bunyan_nvlist_print_json_string(FILE *fp, const char *input)
 				 * characters in the Basic Multilingual Plane
 				 * as JSON-escaped multibyte characters.
 				 */
-				FPRINTF(fp, "\\u%04x", (int)(0xffff & c));
+				(void) snprintf(esc, sizeof (esc), "\\u%04x",
+				    (int)(0xffff & c));
+				n = 6;
 			} else if (c >= 0x20 && c <= 0x7f) {
 				/*
 				 * Render other 7-bit ASCII characters directly
 				 * and drop other, unrepresentable characters.
 				 */
-				FPRINTF(fp, "%c", (int)(0xff & c));
+				esc[0] = (char)(0xff & c);
+				n = 1;
+			} else {
+				n = 0;
 			}
 			break;
 		}
+		if (len + n <= size)
+			(void) memcpy(dst + len, out, n);
+		len += n;
 		input += sz;
 	}
 
@@ -100,8 +231,35 @@ bunyan_nvlist_print_json_string(FILE *fp, const char *input)
 		return (-1);
 	}
 
-	FPRINTF(fp, "\"");
-	return (0);
+	if (len < size)
+		dst[len] = '"';
+	len++;
+	return ((ssize_t)len);
+}
+
+static int
+bunyan_nvlist_print_json_string(FILE *fp, const char *input)
+{
+	char buf[1024];
+	char *out = buf;
+	ssize_t len;
+
+	len = bunyan_json_escape(buf, sizeof (buf), input);
+	if (len < 0)
+		return (-1);
+	if (len > sizeof (buf)) {
+		out = xmalloc(len);
+		if (out == NULL)
+			return (-1);
+		(void) bunyan_json_escape(out, len, input);
+	}
+
+	if (fwrite(out, 1, len, fp) != len)
+		len = -1;
+	if (out != buf)
+		xfree(out);
+
+	return (len < 0 ? -1 : 0);
 }
 
 /*
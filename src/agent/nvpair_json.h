@@ -6,16 +6,22 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #ifndef	NVPAIR_JSON_H_
 #define	NVPAIR_JSON_H_
 
+#include <stdio.h>
+#include <sys/types.h>
+#include <libnvpair.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 extern int bunyan_nvlist_print_json(FILE *, nvlist_t *);
+extern ssize_t bunyan_json_escape(char *, size_t, const char *);
 
 #ifdef __cplusplus
 }
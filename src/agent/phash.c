@@ -0,0 +1,266 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "bunyan.h"
+#include "phash.h"
+#include "util.h"
+
+/* Average keys per bucket */
+#define	PHASH_BUCKET_LOAD	4
+
+/* Displacements to try for a bucket before giving up */
+#define	PHASH_MAX_DISP		(1U << 20)
+
+typedef struct phash_key {
+	const char *key;
+	size_t len;
+	unsigned int value;
+	uint32_t bucket;
+	unsigned int bucket_size;
+} phash_key_t;
+
+
+/*
+ * FNV-1a over the lower-cased key, perturbed by seed, with a final mix so
+ * the low bits we index by depend on every byte.
+ */
+static uint32_t
+phash_hash(const char *key, size_t len, uint32_t seed)
+{
+	uint32_t h = 2166136261U ^ seed;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint32_t)tolower((unsigned char)key[i]);
+		h *= 16777619U;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	return (h);
+}
+
+
+static uint32_t
+phash_slot(const phash_t *ph, const char *key, size_t len)
+{
+	uint32_t b = phash_hash(key, len, 0) & ph->bucket_mask;
+
+	return (phash_hash(key, len, ph->disp[b]) & ph->mask);
+}
+
+
+/* Rounds up to a power of two */
+static uint32_t
+phash_pow2(uint32_t n)
+{
+	uint32_t size = 1;
+
+	while (size < n)
+		size <<= 1;
+	return (size);
+}
+
+
+/* Orders keys by bucket, biggest buckets first */
+static int
+phash_key_compare(const void *pa, const void *pb)
+{
+	const phash_key_t *a = pa;
+	const phash_key_t *b = pb;
+
+	if (a->bucket_size != b->bucket_size)
+		return (a->bucket_size > b->bucket_size ? -1 : 1);
+	if (a->bucket != b->bucket)
+		return (a->bucket < b->bucket ? -1 : 1);
+	return (0);
+}
+
+
+/*
+ * Finds a displacement for the n keys of one bucket that puts each in an
+ * empty slot, distinct from each other, and claims those slots.
+ */
+static boolean_t
+phash_displace(phash_t *ph, const phash_key_t *keys, unsigned int n,
+    uint32_t *slots)
+{
+	uint32_t d;
+	unsigned int i, j;
+
+	for (d = 1; d < PHASH_MAX_DISP; d++) {
+		for (i = 0; i < n; i++) {
+			slots[i] = phash_hash(keys[i].key, keys[i].len, d) &
+			    ph->mask;
+			if (ph->table[slots[i]].key != NULL)
+				break;
+			for (j = 0; j < i && slots[j] != slots[i]; j++)
+				continue;
+			if (j < i)
+				break;
+		}
+		if (i < n)
+			continue;
+
+		ph->disp[keys[0].bucket] = d;
+		for (i = 0; i < n; i++) {
+			ph->table[slots[i]].key = (char *)keys[i].key;
+			ph->table[slots[i]].len = keys[i].len;
+			ph->table[slots[i]].value = keys[i].value;
+		}
+		return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+
+phash_t *
+phash_create(const char **keys, const unsigned int *values,
+    unsigned int count)
+{
+	phash_t *ph = NULL;
+	phash_key_t *uniq = NULL;
+	unsigned int *sizes = NULL;
+	uint32_t *slots = NULL;
+	unsigned int i, j, n = 0;
+	boolean_t ok = B_FALSE;
+
+	if ((keys == NULL || values == NULL) && count != 0) {
+		bunyan_debug("phash_create: NULL arguments", BUNYAN_NONE);
+		return (NULL);
+	}
+
+	ph = xmalloc(sizeof (phash_t));
+	uniq = xcalloc(count + 1, sizeof (phash_key_t));
+	if (ph == NULL || uniq == NULL)
+		goto out;
+
+	/* Drop all but the last of any duplicates; they'd never separate */
+	for (i = 0; i < count; i++) {
+		for (j = i + 1; j < count; j++) {
+			if (strcasecmp(keys[i], keys[j]) == 0)
+				break;
+		}
+		if (j < count)
+			continue;
+		uniq[n].key = keys[i];
+		uniq[n].len = strlen(keys[i]);
+		uniq[n].value = values[i];
+		n++;
+	}
+	ph->count = n;
+
+	ph->mask = phash_pow2(2 * n) - 1;
+	ph->bucket_mask = phash_pow2(n / PHASH_BUCKET_LOAD + 1) - 1;
+	ph->table = xcalloc(ph->mask + 1, sizeof (phash_entry_t));
+	ph->disp = xcalloc(ph->bucket_mask + 1, sizeof (uint32_t));
+	sizes = xcalloc(ph->bucket_mask + 1, sizeof (unsigned int));
+	slots = xcalloc(n + 1, sizeof (uint32_t));
+	if (ph->table == NULL || ph->disp == NULL || sizes == NULL ||
+	    slots == NULL)
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		uniq[i].bucket = phash_hash(uniq[i].key, uniq[i].len, 0) &
+		    ph->bucket_mask;
+		sizes[uniq[i].bucket]++;
+	}
+	for (i = 0; i < n; i++)
+		uniq[i].bucket_size = sizes[uniq[i].bucket];
+	qsort(uniq, n, sizeof (phash_key_t), phash_key_compare);
+
+	/* Place the most crowded buckets first, while there's most room */
+	for (i = 0; i < n; i += uniq[i].bucket_size) {
+		if (!phash_displace(ph, &uniq[i], uniq[i].bucket_size,
+		    slots)) {
+			bunyan_error("phash_create: no perfect hash found",
+			    BUNYAN_INT32, "count", n,
+			    BUNYAN_NONE);
+			(void) memset(ph->table, 0,
+			    (ph->mask + 1) * sizeof (phash_entry_t));
+			goto out;
+		}
+	}
+
+	/* Entries point at the caller's keys until now */
+	for (i = 0; i <= ph->mask; i++) {
+		if (ph->table[i].key == NULL)
+			continue;
+		ph->table[i].key = xstrdup(ph->table[i].key);
+		if (ph->table[i].key == NULL) {
+			/* Don't let phash_destroy() free what isn't ours */
+			for (j = i + 1; j <= ph->mask; j++)
+				ph->table[j].key = NULL;
+			goto out;
+		}
+	}
+	ok = B_TRUE;
+
+	bunyan_debug("phash_create: built table",
+	    BUNYAN_INT32, "count", n,
+	    BUNYAN_INT32, "size", (int)(ph->mask + 1),
+	    BUNYAN_INT32, "buckets", (int)(ph->bucket_mask + 1),
+	    BUNYAN_NONE);
+
+out:
+	xfree(slots);
+	xfree(sizes);
+	xfree(uniq);
+	if (!ok) {
+		phash_destroy(ph);
+		ph = NULL;
+	}
+	return (ph);
+}
+
+
+void
+phash_destroy(phash_t *ph)
+{
+	uint32_t i;
+
+	if (ph == NULL)
+		return;
+
+	if (ph->table != NULL) {
+		for (i = 0; i <= ph->mask; i++)
+			xfree(ph->table[i].key);
+		xfree(ph->table);
+	}
+	xfree(ph->disp);
+	xfree(ph);
+}
+
+
+boolean_t
+phash_lookup(const phash_t *ph, const char *key, size_t len,
+    unsigned int *value)
+{
+	const phash_entry_t *e = NULL;
+
+	if (ph == NULL || key == NULL || ph->count == 0)
+		return (B_FALSE);
+
+	e = &ph->table[phash_slot(ph, key, len)];
+	if (e->key == NULL || e->len != len ||
+	    strncasecmp(e->key, key, len) != 0)
+		return (B_FALSE);
+
+	if (value != NULL)
+		*value = e->value;
+	return (B_TRUE);
+}
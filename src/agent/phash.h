@@ -0,0 +1,79 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef PHASH_H_
+#define	PHASH_H_
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct phash_entry {
+	char *key;
+	size_t len;
+	unsigned int value;
+} phash_entry_t;
+
+/**
+ * A read-only, case-insensitive string set with a value per key.
+ *
+ * This is a "hash and displace" perfect hash: keys are hashed into a few
+ * buckets, and at create time each bucket is given a displacement (a seed
+ * for a second hash) under which its keys land in slots nobody else is
+ * using.  So a lookup is two hashes, one slot and at most one comparison,
+ * no matter how many keys there are.  The table is never modified
+ * afterwards, so lookups need no locking.
+ */
+typedef struct phash {
+	phash_entry_t *table;
+	uint32_t mask;
+	uint32_t *disp;
+	uint32_t bucket_mask;
+	unsigned int count;
+} phash_t;
+
+/**
+ * Builds a table.  Keys that differ only in case are duplicates; the last
+ * one wins.
+ *
+ * @param keys
+ * @param values one per key
+ * @param count (may be 0, for a table that matches nothing)
+ * @return phash_t on success, NULL on error
+ */
+extern phash_t *phash_create(const char **keys, const unsigned int *values,
+			unsigned int count);
+
+/**
+ * Frees a table.
+ *
+ * @param ph
+ */
+extern void phash_destroy(phash_t *ph);
+
+/**
+ * Looks up a key.
+ *
+ * @param ph
+ * @param key needn't be NUL terminated
+ * @param len
+ * @param value set to the key's value, if found (may be NULL)
+ * @return B_TRUE if key is in the table
+ */
+extern boolean_t phash_lookup(const phash_t *ph, const char *key, size_t len,
+			unsigned int *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PHASH_H_ */
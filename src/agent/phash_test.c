@@ -0,0 +1,167 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+/*
+ * Checks the perfect hash behind capi-allowed-users: every key is found,
+ * with its value and in any case, and nothing else is, from the default
+ * three users up to a few thousand.
+ *
+ *	make test
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "phash.h"
+#include "util.h"
+
+#define	CHECK(cond)	check((cond), #cond, __LINE__)
+
+#define	MANY_KEYS	5000
+#define	KEY_LEN		16
+
+static unsigned long g_failures = 0;
+
+static void
+check(boolean_t ok, const char *what, int line)
+{
+	if (!ok) {
+		(void) fprintf(stderr, "phash_test:%d: %s\n", line, what);
+		g_failures++;
+	}
+}
+
+static boolean_t
+lookup(const phash_t *ph, const char *key, unsigned int *value)
+{
+	return (phash_lookup(ph, key, strlen(key), value));
+}
+
+static void
+check_users(void)
+{
+	const char *keys[] = { "root", "admin", "node" };
+	const unsigned int values[] = { 10, 20, 30 };
+	phash_t *ph = NULL;
+	unsigned int value;
+
+	ph = phash_create(keys, values, 3);
+	CHECK(ph != NULL);
+
+	value = 0;
+	CHECK(lookup(ph, "root", &value) && value == 10);
+	CHECK(lookup(ph, "admin", &value) && value == 20);
+	CHECK(lookup(ph, "node", &value) && value == 30);
+
+	/* Case doesn't matter, and value may be NULL */
+	CHECK(lookup(ph, "ROOT", &value) && value == 10);
+	CHECK(lookup(ph, "Admin", NULL));
+
+	/* Only the whole key matches */
+	CHECK(!lookup(ph, "roo", NULL));
+	CHECK(!lookup(ph, "rootx", NULL));
+	CHECK(!lookup(ph, "nodes", NULL));
+	CHECK(!lookup(ph, "", NULL));
+	CHECK(!lookup(ph, "alice", NULL));
+
+	/* Keys are taken by length, not up to a NUL */
+	CHECK(phash_lookup(ph, "rootless", 4, &value) && value == 10);
+	CHECK(!phash_lookup(ph, "rootless", 5, NULL));
+
+	phash_destroy(ph);
+}
+
+static void
+check_duplicates(void)
+{
+	const char *keys[] = { "root", "admin", "ROOT" };
+	const unsigned int values[] = { 1, 2, 3 };
+	phash_t *ph = NULL;
+	unsigned int value;
+
+	ph = phash_create(keys, values, 3);
+	CHECK(ph != NULL && ph->count == 2);
+	CHECK(lookup(ph, "root", &value) && value == 3);
+	CHECK(lookup(ph, "admin", &value) && value == 2);
+	phash_destroy(ph);
+}
+
+static void
+check_empty(void)
+{
+	phash_t *ph = NULL;
+
+	ph = phash_create(NULL, NULL, 0);
+	CHECK(ph != NULL);
+	CHECK(!lookup(ph, "root", NULL));
+	CHECK(!lookup(ph, "", NULL));
+	phash_destroy(ph);
+}
+
+static void
+check_many(void)
+{
+	static char names[MANY_KEYS][KEY_LEN];
+	static const char *keys[MANY_KEYS];
+	static unsigned int values[MANY_KEYS];
+	char other[KEY_LEN];
+	phash_t *ph = NULL;
+	unsigned int i, value;
+	unsigned long missing = 0, wrong = 0, extra = 0;
+
+	for (i = 0; i < MANY_KEYS; i++) {
+		(void) snprintf(names[i], KEY_LEN, "user%u", i);
+		keys[i] = names[i];
+		values[i] = i * 7;
+	}
+
+	ph = phash_create(keys, values, MANY_KEYS);
+	CHECK(ph != NULL && ph->count == MANY_KEYS);
+	if (ph == NULL)
+		return;
+
+	for (i = 0; i < MANY_KEYS; i++) {
+		if (!lookup(ph, keys[i], &value))
+			missing++;
+		else if (value != values[i])
+			wrong++;
+
+		(void) snprintf(other, sizeof (other), "User%u", i);
+		if (!lookup(ph, other, NULL))
+			missing++;
+		(void) snprintf(other, sizeof (other), "user%u", i + MANY_KEYS);
+		if (lookup(ph, other, NULL))
+			extra++;
+		(void) snprintf(other, sizeof (other), "resu%u", i);
+		if (lookup(ph, other, NULL))
+			extra++;
+	}
+	CHECK(missing == 0);
+	CHECK(wrong == 0);
+	CHECK(extra == 0);
+
+	phash_destroy(ph);
+}
+
+int
+main(void)
+{
+	check_users();
+	check_duplicates();
+	check_empty();
+	check_many();
+
+	if (g_failures != 0) {
+		(void) printf("phash_test: %lu failures\n", g_failures);
+		return (1);
+	}
+
+	(void) printf("phash_test: ok\n");
+	return (0);
+}
@@ -0,0 +1,40 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef PROBES_H_
+#define	PROBES_H_
+
+/*
+ * The probes in smartlogin.d.  The SmartOS build defines SMARTLOGIN_USDT
+ * and generates smartlogin_provider.h from the provider with dtrace -h;
+ * a disabled probe is a few nops.  Built without it, they're nothing.
+ */
+#if defined(SMARTLOGIN_USDT)
+
+#include "smartlogin_provider.h"
+
+#else
+
+#define	SMARTLOGIN_DOOR_START(svc, zone, req_id)
+#define	SMARTLOGIN_DOOR_DONE(svc, zone, req_id, allowed, ns)
+#define	SMARTLOGIN_CACHE_HIT(key)
+#define	SMARTLOGIN_CACHE_MISS(key)
+#define	SMARTLOGIN_CACHE_EVICT(key, owner)
+#define	SMARTLOGIN_LOCK_WAIT_START(lock)
+#define	SMARTLOGIN_LOCK_WAIT_DONE(lock, ns)
+#define	SMARTLOGIN_CAPI_ATTEMPT_START(url, uuid)
+#define	SMARTLOGIN_CAPI_ATTEMPT_DONE(url, res, http_code, ns)
+#define	SMARTLOGIN_CAPI_RETRY(uuid, attempts, backoff_ms)
+#define	SMARTLOGIN_ZDOOR_OPEN(zone, svc)
+#define	SMARTLOGIN_ZDOOR_CLOSE(zone, svc)
+
+#endif	/* SMARTLOGIN_USDT */
+
+#endif /* PROBES_H_ */
@@ -0,0 +1,141 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include "bunyan.h"
+#include "ratelimit.h"
+#include "util.h"
+
+/* Tokens are counted in thousandths, so slow rates still refill smoothly */
+#define	RATELIMIT_TOKEN		1000
+
+/* limited counts the calls turned away since the last stats report */
+typedef struct ratelimit_bucket {
+	uint64_t tokens;
+	hrtime_t updated;
+	uint64_t limited;
+} ratelimit_bucket_t;
+
+
+/*
+ * Logs the keys limited since the last report, and starts counting again,
+ * so each report (made under rl->lock) is only as long as the keys that
+ * are being limited now.
+ */
+static void
+ratelimit_report_bucket(const char *key, void *value, void *arg)
+{
+	ratelimit_t *rl = arg;
+	ratelimit_bucket_t *bucket = value;
+
+	if (bucket->limited == 0)
+		return;
+
+	bunyan_info("stats: login rate limit",
+	    BUNYAN_STRING, "limit", rl->name,
+	    BUNYAN_STRING, "key", key,
+	    BUNYAN_INT64, "limited", (int64_t)bucket->limited,
+	    BUNYAN_NONE);
+	bucket->limited = 0;
+}
+
+
+static void
+ratelimit_report(void *arg)
+{
+	ratelimit_t *rl = arg;
+
+	(void) pthread_mutex_lock(&rl->lock);
+	lru_walk(rl->buckets, ratelimit_report_bucket, rl);
+	(void) pthread_mutex_unlock(&rl->lock);
+}
+
+
+ratelimit_t *
+ratelimit_create(const char *name, unsigned int rate, unsigned int burst,
+		size_t max_keys)
+{
+	ratelimit_t *rl = NULL;
+
+	if (name == NULL || rate == 0 || max_keys == 0) {
+		bunyan_debug("ratelimit_create: NULL arguments", BUNYAN_NONE);
+		return (NULL);
+	}
+
+	rl = xmalloc(sizeof (ratelimit_t));
+	if (rl == NULL)
+		return (NULL);
+
+	rl->buckets = lru_cache_create(max_keys);
+	if (rl->buckets == NULL) {
+		xfree(rl);
+		return (NULL);
+	}
+
+	(void) pthread_mutex_init(&rl->lock, NULL);
+	rl->name = name;
+	rl->rate = rate;
+	rl->burst = (burst != 0 ? burst : rate);
+	rl->limited = stats_counter_create(name);
+	stats_register_reporter(ratelimit_report, rl);
+
+	return (rl);
+}
+
+
+boolean_t
+ratelimit_allow(ratelimit_t *rl, const char *key)
+{
+	ratelimit_bucket_t *bucket = NULL;
+	uint64_t max;
+	hrtime_t now;
+	boolean_t allow = B_TRUE;
+
+	if (rl == NULL)
+		return (B_TRUE);
+	if (key == NULL) {
+		bunyan_debug("ratelimit_allow: NULL arguments", BUNYAN_NONE);
+		return (B_TRUE);
+	}
+
+	now = gethrtime();
+	max = (uint64_t)rl->burst * RATELIMIT_TOKEN;
+
+	(void) pthread_mutex_lock(&rl->lock);
+	bucket = (ratelimit_bucket_t *)lru_get(rl->buckets, key);
+	if (bucket == NULL) {
+		bucket = xmalloc(sizeof (ratelimit_bucket_t));
+		if (bucket == NULL)
+			goto out;
+		bucket->tokens = max;
+		bucket->updated = now;
+		xfree(lru_add(rl->buckets, key, bucket));
+	}
+
+	/* rate tokens/s is rate * RATELIMIT_TOKEN units per 10^9 ns */
+	bucket->tokens += (uint64_t)(now - bucket->updated) * rl->rate /
+	    (1000000000ULL / RATELIMIT_TOKEN);
+	if (bucket->tokens > max)
+		bucket->tokens = max;
+	bucket->updated = now;
+
+	if (bucket->tokens >= RATELIMIT_TOKEN) {
+		bucket->tokens -= RATELIMIT_TOKEN;
+	} else {
+		bucket->limited++;
+		allow = B_FALSE;
+	}
+
+out:
+	(void) pthread_mutex_unlock(&rl->lock);
+
+	if (!allow)
+		stats_incr(rl->limited);
+	return (allow);
+}
@@ -0,0 +1,69 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef RATELIMIT_H_
+#define	RATELIMIT_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "lru.h"
+#include "stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A set of token buckets, one per key (e.g., per zone or per owner).
+ *
+ * Each bucket holds up to `burst` tokens and refills at `rate` tokens a
+ * second; every call takes one.  Buckets live in an LRU of `max_keys`, so
+ * memory is bounded no matter how many keys we see: a bucket that's evicted
+ * just comes back full, which only matters for keys nobody has used lately.
+ */
+typedef struct ratelimit {
+	pthread_mutex_t lock;
+	lru_cache_t *buckets;
+	const char *name;
+	unsigned int rate;
+	unsigned int burst;
+	stats_counter_t *limited;
+} ratelimit_t;
+
+/**
+ * Creates a rate limiter.
+ *
+ * The name is used in logs and stats and is not copied, so pass a string
+ * literal.
+ *
+ * @param name
+ * @param rate tokens per second
+ * @param burst bucket size (0 means the same as rate)
+ * @param max_keys most buckets kept at once
+ * @return ratelimit_t on success, NULL on error (or a zero rate)
+ */
+extern ratelimit_t *ratelimit_create(const char *name, unsigned int rate,
+			unsigned int burst, size_t max_keys);
+
+/**
+ * Takes a token from key's bucket.
+ *
+ * @param rl (NULL means no limit)
+ * @param key
+ * @return B_TRUE if there was one, B_FALSE if the key is over its limit
+ */
+extern boolean_t ratelimit_allow(ratelimit_t *rl, const char *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RATELIMIT_H_ */
@@ -6,6 +6,7 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 /*
@@ -21,9 +22,12 @@
  *
  *  For more information: https://hub.joyent.com/wiki/display/dev/SmartLogin
  */
+#include <atomic.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdio.h>
@@ -39,54 +43,417 @@
 #include "bunyan.h"
 #include "capi.h"
 #include "config.h"
+#include "limiter.h"
+#include "lockprof.h"
 #include "lru.h"
+#include "phash.h"
+#include "probes.h"
+#include "ratelimit.h"
+#include "span.h"
+#include "stats.h"
 #include "util.h"
+#include "workq.h"
 #include "zutil.h"
 
 /* Our static variables */
 static const char *KEY_SVC_NAME = "_joyent_sshd_key_is_authorized";
+static const char *KEYS_SVC_NAME = "_joyent_sshd_keys_are_authorized";
 static const char *CFGFILE_ENV_VAR = "SMARTLOGIN_CONFIG";
 
 /* Global handles */
 static capi_handle_t *g_capi_handle = NULL;
 static lru_cache_t *g_lru_cache = NULL;
 static boolean_t g_recheck_denies = B_TRUE;
+static boolean_t g_serve_stale = B_TRUE;
 static unsigned int g_cache_age = 600;
-static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static phash_t *g_allowed_users = NULL;
+static unsigned int g_login_deadline_ms = 5000;
+static workq_t *g_workq = NULL;
+static unsigned int g_capi_workers = 32;
+static unsigned int g_capi_queue_max = 256;
+static lockprof_t g_cache_lock = LOCKPROF_INITIALIZER("g_cache_lock");
+static ratelimit_t *g_zone_limit = NULL;
+static ratelimit_t *g_owner_limit = NULL;
+static unsigned int g_shed_waiters = 128;
+static unsigned int g_shed_queue_ms = 1000;
+static volatile uint32_t g_overloaded = 0;
+static unsigned int g_slow_request_ms = 1000;
+static uint32_t g_req_id_salt = 0;
+static volatile uint32_t g_req_id_seq = 0;
+
+/* Log records buffered for the writer thread when log-ring-records is unset */
+#define	DEFAULT_LOG_RING_RECORDS	4096
+
+/*
+ * Records a second each INFO/DEBUG/TRACE message may log by default: no
+ * cap, so nothing goes missing unless someone asks for it.
+ */
+#define	DEFAULT_LOG_RATE_LIMIT		0
+
+/*
+ * Binary log rotation, in the spirit of what logadm does with the SMF log
+ * when the JSON log goes to stdout: log-binary-max-size (in MB) before
+ * moving the file aside, keeping log-binary-keep of the old ones.
+ */
+#define	DEFAULT_LOG_BINARY_MAX_SIZE	64
+#define	DEFAULT_LOG_BINARY_KEEP		3
+#define	MAX_LOG_BINARY_KEEP		100
+
+/* Who CAPI keys may log in as when capi-allowed-users isn't set */
+#define	DEFAULT_ALLOWED_USERS	"root,admin,node"
+
+/*
+ * Highest load-shedding thresholds we take: beyond these, shedding could
+ * never kick in before everything else had fallen over.
+ */
+#define	MAX_SHED_WAITERS	65536
+#define	MAX_SHED_QUEUE_MS	60000
+
+/*
+ * The most the CAPI knobs in build_capi_handle_from_config() take.  The
+ * percentages mean nothing past 100; the rest are well beyond anything
+ * sensible, and mostly there to catch typos.
+ */
+#define	MAX_CAPI_PCT		100
+#define	MAX_CAPI_MULTIPLIER_PCT	10000
+#define	MAX_CAPI_SECONDS	3600
+#define	MAX_CAPI_MS		3600000
+#define	MAX_CAPI_DNS_TTL	86400
+#define	MAX_CAPI_COUNT		1000
+#define	MAX_CAPI_WORKERS	1024
+#define	MAX_CAPI_QUEUE		65536
+#define	MAX_CAPI_BATCH		1024
+#define	MAX_CAPI_CONCURRENCY	1024
+
+/* Most zones/owners we track login rates for at once */
+#define	RATELIMIT_MAX_KEYS	4096
+
+/* Most fingerprints a single KEYS_SVC_NAME call may ask about */
+#define	KEYS_MAX	32
+
+/* Room for span_format_attempts() to describe SPAN_ATTEMPTS_MAX attempts */
+#define	SPAN_ATTEMPTS_LEN	512
+
+/*
+ * Longest door request fields we accept.  Door requests are parsed into
+ * buffers of these sizes on the stack; anything longer is malformed.
+ */
+#define	USER_MAX	64
+#define	FP_MAX		128
+#define	UUID_MAX	64
+#define	CACHE_KEY_MAX	(UUID_MAX + USER_MAX + FP_MAX + 3)
+
+static stats_counter_t *g_stat_stale_served = NULL;
+static stats_counter_t *g_stat_capi_waiters = NULL;
+static stats_counter_t *g_stat_overloads = NULL;
+static stats_counter_t *g_stat_shed = NULL;
+static stats_counter_t *g_stat_user_denied = NULL;
 
 typedef struct cache_entry {
 	boolean_t allowed;
 	hrtime_t ctime;
 } cache_entry_t;
 
-static char *
-build_cache_key(const char *uuid, const char *user, const char *fp)
+/* A CAPI lookup handed off to the worker pool */
+typedef struct capi_job {
+	workq_job_t job;
+	const char *uuid;
+	const char *user;
+	const char *fp;
+	hrtime_t deadline;
+	hrtime_t queued;
+	span_t *span;
+	const char *req_id;
+	capi_result_t result;
+} capi_job_t;
+
+/*
+ * Makes up an id for a door call: 8 hex digits picked at random when we
+ * start (so ids from different CNs, or restarts, don't collide) and 8 that
+ * count calls.  buf should be BUNYAN_REQ_ID_LEN bytes.
+ */
+static void
+new_request_id(char *buf, size_t len)
 {
-	char *buf = NULL;
-	int len = 0;
+	(void) snprintf(buf, len, "%08x%08x", g_req_id_salt,
+	    atomic_inc_32_nv(&g_req_id_seq));
+}
+
 
-	len = snprintf(NULL, 0, "%s|%s|%s", uuid, user, fp) + 1;
-	buf = xmalloc(len);
-	if (buf == NULL)
+/*
+ * Builds "uuid|user|fp" into buf, which should be CACHE_KEY_MAX bytes.
+ */
+static boolean_t
+build_cache_key(char *buf, size_t len, const char *uuid, const char *user,
+    const char *fp)
+{
+	int n;
+
+	n = snprintf(buf, len, "%s|%s|%s", uuid, user, fp);
+	if (n < 0 || n >= len) {
+		bunyan_error("cache key too long",
+		    BUNYAN_STRING, "owner", uuid,
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+
+/*
+ * Copies the next space-separated token of a door request out of
+ * [*pp, end) into buf (or just skips it, if buf is NULL), and advances *pp
+ * past it.  A NUL ends the request as surely as end does, so we never read
+ * past argp_sz and never need argp to be terminated.
+ *
+ * @return the token's length, 0 if there are no more, -1 if it won't fit
+ */
+static int
+next_token(const char **pp, const char *end, char *buf, size_t len)
+{
+	const char *p = *pp;
+	const char *start = NULL;
+	size_t n;
+
+	while (p < end && *p == ' ')
+		p++;
+	start = p;
+	while (p < end && *p != ' ' && *p != '\0')
+		p++;
+	*pp = (p < end && *p == '\0') ? end : p;
+
+	n = p - start;
+	if (buf != NULL) {
+		if (n >= len)
+			return (-1);
+		(void) memcpy(buf, start, n);
+		buf[n] = '\0';
+	}
+
+	return ((int)n);
+}
+
+
+/*
+ * Whether CAPI keys may log in as this user, and if so, how long (seconds)
+ * to trust a cached answer for them.  This runs before anything that takes
+ * a lock, so requests for other users cost a hash and a counter bump.
+ */
+static boolean_t
+is_capi_user(const char *name, size_t len, unsigned int *ttl)
+{
+	unsigned int user_ttl = 0;
+
+	if (!phash_lookup(g_allowed_users, name, len, &user_ttl)) {
+		stats_incr(g_stat_user_denied);
+		return (B_FALSE);
+	}
+
+	*ttl = (user_ttl != 0 ? user_ttl : g_cache_age);
+	return (B_TRUE);
+}
+
+
+/*
+ * libzdoor frees both the result and its data once it has copied them into
+ * the door reply, so these have to be fresh allocations every time.
+ */
+static zdoor_result_t *
+door_result(const char *data, size_t size)
+{
+	zdoor_result_t *result = NULL;
+
+	result = (zdoor_result_t *)xmalloc(sizeof (zdoor_result_t));
+	if (result == NULL)
+		return (NULL);
+
+	result->zdr_size = size;
+	result->zdr_data = (char *)xmalloc(size);
+	if (result->zdr_data == NULL) {
+		xfree(result);
 		return (NULL);
+	}
+	(void) memcpy(result->zdr_data, data, size);
+
+	return (result);
+}
+
+
+static void
+cache_report_owner(const char *owner, size_t count, void *arg)
+{
+	bunyan_info("stats: cache owner",
+	    BUNYAN_STRING, "owner", owner,
+	    BUNYAN_INT32, "entries", (int)count,
+	    BUNYAN_INT32, "quota", (int)g_lru_cache->owner_max,
+	    BUNYAN_NONE);
+}
+
+
+static void
+cache_report(void *arg)
+{
+	/*
+	 * Not lockprof_lock(): we're called with the stats lock held, which
+	 * it may need, and the report shouldn't show up in the profile.
+	 */
+	(void) pthread_mutex_lock(&g_cache_lock.mutex);
+	bunyan_info("stats: cache",
+	    BUNYAN_INT32, "entries", (int)g_lru_cache->count,
+	    BUNYAN_INT32, "size", (int)g_lru_cache->size,
+	    BUNYAN_INT32, "owner_quota", (int)g_lru_cache->owner_max,
+	    BUNYAN_NONE);
+	lru_walk_owners(g_lru_cache, cache_report_owner, NULL);
+	(void) pthread_mutex_unlock(&g_cache_lock.mutex);
+}
+
+
+/*
+ * Log records are written by a background thread unless log-ring-records is
+ * 0.  log-overflow says what to do when it falls behind: "drop" (the
+ * default) or "block".
+ *
+ * log-rate-limit caps how many records a second any one INFO or lower
+ * message may log (0, the default, for no cap); the "completed auth check"
+ * records are exempt.  log-sample-rate N logs only 1 in N of those.
+ *
+ * If log-binary-file is set, records are written there in binary (which
+ * blog2json converts back to JSON) instead of to stdout.  It is rotated to
+ * .0, .1, ... every log-binary-max-size MB (0 to never), keeping
+ * log-binary-keep old files.
+ *
+ * Door calls taking slow-request-ms or longer are logged with a breakdown
+ * of where the time went (0 turns that off).
+ *
+ * lock-profiling "yes" has g_cache_lock and g_zdoor_lock keep histograms of
+ * how long each acquisition waited and held the lock, and which callers
+ * held it longest, which then come out with the stats.
+ */
+static void
+build_logging_from_config(const char *file)
+{
+	char *ring_records = NULL;
+	char *overflow = NULL;
+	char *rate_limit = NULL;
+	char *sample_rate = NULL;
+	char *binary_file = NULL;
+	char *binary_max_size = NULL;
+	char *binary_keep = NULL;
+	char *slow_request = NULL;
+	char *lock_profiling = NULL;
+	unsigned int records = DEFAULT_LOG_RING_RECORDS;
+	boolean_t block = B_FALSE;
+	unsigned int per_sec = DEFAULT_LOG_RATE_LIMIT;
+	unsigned int sample = 1;
+	unsigned int max_mb = DEFAULT_LOG_BINARY_MAX_SIZE;
+	unsigned int keep = DEFAULT_LOG_BINARY_KEEP;
+
+	ring_records = read_cfg_key(file, CFG_LOG_RING_RECORDS);
+	if (ring_records != NULL)
+		records = atoi(ring_records);
+
+	overflow = read_cfg_key(file, CFG_LOG_OVERFLOW);
+	if (overflow != NULL)
+		block = strcmp("block", overflow) == 0;
+
+	rate_limit = read_cfg_key(file, CFG_LOG_RATE_LIMIT);
+	if (rate_limit != NULL)
+		per_sec = atoi(rate_limit);
+
+	sample_rate = read_cfg_key(file, CFG_LOG_SAMPLE_RATE);
+	if (sample_rate != NULL)
+		sample = atoi(sample_rate);
+
+	bunyan_limits(per_sec, sample);
+
+	slow_request = read_cfg_key(file, CFG_SLOW_REQUEST_MS);
+	if (slow_request != NULL)
+		g_slow_request_ms = atoi(slow_request);
+
+	lock_profiling = read_cfg_key(file, CFG_LOCK_PROFILING);
+	if (lock_profiling != NULL && strcmp("yes", lock_profiling) == 0)
+		lockprof_enable();
+
+	binary_max_size = read_cfg_key(file, CFG_LOG_BINARY_MAX_SIZE);
+	if (binary_max_size != NULL && atoi(binary_max_size) >= 0)
+		max_mb = atoi(binary_max_size);
+
+	binary_keep = read_cfg_key(file, CFG_LOG_BINARY_KEEP);
+	if (binary_keep != NULL) {
+		if (atoi(binary_keep) >= 0 &&
+		    atoi(binary_keep) <= MAX_LOG_BINARY_KEEP) {
+			keep = atoi(binary_keep);
+		} else {
+			bunyan_warn("log-binary-keep out of range, using "
+			    "the default",
+			    BUNYAN_INT32, "max", MAX_LOG_BINARY_KEEP,
+			    BUNYAN_INT32, "default", keep,
+			    BUNYAN_NONE);
+		}
+	}
+
+	binary_file = read_cfg_key(file, CFG_LOG_BINARY_FILE);
+	if (binary_file != NULL && bunyan_binary_start(binary_file,
+	    (uint64_t)max_mb * 1024 * 1024, keep) != 0) {
+		bunyan_error("unable to open binary log, logging to stdout",
+		    BUNYAN_STRING, "file", binary_file,
+		    BUNYAN_INT32, "errno", errno,
+		    BUNYAN_NONE);
+	}
 
-	(void) snprintf(buf, len, "%s|%s|%s", uuid, user, fp);
-	return (buf);
+	if (records != 0 && bunyan_async_start(records, block) != 0) {
+		bunyan_error("unable to start log writer, logging "
+		    "synchronously",
+		    BUNYAN_INT32, "records", records,
+		    BUNYAN_NONE);
+	}
+
+	xfree(ring_records);
+	xfree(overflow);
+	xfree(rate_limit);
+	xfree(sample_rate);
+	xfree(binary_file);
+	xfree(binary_max_size);
+	xfree(binary_keep);
+	xfree(slow_request);
+	xfree(lock_profiling);
 }
 
+
 static void
 build_lru_cache_from_config(const char *file)
 {
 
 	char *cache_size = NULL;
+	char *cache_owner_pct = NULL;
+	size_t owner_max;
 	char *cache_age = NULL;
 	char *recheck_denies = NULL;
+	char *serve_stale = NULL;
 
 	cache_size = read_cfg_key(file, CFG_CAPI_CACHE_SIZE);
 	if (cache_size != NULL) {
 		g_lru_cache = lru_cache_create(atoi(cache_size));
 	}
 
+	/*
+	 * Keep any one customer from taking over the cache (and evicting
+	 * everyone else's entries) on a multi-tenant CN.
+	 */
+	cache_owner_pct = read_cfg_key(file, CFG_CAPI_CACHE_OWNER_PCT);
+	if (cache_owner_pct != NULL && g_lru_cache != NULL &&
+	    atoi(cache_owner_pct) > 0 && atoi(cache_owner_pct) < 100) {
+		owner_max = g_lru_cache->size * atoi(cache_owner_pct) / 100;
+		if (!lru_set_owner_quota(g_lru_cache,
+		    owner_max > 0 ? owner_max : 1)) {
+			bunyan_error("unable to set cache owner quota",
+			    BUNYAN_NONE);
+		}
+	}
+	if (g_lru_cache != NULL)
+		stats_register_reporter(cache_report, NULL);
+
 	cache_age = read_cfg_key(file, CFG_CAPI_CACHE_AGE);
 	if (cache_age != NULL) {
 		g_cache_age = atoi(cache_age);
@@ -97,24 +464,117 @@ build_lru_cache_from_config(const char *file)
 		g_recheck_denies = strcmp("yes", recheck_denies) == 0;
 	}
 
+	serve_stale = read_cfg_key(file, CFG_CAPI_SERVE_STALE);
+	if (serve_stale != NULL) {
+		g_serve_stale = strcmp("yes", serve_stale) == 0;
+	}
+
 	xfree(cache_size);
+	xfree(cache_owner_pct);
 	xfree(cache_age);
 	xfree(recheck_denies);
+	xfree(serve_stale);
+}
+
+
+/*
+ * Parses a config value that must be a whole number from 0 to max.
+ * Unlike atoi(), junk is an error instead of 0.
+ */
+static boolean_t
+parse_bounded(const char *str, long max, unsigned int *val)
+{
+	char *end = NULL;
+	long l;
+
+	errno = 0;
+	l = strtol(str, &end, 10);
+	while (end != NULL && isspace((unsigned char)*end))
+		end++;
+	if (errno != 0 || end == str || *end != '\0' || l < 0 || l > max)
+		return (B_FALSE);
+
+	*val = (unsigned int)l;
+	return (B_TRUE);
+}
+
+
+/*
+ * Reads `key` into *val, if it's set.  It must be a number from 0 to max;
+ * anything else is logged, and *val (the default) left as it is.
+ */
+static void
+read_cfg_bounded(const char *file, const char *key, long max,
+    unsigned int *val)
+{
+	char *str = NULL;
+
+	str = read_cfg_key(file, key);
+	if (str != NULL && !parse_bounded(str, max, val)) {
+		bunyan_warn("invalid config value, using the default",
+		    BUNYAN_STRING, "param", key,
+		    BUNYAN_STRING, "value", str,
+		    BUNYAN_INT32, "max", (int)max,
+		    BUNYAN_INT32, "default", *val,
+		    BUNYAN_NONE);
+	}
+
+	xfree(str);
+}
+
+
+/*
+ * shed-capi-waiters and shed-queue-ms are the thresholds shedding_load()
+ * goes into overload at; 0 turns either off.  A value that isn't a number
+ * in range is logged and the default kept, rather than quietly turning
+ * shedding off (or making it impossible to trigger).
+ */
+static void
+build_shed_from_config(const char *file)
+{
+	char *shed_waiters = NULL;
+	char *shed_queue_ms = NULL;
+
+	shed_waiters = read_cfg_key(file, CFG_SHED_WAITERS);
+	if (shed_waiters != NULL) {
+		if (!parse_bounded(shed_waiters, MAX_SHED_WAITERS,
+		    &g_shed_waiters)) {
+			bunyan_warn("invalid shed-capi-waiters, using the "
+			    "default",
+			    BUNYAN_INT32, "max", MAX_SHED_WAITERS,
+			    BUNYAN_INT32, "default", g_shed_waiters,
+			    BUNYAN_NONE);
+		}
+	}
+
+	shed_queue_ms = read_cfg_key(file, CFG_SHED_QUEUE_MS);
+	if (shed_queue_ms != NULL) {
+		if (!parse_bounded(shed_queue_ms, MAX_SHED_QUEUE_MS,
+		    &g_shed_queue_ms)) {
+			bunyan_warn("invalid shed-queue-ms, using the "
+			    "default",
+			    BUNYAN_INT32, "max", MAX_SHED_QUEUE_MS,
+			    BUNYAN_INT32, "default", g_shed_queue_ms,
+			    BUNYAN_NONE);
+		}
+	}
+
+	xfree(shed_waiters);
+	xfree(shed_queue_ms);
 }
 
 
+/*
+ * Every knob but the URL is optional, and bounded (see the MAX_CAPI_*
+ * limits); a bad value is logged and the default kept.
+ */
 static void
 build_capi_handle_from_config(const char *file)
 {
-	/* required fields */
+	capi_handle_t *h = NULL;
+	unsigned int limit_min, limit_max;
 	char *url = NULL;
 
-	/* optional fields */
-	char *connect_timeout = NULL;
-	char *retries = NULL;
-	char *retry_sleep = NULL;
-	char *timeout = NULL;
-
 	url = read_cfg_key(file, CFG_CAPI_URL);
 	if (url == NULL) {
 		bunyan_error("missing required config param",
@@ -128,80 +588,445 @@ build_capi_handle_from_config(const char *file)
 		bunyan_error("unable to create CAPI handle", BUNYAN_NONE);
 		goto out;
 	}
+	h = g_capi_handle;
 
-	connect_timeout = read_cfg_key(file, CFG_CAPI_CONNECT_TIMEOUT);
-	if (connect_timeout != NULL)
-		g_capi_handle->connect_timeout = atoi(connect_timeout);
+	read_cfg_bounded(file, CFG_CAPI_CONNECT_TIMEOUT, MAX_CAPI_SECONDS,
+	    &h->connect_timeout);
+	read_cfg_bounded(file, CFG_CAPI_RETRIES, MAX_CAPI_COUNT, &h->retries);
+	read_cfg_bounded(file, CFG_CAPI_RETRY_SLEEP, MAX_CAPI_SECONDS,
+	    &h->retry_sleep);
+	read_cfg_bounded(file, CFG_CAPI_RETRY_BACKOFF, MAX_CAPI_MS,
+	    &h->retry_backoff_ms);
+	read_cfg_bounded(file, CFG_CAPI_RETRY_BUDGET, MAX_CAPI_PCT,
+	    &h->retry_budget.pct);
+	read_cfg_bounded(file, CFG_CAPI_LOGIN_DEADLINE, MAX_CAPI_MS,
+	    &g_login_deadline_ms);
+	read_cfg_bounded(file, CFG_CAPI_WORKERS, MAX_CAPI_WORKERS,
+	    &g_capi_workers);
+	read_cfg_bounded(file, CFG_CAPI_QUEUE_MAX, MAX_CAPI_QUEUE,
+	    &g_capi_queue_max);
 
-	retries = read_cfg_key(file, CFG_CAPI_RETRIES);
-	if (retries != NULL)
-		g_capi_handle->retries = atoi(retries);
+	read_cfg_bounded(file, CFG_CAPI_BREAKER_FAILURES, MAX_CAPI_COUNT,
+	    &h->breaker.max_failures);
+	read_cfg_bounded(file, CFG_CAPI_BREAKER_ERROR_PCT, MAX_CAPI_PCT,
+	    &h->breaker.error_pct);
+	read_cfg_bounded(file, CFG_CAPI_BREAKER_OPEN, MAX_CAPI_MS,
+	    &h->breaker.open_ms);
+	read_cfg_bounded(file, CFG_CAPI_PROBE_INTERVAL, MAX_CAPI_MS,
+	    &h->endpoints->probe_ms);
+	read_cfg_bounded(file, CFG_CAPI_EJECT_FAILURES, MAX_CAPI_COUNT,
+	    &h->endpoints->eject_failures);
+	read_cfg_bounded(file, CFG_CAPI_EJECT_TIME, MAX_CAPI_MS,
+	    &h->endpoints->eject_ms);
 
-	retry_sleep = read_cfg_key(file, CFG_CAPI_RETRY_SLEEP);
-	if (retry_sleep != NULL)
-		g_capi_handle->retry_sleep = atoi(retry_sleep);
+	read_cfg_bounded(file, CFG_CAPI_HEDGE_PERCENTILE, MAX_CAPI_PCT,
+	    &h->hedge_pct);
+	read_cfg_bounded(file, CFG_CAPI_HEDGE_BUDGET, MAX_CAPI_PCT,
+	    &h->hedge_budget.pct);
+	read_cfg_bounded(file, CFG_CAPI_BATCH_WINDOW, MAX_CAPI_MS,
+	    &h->batch_window_ms);
+	read_cfg_bounded(file, CFG_CAPI_BATCH_MAX, MAX_CAPI_BATCH,
+	    &h->batch_max);
+	read_cfg_bounded(file, CFG_CAPI_DNS_TTL, MAX_CAPI_DNS_TTL, &h->dns_ttl);
 
-	timeout = read_cfg_key(file, CFG_CAPI_TIMEOUT);
-	if (timeout != NULL)
-		g_capi_handle->timeout = atoi(timeout);
+	/*
+	 * The limiter needs 1 <= min <= max (unless max is 0, for no limit);
+	 * if the two don't fit together, neither can be trusted.
+	 */
+	limit_min = h->limit_min;
+	limit_max = h->limit_max;
+	read_cfg_bounded(file, CFG_CAPI_LIMIT_MIN, MAX_CAPI_CONCURRENCY,
+	    &h->limit_min);
+	read_cfg_bounded(file, CFG_CAPI_LIMIT_MAX, MAX_CAPI_CONCURRENCY,
+	    &h->limit_max);
+	if (h->limit_max != 0 &&
+	    (h->limit_min == 0 || h->limit_min > h->limit_max)) {
+		bunyan_warn("invalid " CFG_CAPI_LIMIT_MIN " and "
+		    CFG_CAPI_LIMIT_MAX ", using the defaults",
+		    BUNYAN_INT32, "min", h->limit_min,
+		    BUNYAN_INT32, "max", h->limit_max,
+		    BUNYAN_NONE);
+		h->limit_min = limit_min;
+		h->limit_max = limit_max;
+	}
+	read_cfg_bounded(file, CFG_CAPI_LIMIT_QUEUE_MAX, MAX_CAPI_QUEUE,
+	    &h->limit_queue_max);
+
+	read_cfg_bounded(file, CFG_CAPI_TIMEOUT, MAX_CAPI_SECONDS, &h->timeout);
+	read_cfg_bounded(file, CFG_CAPI_TIMEOUT_FLOOR, MAX_CAPI_MS,
+	    &h->timeout_floor_ms);
+	read_cfg_bounded(file, CFG_CAPI_TIMEOUT_CEILING, MAX_CAPI_MS,
+	    &h->timeout_ceiling_ms);
+	read_cfg_bounded(file, CFG_CAPI_TIMEOUT_MULTIPLIER,
+	    MAX_CAPI_MULTIPLIER_PCT, &h->timeout_multiplier_pct);
 
 out:
 	xfree(url);
-	xfree(connect_timeout);
-	xfree(retries);
-	xfree(retry_sleep);
-	xfree(timeout);
 }
 
 
+static void
+build_rate_limits_from_config(const char *file)
+{
+	char *zone_rate = NULL;
+	char *zone_burst = NULL;
+	char *owner_rate = NULL;
+	char *owner_burst = NULL;
+
+	zone_rate = read_cfg_key(file, CFG_LOGIN_RATE_ZONE);
+	zone_burst = read_cfg_key(file, CFG_LOGIN_BURST_ZONE);
+	if (zone_rate != NULL && atoi(zone_rate) > 0) {
+		g_zone_limit = ratelimit_create("login_rate_limited_zone",
+		    atoi(zone_rate),
+		    zone_burst != NULL ? atoi(zone_burst) : 0,
+		    RATELIMIT_MAX_KEYS);
+	}
+
+	owner_rate = read_cfg_key(file, CFG_LOGIN_RATE_OWNER);
+	owner_burst = read_cfg_key(file, CFG_LOGIN_BURST_OWNER);
+	if (owner_rate != NULL && atoi(owner_rate) > 0) {
+		g_owner_limit = ratelimit_create("login_rate_limited_owner",
+		    atoi(owner_rate),
+		    owner_burst != NULL ? atoi(owner_burst) : 0,
+		    RATELIMIT_MAX_KEYS);
+	}
+
+	xfree(zone_rate);
+	xfree(zone_burst);
+	xfree(owner_rate);
+	xfree(owner_burst);
+}
+
+
+/*
+ * capi-allowed-users is a comma-separated list of "user" or "user:ttl",
+ * where ttl (seconds) overrides capi-cache-age for that user's entries.
+ */
+static void
+build_allowed_users_from_config(const char *file)
+{
+	char *users = NULL;
+	char *ptr = NULL;
+	char *rest = NULL;
+	char *token = NULL;
+	char *ttl = NULL;
+	const char **names = NULL;
+	unsigned int *ttls = NULL;
+	unsigned int count = 1;
+	unsigned int n = 0;
+
+	users = read_cfg_key(file, CFG_CAPI_ALLOWED_USERS);
+	if (users == NULL)
+		users = xstrdup(DEFAULT_ALLOWED_USERS);
+	if (users == NULL)
+		return;
+
+	for (ptr = users; *ptr != '\0'; ptr++) {
+		if (*ptr == ',')
+			count++;
+	}
+	names = xcalloc(count, sizeof (char *));
+	ttls = xcalloc(count, sizeof (unsigned int));
+	if (names == NULL || ttls == NULL)
+		goto out;
+
+	ptr = users;
+	while ((token = strtok_r(ptr, ", ", &rest)) != NULL) {
+		ptr = rest;
+		ttl = strchr(token, ':');
+		if (ttl != NULL)
+			*ttl++ = '\0';
+		if (*token == '\0')
+			continue;
+		if (strlen(token) >= USER_MAX) {
+			bunyan_warn("allowed user name too long, ignoring",
+			    BUNYAN_STRING, "user", token,
+			    BUNYAN_INT32, "max", USER_MAX - 1,
+			    BUNYAN_NONE);
+			continue;
+		}
+		names[n] = token;
+		ttls[n] = (ttl != NULL && atoi(ttl) > 0) ? atoi(ttl) : 0;
+		n++;
+	}
+
+	g_allowed_users = phash_create(names, ttls, n);
+	if (g_allowed_users == NULL || n == 0) {
+		bunyan_warn("no users may log in with CAPI keys",
+		    BUNYAN_STRING, "config", CFG_CAPI_ALLOWED_USERS,
+		    BUNYAN_NONE);
+	}
+
+out:
+	xfree(names);
+	xfree(ttls);
+	xfree(users);
+}
+
+
+/*
+ * Decides whether we're too backed up to send anything more to CAPI.
+ *
+ * We go into overload when too many door calls are waiting on CAPI, or
+ * callers have been queueing too long for a CAPI slot, and only come out
+ * once both have fallen to half their thresholds, so we don't flap.
+ */
 static boolean_t
-user_allowed_in_capi(const char *uuid, const char *user, const char *fp)
+shedding_load(void)
 {
-	boolean_t allowed = B_FALSE;
-	cache_entry_t *cache_entry = NULL;
-	cache_entry_t *existing = NULL;
-	char *cache_key = NULL;
+	uint64_t waiters = stats_get(g_stat_capi_waiters);
+	int queue_ms = HR_MSEC(limiter_queue_time(g_capi_handle->limiter));
+	boolean_t high, low;
 
-	if (uuid == NULL || user == NULL || fp == NULL) {
-		bunyan_debug("user_allowed_in_capi: NULL arguments",
+	high = (g_shed_waiters != 0 && waiters >= g_shed_waiters) ||
+	    (g_shed_queue_ms != 0 && queue_ms >= g_shed_queue_ms);
+	low = (g_shed_waiters == 0 || waiters <= g_shed_waiters / 2) &&
+	    (g_shed_queue_ms == 0 || queue_ms <= g_shed_queue_ms / 2);
+
+	if (high && atomic_cas_32(&g_overloaded, 0, 1) == 0) {
+		bunyan_warn("overloaded, answering from cache only",
+		    BUNYAN_INT32, "capi_waiters", (int)waiters,
+		    BUNYAN_INT32, "queue_ms", queue_ms,
+		    BUNYAN_NONE);
+		stats_incr(g_stat_overloads);
+	} else if (low && atomic_cas_32(&g_overloaded, 1, 0) == 1) {
+		bunyan_info("no longer overloaded",
+		    BUNYAN_INT32, "capi_waiters", (int)waiters,
+		    BUNYAN_INT32, "queue_ms", queue_ms,
 		    BUNYAN_NONE);
 	}
 
-	cache_key = build_cache_key(uuid, user, fp);
+	return (g_overloaded != 0);
+}
+
+
+static void
+capi_job_run(void *arg)
+{
+	capi_job_t *cj = arg;
+	hrtime_t start = gethrtime();
+	/* Workers log (and call CAPI) under the id of the call they serve */
+	boolean_t adopt = (bunyan_req_id() == NULL);
+
+	if (adopt)
+		bunyan_req_id_set(cj->req_id);
+	if (cj->span != NULL)
+		cj->span->queue = start - cj->queued;
+	cj->result = capi_is_allowed(g_capi_handle, cj->uuid, cj->fp,
+	    cj->user, cj->deadline, cj->span);
+	if (cj->span != NULL)
+		cj->span->capi = gethrtime() - start;
+	if (adopt)
+		bunyan_req_id_set(NULL);
+}
 
-	(void) pthread_mutex_lock(&g_cache_lock);
+
+/*
+ * Lookups with no cached answer to fall back on go ahead of rechecks that
+ * have one.
+ */
+static void
+capi_job_init(capi_job_t *cj, const char *uuid, const char *user,
+    const char *fp, hrtime_t deadline, boolean_t have_stale, span_t *span)
+{
+	(void) memset(cj, 0, sizeof (capi_job_t));
+	cj->job.fn = capi_job_run;
+	cj->job.arg = cj;
+	cj->job.priority = (have_stale ? WORKQ_PRI_LOW : WORKQ_PRI_HIGH);
+	cj->job.deadline = deadline;
+	cj->uuid = uuid;
+	cj->user = user;
+	cj->fp = fp;
+	cj->deadline = deadline;
+	cj->queued = gethrtime();
+	cj->span = span;
+	cj->req_id = bunyan_req_id();
+	cj->result = CAPI_UNAVAILABLE;
+}
+
+
+static capi_result_t
+capi_job_result(capi_job_t *cj, workq_status_t status)
+{
+	/* A job that never ran spent all its time queued */
+	if (status != WORKQ_DONE && cj->span != NULL)
+		cj->span->queue = gethrtime() - cj->queued;
+
+	switch (status) {
+	case WORKQ_DONE:
+		break;
+	case WORKQ_FULL:
+		bunyan_info("CAPI work queue full",
+		    BUNYAN_STRING, "owner", cj->uuid,
+		    BUNYAN_NONE);
+		break;
+	case WORKQ_EXPIRED:
+		bunyan_info("deadline passed waiting for a CAPI worker",
+		    BUNYAN_STRING, "owner", cj->uuid,
+		    BUNYAN_NONE);
+		break;
+	}
+
+	return (cj->result);
+}
+
+
+/*
+ * Asks CAPI from one of the worker threads, so however many door threads
+ * libzdoor has going, at most capi-workers of them are blocked in HTTP.
+ */
+static capi_result_t
+ask_capi(const char *uuid, const char *user, const char *fp,
+    hrtime_t deadline, boolean_t have_stale, span_t *span)
+{
+	capi_job_t cj;
+
+	capi_job_init(&cj, uuid, user, fp, deadline, have_stale, span);
+	if (g_workq == NULL) {
+		capi_job_run(&cj);
+		return (cj.result);
+	}
+
+	return (capi_job_result(&cj, workq_run(g_workq, &cj.job)));
+}
+
+
+/*
+ * Takes g_cache_lock for `site`, adding the time spent waiting for it to
+ * the span.
+ * Returns when we started waiting, for cache_unlock().
+ */
+static hrtime_t
+cache_lock(span_t *span, const char *site)
+{
+	hrtime_t start = gethrtime();
+	hrtime_t wait;
+
+	SMARTLOGIN_LOCK_WAIT_START("g_cache_lock");
+	lockprof_lock(&g_cache_lock, site);
+	wait = gethrtime() - start;
+	SMARTLOGIN_LOCK_WAIT_DONE("g_cache_lock", wait);
+	span->lock_wait += wait;
+
+	return (start);
+}
+
+
+/* Drops g_cache_lock, adding the time we held it to the span */
+static void
+cache_unlock(span_t *span, hrtime_t start)
+{
+	lockprof_unlock(&g_cache_lock);
+	span->cache += gethrtime() - start;
+}
+
+
+/*
+ * Checks the cache.  Returns B_TRUE if *allowed is an answer we can use
+ * as is; otherwise CAPI needs asking, and *have_stale says whether
+ * *allowed holds an old answer to fall back on.
+ */
+static boolean_t
+cache_lookup(const char *cache_key, unsigned int ttl, boolean_t *allowed,
+    boolean_t *have_stale, span_t *span)
+{
+	boolean_t fresh = B_FALSE;
+	cache_entry_t *cache_entry = NULL;
+	hrtime_t locked;
+
+	*allowed = B_FALSE;
+	*have_stale = B_FALSE;
+
+	locked = cache_lock(span, "cache_lookup");
 	cache_entry = (cache_entry_t *)lru_get(g_lru_cache, cache_key);
 	if (cache_entry != NULL) {
 		int age;
 		bunyan_debug("cache hit",
 		    BUNYAN_STRING, "cache_key", cache_key,
 		    BUNYAN_NONE);
-		allowed = cache_entry->allowed;
+		*allowed = cache_entry->allowed;
 		age = HR_SEC(gethrtime() - cache_entry->ctime);
-		if (age >= g_cache_age) {
+		if (age >= ttl) {
 			bunyan_debug("cache entry expired, checking CAPI",
 			    BUNYAN_INT32, "cache_age", age,
 			    BUNYAN_NONE);
-		} else if (!allowed && g_recheck_denies) {
+		} else if (!*allowed && g_recheck_denies) {
 			bunyan_debug("cache deny, config says to check "
 			    "CAPI again", BUNYAN_NONE);
 		} else {
-			goto out;
+			fresh = B_TRUE;
 		}
+		*have_stale = !fresh;
 	}
-	cache_entry = NULL;
-	(void) pthread_mutex_unlock(&g_cache_lock);
+	cache_unlock(span, locked);
+
+	return (fresh);
+}
+
+
+/*
+ * What to answer instead of asking CAPI while we're shedding load: stand
+ * on a stale answer if policy lets us, and deny anything else.
+ */
+static boolean_t
+shed_answer(const char *cache_key, boolean_t allowed, boolean_t have_stale)
+{
+	if (have_stale && g_serve_stale)
+		stats_incr(g_stat_stale_served);
+	else
+		allowed = B_FALSE;
+	bunyan_debug("overloaded, not asking CAPI",
+	    BUNYAN_BOOLEAN, "allowed", allowed,
+	    BUNYAN_STRING, "cache_key", cache_key,
+	    BUNYAN_NONE);
+	stats_incr(g_stat_shed);
+
+	return (allowed);
+}
 
-	allowed = capi_is_allowed(g_capi_handle, uuid, fp, user);
 
-	(void) pthread_mutex_lock(&g_cache_lock);
+/*
+ * Turns what CAPI said into an answer, caching it if CAPI actually
+ * answered.  allowed/have_stale are as left by cache_lookup().
+ */
+static boolean_t
+capi_settle(const char *uuid, const char *cache_key, capi_result_t result,
+    boolean_t allowed, boolean_t have_stale, span_t *span)
+{
+	cache_entry_t *cache_entry = NULL;
+	cache_entry_t *existing = NULL;
+	hrtime_t locked;
+
+	if (result == CAPI_UNAVAILABLE) {
+		/*
+		 * Don't cache anything we didn't actually hear from CAPI.  If
+		 * we had an old answer and policy allows, stand on it.
+		 */
+		if (have_stale && g_serve_stale) {
+			bunyan_info("CAPI unavailable, using stale cache entry",
+			    BUNYAN_BOOLEAN, "allowed", allowed,
+			    BUNYAN_STRING, "cache_key", cache_key,
+			    BUNYAN_NONE);
+			stats_incr(g_stat_stale_served);
+		} else {
+			allowed = B_FALSE;
+		}
+		return (allowed);
+	}
+	allowed = (result == CAPI_ALLOWED);
+
+	locked = cache_lock(span, "capi_settle");
 	cache_entry = (cache_entry_t *)lru_get(g_lru_cache, cache_key);
 	if (cache_entry == NULL) {
 		cache_entry = (cache_entry_t *)xmalloc(sizeof (cache_entry_t));
 		if (cache_entry == NULL)
 			goto out;
 
-		existing = lru_add(g_lru_cache, cache_key, cache_entry);
+		existing = lru_add_owned(g_lru_cache, uuid, cache_key,
+		    cache_entry);
+		/* With caching off, we get our own entry straight back */
+		if (existing == cache_entry)
+			cache_entry = NULL;
 		xfree(existing);
 	}
 
@@ -211,58 +1036,258 @@ user_allowed_in_capi(const char *uuid, const char *user, const char *fp)
 	}
 
 out:
-	(void) pthread_mutex_unlock(&g_cache_lock);
-	xfree(cache_key);
+	cache_unlock(span, locked);
 	return (allowed);
 }
 
 
+static boolean_t
+user_allowed_in_capi(const char *uuid, const char *user, const char *fp,
+    unsigned int ttl, hrtime_t deadline, span_t *span)
+{
+	boolean_t allowed = B_FALSE;
+	boolean_t have_stale = B_FALSE;
+	capi_result_t result;
+	char cache_key[CACHE_KEY_MAX];
+
+	if (uuid == NULL || user == NULL || fp == NULL) {
+		bunyan_debug("user_allowed_in_capi: NULL arguments",
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	if (!build_cache_key(cache_key, sizeof (cache_key), uuid, user, fp))
+		return (B_FALSE);
+
+	if (cache_lookup(cache_key, ttl, &allowed, &have_stale, span))
+		return (allowed);
+
+	/* Don't add to the pile waiting on CAPI while it's already too high */
+	if (shedding_load())
+		return (shed_answer(cache_key, allowed, have_stale));
+
+	stats_incr(g_stat_capi_waiters);
+	result = ask_capi(uuid, user, fp, deadline, have_stale, span);
+	stats_add(g_stat_capi_waiters, -1);
+
+	return (capi_settle(uuid, cache_key, result, allowed, have_stale,
+	    span));
+}
+
+
+/*
+ * user_allowed_in_capi() for several fingerprints at once.  Everything the
+ * cache can't answer goes to the worker pool together, so the CAPI round
+ * trips overlap (and batch, if batching is on) instead of queueing up
+ * behind each other.
+ *
+ * The lookups run in parallel, so they can't all write to the one span;
+ * it gets the cache timings and how long the CAPI lookups took as a whole.
+ */
+static void
+users_allowed_in_capi(const char *uuid, const char *user,
+    char fps[][FP_MAX], unsigned int nfps, unsigned int ttl,
+    hrtime_t deadline, boolean_t *allowed, span_t *span)
+{
+	unsigned int i;
+	char cache_keys[KEYS_MAX][CACHE_KEY_MAX];
+	boolean_t have_stale[KEYS_MAX] = { B_FALSE };
+	boolean_t asking[KEYS_MAX] = { B_FALSE };
+	boolean_t queued[KEYS_MAX] = { B_FALSE };
+	capi_job_t jobs[KEYS_MAX];
+	capi_result_t result;
+	hrtime_t capi_start = 0;
+
+	for (i = 0; i < nfps; i++) {
+		if (!build_cache_key(cache_keys[i], CACHE_KEY_MAX, uuid, user,
+		    fps[i]))
+			continue;
+		if (cache_lookup(cache_keys[i], ttl, &allowed[i],
+		    &have_stale[i], span))
+			continue;
+		if (shedding_load()) {
+			allowed[i] = shed_answer(cache_keys[i], allowed[i],
+			    have_stale[i]);
+			continue;
+		}
+
+		asking[i] = B_TRUE;
+		if (capi_start == 0)
+			capi_start = gethrtime();
+		capi_job_init(&jobs[i], uuid, user, fps[i], deadline,
+		    have_stale[i], NULL);
+		if (g_workq != NULL) {
+			queued[i] = workq_submit(g_workq, &jobs[i].job);
+			if (queued[i])
+				stats_incr(g_stat_capi_waiters);
+		}
+	}
+
+	for (i = 0; i < nfps; i++) {
+		if (!asking[i])
+			continue;
+
+		if (queued[i]) {
+			result = capi_job_result(&jobs[i],
+			    workq_wait(g_workq, &jobs[i].job));
+			stats_add(g_stat_capi_waiters, -1);
+		} else if (g_workq != NULL) {
+			/*
+			 * Like ask_capi(): a full queue means CAPI is
+			 * unavailable to us, and capi_settle() falls back on
+			 * the stale answer (or denies), instead of this door
+			 * thread going to CAPI outside the worker bound.
+			 */
+			result = capi_job_result(&jobs[i], WORKQ_FULL);
+		} else {
+			stats_incr(g_stat_capi_waiters);
+			capi_job_run(&jobs[i]);
+			result = jobs[i].result;
+			stats_add(g_stat_capi_waiters, -1);
+		}
+		allowed[i] = capi_settle(uuid, cache_keys[i], result,
+		    allowed[i], have_stale[i], span);
+	}
+
+	if (capi_start != 0)
+		span->capi = gethrtime() - capi_start;
+}
+
+
+/*
+ * Logs where the time went in a door call that took slow-request-ms or
+ * longer.  It's an INFO record, so a CAPI outage (when every call is slow)
+ * gets rate limited like anything else.
+ */
+static void
+log_slow_request(const span_t *span, hrtime_t end, const char *zone,
+    const char *owner, const char *user, unsigned int keys)
+{
+	char attempts[SPAN_ATTEMPTS_LEN];
+
+	if (g_slow_request_ms == 0 ||
+	    HR_MSEC(end - span->start) < g_slow_request_ms)
+		return;
+
+	bunyan_info("slow auth check",
+	    BUNYAN_STRING, "zone", zone,
+	    BUNYAN_STRING, "owner", owner,
+	    BUNYAN_STRING, "user", user,
+	    BUNYAN_INT32, "keys", keys,
+	    BUNYAN_INT32, "timing_us", HR_USEC(end - span->start),
+	    BUNYAN_INT32, "parse_us", HR_USEC(span->parse),
+	    BUNYAN_INT32, "lock_wait_us", HR_USEC(span->lock_wait),
+	    BUNYAN_INT32, "cache_us", HR_USEC(span->cache),
+	    BUNYAN_INT32, "queue_us", HR_USEC(span->queue),
+	    BUNYAN_INT32, "limit_wait_us", HR_USEC(span->limit_wait),
+	    BUNYAN_INT32, "capi_us", HR_USEC(span->capi),
+	    BUNYAN_BOOLEAN, "batched", span->batched,
+	    BUNYAN_INT32, "capi_attempts", span->nattempts,
+	    BUNYAN_STRING, "attempts",
+	    span_format_attempts(span, attempts, sizeof (attempts)),
+	    BUNYAN_NONE);
+}
+
+
+/*
+ * Parses a door request, "user uid fp1 ... fpN" with 1 <= N <= maxfps,
+ * into name and fps.  The uid field is unused.
+ * Returns the length of the user name, or -1 if the request is malformed.
+ */
+static int
+parse_request(const char *argp, size_t argp_sz, char *name, size_t name_sz,
+    char fps[][FP_MAX], unsigned int maxfps, unsigned int *nfps)
+{
+	const char *ptr = argp;
+	const char *argp_end = argp + argp_sz;
+	int name_len;
+	int len = 0;
+
+	*nfps = 0;
+	name_len = next_token(&ptr, argp_end, name, name_sz);
+	(void) next_token(&ptr, argp_end, NULL, 0);
+	while (*nfps < maxfps &&
+	    (len = next_token(&ptr, argp_end, fps[*nfps], FP_MAX)) > 0)
+		(*nfps)++;
+	if (name_len <= 0 || *nfps == 0 || len < 0 ||
+	    next_token(&ptr, argp_end, NULL, 0) != 0)
+		return (-1);
+
+	return (name_len);
+}
+
+
+/*
+ * Decides whether a login may go to the cache and CAPI at all.  Users CAPI
+ * keys can't log in as are turned away first, without taking a lock.  Then
+ * a zone (or owner) hammering us gets denied, before it can churn the
+ * cache or take CAPI capacity from its neighbours.  One door call is one
+ * login attempt, however many keys it carries.
+ */
+static boolean_t
+login_permitted(const char *zone, const char *uuid, const char *name,
+    int name_len, unsigned int *ttl)
+{
+	if (!is_capi_user(name, name_len, ttl))
+		return (B_FALSE);
+
+	if (!ratelimit_allow(g_zone_limit, zone) ||
+	    !ratelimit_allow(g_owner_limit, uuid)) {
+		bunyan_debug("login rate limited",
+		    BUNYAN_STRING, "zone", zone,
+		    BUNYAN_STRING, "owner", uuid,
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+
+/*
+ * KEY_SVC_NAME: the request is "user uid fp" and the answer is "1" or "0".
+ */
 static zdoor_result_t *
 _key_is_authorized(zdoor_cookie_t *cookie, char *argp, size_t argp_sz)
 {
 	zdoor_result_t *result = NULL;
 	boolean_t allowed = B_FALSE;
-	int i = 0;
-	char *ptr = NULL;
-	char *rest = NULL;
-	char *token = NULL;
-	char *name = NULL;
-	char *fp = NULL;
+	unsigned int ttl = 0;
+	unsigned int nfps = 0;
+	int name_len;
+	char name[USER_MAX] = "";
+	char fps[1][FP_MAX] = { "" };
+	const char *fp = fps[0];
+	char answer[2];
 	const char *uuid = NULL;
-	hrtime_t start, end;
+	hrtime_t start, end, deadline = 0;
+	span_t span;
+	char req_id[BUNYAN_REQ_ID_LEN];
 
 	start = gethrtime();
+	span_init(&span, start);
+	if (g_login_deadline_ms != 0)
+		deadline = start + (hrtime_t)g_login_deadline_ms * 1000000LL;
 
 	if (cookie == NULL || argp == NULL || argp_sz == 0) {
 		bunyan_error("zdoor arguments NULL", BUNYAN_NONE);
 		return (NULL);
 	}
 
-	ptr = argp;
-	while ((token = strtok_r(ptr, " ", &rest)) != NULL) {
-		switch (i++) {
-		case 0:
-			name = xstrdup(token);
-			if (name == NULL)
-				goto out;
-			break;
-		case 1:
-			/* noop, this is the uid field */
-			break;
-		case 2:
-			fp = xstrdup(token);
-			if (fp == NULL)
-				goto out;
-			break;
-		default:
-			bunyan_error("processing",
-			    BUNYAN_STRING, "remainder", rest,
-			    BUNYAN_NONE);
-			goto out;
-			break;
-		}
-		ptr = rest;
+	new_request_id(req_id, sizeof (req_id));
+	bunyan_req_id_set(req_id);
+	SMARTLOGIN_DOOR_START(KEY_SVC_NAME, cookie->zdc_zonename, req_id);
+
+	name_len = parse_request(argp, argp_sz, name, sizeof (name), fps, 1,
+	    &nfps);
+	if (name_len < 0) {
+		bunyan_error("malformed request",
+		    BUNYAN_STRING, "zone", cookie->zdc_zonename,
+		    BUNYAN_INT32, "size", (int)argp_sz,
+		    BUNYAN_NONE);
+		goto out;
 	}
+	span.parse = gethrtime() - start;
 
 	uuid = (const char *)cookie->zdc_biscuit;
 	bunyan_debug("login attempt",
@@ -271,12 +1296,10 @@ _key_is_authorized(zdoor_cookie_t *cookie, char *argp, size_t argp_sz)
 	    BUNYAN_STRING, "user", name,
 	    BUNYAN_STRING, "ssh_fp", fp,
 	    BUNYAN_NONE);
-	if (strcasecmp(name, "root") == 0 ||
-	    strcasecmp(name, "admin") == 0 ||
-	    strcasecmp(name, "node") == 0) {
-		allowed = user_allowed_in_capi(uuid, name, fp);
-	} else {
-		allowed = B_FALSE;
+	if (login_permitted(cookie->zdc_zonename, uuid, name, name_len,
+	    &ttl)) {
+		allowed = user_allowed_in_capi(uuid, name, fp, ttl, deadline,
+		    &span);
 	}
 	bunyan_debug("login response",
 	    BUNYAN_BOOLEAN, "allowed", allowed,
@@ -286,21 +1309,12 @@ _key_is_authorized(zdoor_cookie_t *cookie, char *argp, size_t argp_sz)
 	    BUNYAN_STRING, "ssh_fp", fp,
 	    BUNYAN_NONE);
 
-	result = (zdoor_result_t *)xmalloc(sizeof (zdoor_result_t));
-	if (result == NULL)
-		goto out;
-
-	result->zdr_size = 2;
-	result->zdr_data = (char *)xmalloc(result->zdr_size);
-	if (result->zdr_data != NULL) {
-		(void) sprintf(result->zdr_data, "%d", allowed);
-	} else {
-		xfree(result);
-		result = NULL;
-	}
+	answer[0] = (allowed ? '1' : '0');
+	answer[1] = '\0';
+	result = door_result(answer, sizeof (answer));
 out:
 	end = gethrtime();
-	bunyan_info("completed auth check",
+	bunyan_info_sampled("completed auth check",
 	    BUNYAN_STRING, "allowed", (allowed ? "yes" : "no"),
 	    BUNYAN_STRING, "zone", cookie->zdc_zonename,
 	    BUNYAN_STRING, "owner", uuid,
@@ -308,14 +1322,122 @@ out:
 	    BUNYAN_STRING, "ssh_fp", fp,
 	    BUNYAN_INT32, "timing_us", HR_USEC(end - start),
 	    BUNYAN_NONE);
+	log_slow_request(&span, end, cookie->zdc_zonename, uuid, name, 1);
+	SMARTLOGIN_DOOR_DONE(KEY_SVC_NAME, cookie->zdc_zonename, req_id,
+	    allowed, end - start);
+	bunyan_req_id_set(NULL);
+
+	return (result);
+}
+
+
+/*
+ * KEYS_SVC_NAME: like _key_is_authorized, but for every key the client has
+ * to offer at once.  The request is "user uid fp1 fp2 ... fpN" and the
+ * answer is one '0' or '1' per fingerprint, in order, NUL terminated.
+ */
+static zdoor_result_t *
+_keys_are_authorized(zdoor_cookie_t *cookie, char *argp, size_t argp_sz)
+{
+	zdoor_result_t *result = NULL;
+	boolean_t allowed[KEYS_MAX] = { B_FALSE };
+	char fps[KEYS_MAX][FP_MAX];
+	char name[USER_MAX] = "";
+	char answer[KEYS_MAX + 1];
+	unsigned int nfps = 0;
+	unsigned int nallowed = 0;
+	unsigned int ttl = 0;
+	unsigned int i;
+	int name_len;
+	const char *uuid = NULL;
+	hrtime_t start, end, deadline = 0;
+	span_t span;
+	char req_id[BUNYAN_REQ_ID_LEN];
+
+	start = gethrtime();
+	span_init(&span, start);
+	if (g_login_deadline_ms != 0)
+		deadline = start + (hrtime_t)g_login_deadline_ms * 1000000LL;
+
+	if (cookie == NULL || argp == NULL || argp_sz == 0) {
+		bunyan_error("zdoor arguments NULL", BUNYAN_NONE);
+		return (NULL);
+	}
+
+	new_request_id(req_id, sizeof (req_id));
+	bunyan_req_id_set(req_id);
+	SMARTLOGIN_DOOR_START(KEYS_SVC_NAME, cookie->zdc_zonename, req_id);
+
+	name_len = parse_request(argp, argp_sz, name, sizeof (name), fps,
+	    KEYS_MAX, &nfps);
+	if (name_len < 0) {
+		bunyan_error("malformed request",
+		    BUNYAN_STRING, "zone", cookie->zdc_zonename,
+		    BUNYAN_INT32, "size", (int)argp_sz,
+		    BUNYAN_INT32, "max_keys", KEYS_MAX,
+		    BUNYAN_NONE);
+		goto out;
+	}
+	span.parse = gethrtime() - start;
+
+	uuid = (const char *)cookie->zdc_biscuit;
+	bunyan_debug("multi-key login attempt",
+	    BUNYAN_STRING, "zone", cookie->zdc_zonename,
+	    BUNYAN_STRING, "owner", uuid,
+	    BUNYAN_STRING, "user", name,
+	    BUNYAN_INT32, "keys", nfps,
+	    BUNYAN_NONE);
+	if (login_permitted(cookie->zdc_zonename, uuid, name, name_len,
+	    &ttl)) {
+		users_allowed_in_capi(uuid, name, fps, nfps, ttl, deadline,
+		    allowed, &span);
+	}
 
-	xfree(name);
-	xfree(fp);
+	for (i = 0; i < nfps; i++) {
+		answer[i] = (allowed[i] ? '1' : '0');
+		if (allowed[i])
+			nallowed++;
+	}
+	answer[nfps] = '\0';
+	result = door_result(answer, nfps + 1);
+out:
+	end = gethrtime();
+	bunyan_info_sampled("completed multi-key auth check",
+	    BUNYAN_INT32, "allowed", nallowed,
+	    BUNYAN_INT32, "keys", nfps,
+	    BUNYAN_STRING, "zone", cookie->zdc_zonename,
+	    BUNYAN_STRING, "owner", uuid,
+	    BUNYAN_STRING, "user", name,
+	    BUNYAN_INT32, "timing_us", HR_USEC(end - start),
+	    BUNYAN_NONE);
+	log_slow_request(&span, end, cookie->zdc_zonename, uuid, name, nfps);
+	SMARTLOGIN_DOOR_DONE(KEYS_SVC_NAME, cookie->zdc_zonename, req_id,
+	    nallowed, end - start);
+	bunyan_req_id_set(NULL);
 
 	return (result);
 }
 
 
+/*
+ * The main thread just sits here fielding signals, which every other thread
+ * has blocked (they inherit our mask).  SIGUSR1 dumps stats to the log;
+ * SIGTERM (from SMF) returns, so we can shut down cleanly.
+ */
+static void
+wait_for_signals(const sigset_t *set)
+{
+	int sig;
+
+	for (;;) {
+		sig = sigwaitinfo(set, NULL);
+		if (sig == SIGUSR1)
+			stats_report();
+		else if (sig == SIGTERM)
+			return;
+	}
+}
+
 
 int
 main(int argc, char **argv)
@@ -325,6 +1447,12 @@ main(int argc, char **argv)
 	char *cfg_file = NULL;
 	char *z = NULL;
 	char **zones = NULL;
+	sigset_t sigset;
+
+	(void) sigemptyset(&sigset);
+	(void) sigaddset(&sigset, SIGUSR1);
+	(void) sigaddset(&sigset, SIGTERM);
+	(void) pthread_sigmask(SIG_BLOCK, &sigset, NULL);
 
 	opterr = 0;
 	while ((c = getopt(argc, argv, "sf:d:")) != -1) {
@@ -367,6 +1495,14 @@ main(int argc, char **argv)
 	}
 
 	curl_global_init(CURL_GLOBAL_ALL);
+	srand48((long)gethrtime());
+	g_req_id_salt = (uint32_t)mrand48();
+
+	g_stat_stale_served = stats_counter_create("cache_stale_served");
+	g_stat_capi_waiters = stats_counter_create("capi_waiters");
+	g_stat_overloads = stats_counter_create("overloads");
+	g_stat_shed = stats_counter_create("capi_lookups_shed");
+	g_stat_user_denied = stats_counter_create("logins_user_denied");
 
 	if (cfg_file == NULL) {
 		cfg_file = getenv(CFGFILE_ENV_VAR);
@@ -377,6 +1513,8 @@ main(int argc, char **argv)
 		}
 	}
 
+	build_logging_from_config(cfg_file);
+
 	build_capi_handle_from_config(cfg_file);
 	if (g_capi_handle == NULL) {
 		bunyan_fatal("Unable to create CAPI handle",
@@ -385,12 +1523,32 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (!capi_handle_start(g_capi_handle)) {
+		bunyan_fatal("Unable to start CAPI handle", BUNYAN_NONE);
+		exit(1);
+	}
+
 	build_lru_cache_from_config(cfg_file);
 	if (g_lru_cache == NULL) {
 		bunyan_info("CAPI caching disabled", BUNYAN_NONE);
 	}
 
-	if (!register_zmon(KEY_SVC_NAME, _key_is_authorized)) {
+	build_shed_from_config(cfg_file);
+	build_rate_limits_from_config(cfg_file);
+	build_allowed_users_from_config(cfg_file);
+
+	if (g_capi_workers != 0) {
+		g_workq = workq_create(g_capi_workers, g_capi_queue_max);
+		if (g_workq == NULL) {
+			bunyan_fatal("Unable to start CAPI workers",
+			    BUNYAN_INT32, "workers", g_capi_workers,
+			    BUNYAN_NONE);
+			exit(1);
+		}
+	}
+
+	if (!add_zdoor_service(KEYS_SVC_NAME, _keys_are_authorized) ||
+	    !register_zmon(KEY_SVC_NAME, _key_is_authorized)) {
 		bunyan_fatal("unable to setup zone monitoring", BUNYAN_NONE);
 		exit(1);
 	}
@@ -403,19 +1561,15 @@ main(int argc, char **argv)
 	}
 
 	bunyan_info("smart-login started", BUNYAN_NONE);
-	(void) pause();
+	wait_for_signals(&sigset);
 	bunyan_info("smart-login shutting down", BUNYAN_NONE);
 
-	i = 0;
-	z = zones[0];
-	while (z != NULL) {
-		close_zdoor(z);
-		xfree(z);
-		z = zones[++i];
-	}
-	xfree(zones);
-	lru_cache_destroy(g_lru_cache);
-	curl_global_cleanup();
-
-	return (0);
+	/*
+	 * Door calls, the zone monitor and the endpoint prober are all still
+	 * running, and there's no stopping all of them, so free nothing they
+	 * might be using: just get the log out and go.
+	 */
+	bunyan_info("smart-login stopped", BUNYAN_NONE);
+	bunyan_async_stop();
+	_exit(0);
 }
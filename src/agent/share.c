@@ -0,0 +1,120 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <pthread.h>
+
+#include <curl/curl.h>
+
+#include "bunyan.h"
+#include "share.h"
+#include "util.h"
+
+static CURLSH *g_share = NULL;
+static long g_share_dns_ttl = 60;
+/* One lock per kind of shared data, so DNS and TLS don't contend */
+static pthread_rwlock_t g_share_locks[CURL_LOCK_DATA_LAST];
+
+
+static void
+share_lock(CURL *curl, curl_lock_data data, curl_lock_access access,
+		void *arg)
+{
+	if (access == CURL_LOCK_ACCESS_SHARED)
+		(void) pthread_rwlock_rdlock(&g_share_locks[data]);
+	else
+		(void) pthread_rwlock_wrlock(&g_share_locks[data]);
+}
+
+
+static void
+share_unlock(CURL *curl, curl_lock_data data, void *arg)
+{
+	(void) pthread_rwlock_unlock(&g_share_locks[data]);
+}
+
+
+static void
+share_data(curl_lock_data data, const char *name)
+{
+	CURLSHcode rc;
+
+	rc = curl_share_setopt(g_share, CURLSHOPT_SHARE, data);
+	if (rc != CURLSHE_OK) {
+		bunyan_info("share_init: libcurl can't share this",
+		    BUNYAN_STRING, "data", name,
+		    BUNYAN_STRING, "error", curl_share_strerror(rc),
+		    BUNYAN_NONE);
+	}
+}
+
+
+boolean_t
+share_init(unsigned int dns_ttl)
+{
+	int i;
+
+	if (g_share != NULL)
+		return (B_TRUE);
+
+	g_share = curl_share_init();
+	if (g_share == NULL) {
+		bunyan_error("share_init: unable to create share handle",
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		(void) pthread_rwlock_init(&g_share_locks[i], NULL);
+	g_share_dns_ttl = dns_ttl;
+
+	(void) curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, share_lock);
+	(void) curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	share_data(CURL_LOCK_DATA_DNS, "dns");
+	share_data(CURL_LOCK_DATA_SSL_SESSION, "ssl_session");
+	share_data(CURL_LOCK_DATA_CONNECT, "connect");
+
+	return (B_TRUE);
+}
+
+
+void
+share_fini(void)
+{
+	int i;
+
+	if (g_share == NULL)
+		return;
+
+	(void) curl_share_cleanup(g_share);
+	g_share = NULL;
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		(void) pthread_rwlock_destroy(&g_share_locks[i]);
+}
+
+
+void
+share_attach(CURL *curl, boolean_t refresh)
+{
+	if (curl == NULL) {
+		bunyan_debug("share_attach: NULL arguments", BUNYAN_NONE);
+		return;
+	}
+
+	if (g_share == NULL) {
+		/* Each handle has its own cache, so it may as well expire */
+		curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT,
+		    g_share_dns_ttl);
+		return;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_SHARE, g_share);
+	curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT,
+	    refresh ? g_share_dns_ttl : -1L);
+}
@@ -0,0 +1,58 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef SHARE_H_
+#define	SHARE_H_
+
+#include <curl/curl.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A process-wide curl share handle, so that every CAPI request (on any
+ * thread) reuses resolved addresses, TLS sessions and, where libcurl
+ * supports it, open connections, instead of starting cold each time.
+ *
+ * DNS entries are kept fresh off the login path: handles attached with
+ * `refresh` set (the endpoint prober) expire entries older than the TTL and
+ * re-resolve them, while login requests use whatever is cached and never
+ * resolve a name that's already known.
+ */
+
+/**
+ * Creates the share handle.  Safe to call more than once.
+ *
+ * @param dns_ttl seconds before a cached address is re-resolved
+ * @return boolean
+ */
+extern boolean_t share_init(unsigned int dns_ttl);
+
+/**
+ * Frees the share handle.  No attached easy handle may still exist.
+ */
+extern void share_fini(void);
+
+/**
+ * Attaches an easy handle to the share handle, if there is one.
+ *
+ * @param curl
+ * @param refresh whether this handle should re-resolve stale DNS entries
+ *	(the background refresher, or anything when there isn't one)
+ */
+extern void share_attach(CURL *curl, boolean_t refresh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHARE_H_ */
@@ -0,0 +1,71 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "span.h"
+#include "util.h"
+
+
+void
+span_init(span_t *span, hrtime_t start)
+{
+	(void) memset(span, 0, sizeof (span_t));
+	span->start = start;
+}
+
+
+span_attempt_t *
+span_attempt(span_t *span)
+{
+	span_attempt_t *attempt = NULL;
+
+	if (span == NULL)
+		return (NULL);
+
+	if (span->nattempts < SPAN_ATTEMPTS_MAX) {
+		attempt = &span->attempts[span->nattempts];
+		(void) memset(attempt, 0, sizeof (span_attempt_t));
+	}
+	span->nattempts++;
+
+	return (attempt);
+}
+
+
+char *
+span_format_attempts(const span_t *span, char *buf, size_t len)
+{
+	const span_attempt_t *a = NULL;
+	unsigned int i;
+	size_t off = 0;
+	int n;
+
+	if (len == 0)
+		return (buf);
+	buf[0] = '\0';
+
+	for (i = 0; i < span->nattempts && i < SPAN_ATTEMPTS_MAX; i++) {
+		a = &span->attempts[i];
+		n = snprintf(buf + off, len - off,
+		    "%s%u:backoff=%dus,dns=%dus,connect=%dus,tls=%dus,"
+		    "transfer=%dus,total=%dus,res=%d,http_code=%ld%s",
+		    (i == 0 ? "" : ";"), i + 1, HR_USEC(a->backoff),
+		    HR_USEC(a->dns), HR_USEC(a->connect), HR_USEC(a->tls),
+		    HR_USEC(a->transfer), HR_USEC(a->total), a->res,
+		    a->http_code, (a->hedged ? ",hedged" : ""));
+		if (n < 0 || n >= len - off)
+			break;
+		off += n;
+	}
+
+	return (buf);
+}
@@ -0,0 +1,94 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef SPAN_H_
+#define	SPAN_H_
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Attempts we keep the details of; any more are only counted */
+#define	SPAN_ATTEMPTS_MAX	4
+
+/**
+ * Where one CAPI attempt's time went, in nanoseconds.  dns, connect, tls
+ * and transfer come from curl (so a reused connection shows no dns,
+ * connect or tls), and add up to roughly total.  backoff is how long we
+ * slept before making the attempt.
+ */
+typedef struct span_attempt {
+	hrtime_t backoff;
+	hrtime_t dns;
+	hrtime_t connect;
+	hrtime_t tls;
+	hrtime_t transfer;
+	hrtime_t total;
+	int res;
+	long http_code;
+	boolean_t hedged;
+} span_attempt_t;
+
+/**
+ * Where one door call's time went, in nanoseconds.
+ *
+ * Lives on the door thread's stack and is filled in as the call goes
+ * along, including by the CAPI worker that runs its lookup (the door
+ * thread is blocked waiting on it meanwhile).  Anything that didn't happen
+ * is left 0.
+ */
+typedef struct span {
+	hrtime_t start;
+	hrtime_t parse;
+	hrtime_t lock_wait;
+	hrtime_t cache;
+	hrtime_t queue;
+	hrtime_t limit_wait;
+	hrtime_t capi;
+	boolean_t batched;
+	unsigned int nattempts;
+	span_attempt_t attempts[SPAN_ATTEMPTS_MAX];
+} span_t;
+
+/**
+ * Starts a span.
+ *
+ * @param span
+ * @param start gethrtime() when the call came in
+ */
+extern void span_init(span_t *span, hrtime_t start);
+
+/**
+ * Counts a CAPI attempt and returns the record for its details.
+ *
+ * @param span may be NULL
+ * @return span_attempt_t, zeroed, or NULL if span is NULL or there have
+ *	already been SPAN_ATTEMPTS_MAX attempts
+ */
+extern span_attempt_t *span_attempt(span_t *span);
+
+/**
+ * Describes the attempts as a string, e.g.
+ * "1:backoff=0us,dns=0us,connect=812us,...,res=28,http_code=0;2:..."
+ *
+ * @param span
+ * @param buf
+ * @param len size of buf; the string is truncated to fit
+ * @return buf
+ */
+extern char *span_format_attempts(const span_t *span, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPAN_H_ */
@@ -0,0 +1,150 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <atomic.h>
+#include <pthread.h>
+
+#include "bunyan.h"
+#include "stats.h"
+#include "util.h"
+
+typedef struct stats_reporter_entry {
+	stats_reporter_t fn;
+	void *arg;
+	struct stats_reporter_entry *next;
+} stats_reporter_entry_t;
+
+/*
+ * Both lists are only appended to (at startup), and are walked under the
+ * lock so a report can't race a late registration.
+ */
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_counter_t *g_stats_counters = NULL;
+static stats_counter_t *g_stats_tail = NULL;
+static stats_reporter_entry_t *g_stats_reporters = NULL;
+static stats_reporter_entry_t *g_stats_reporters_tail = NULL;
+
+
+stats_counter_t *
+stats_counter_create(const char *name)
+{
+	stats_counter_t *counter = NULL;
+
+	if (name == NULL) {
+		bunyan_debug("stats_counter_create: NULL arguments",
+		    BUNYAN_NONE);
+		return (NULL);
+	}
+
+	counter = xmalloc(sizeof (stats_counter_t));
+	if (counter == NULL)
+		return (NULL);
+
+	counter->name = name;
+
+	(void) pthread_mutex_lock(&g_stats_lock);
+	if (g_stats_tail == NULL) {
+		g_stats_counters = counter;
+	} else {
+		g_stats_tail->next = counter;
+	}
+	g_stats_tail = counter;
+	(void) pthread_mutex_unlock(&g_stats_lock);
+
+	return (counter);
+}
+
+
+void
+stats_incr(stats_counter_t *counter)
+{
+	if (counter != NULL)
+		atomic_inc_64(&counter->value);
+}
+
+
+void
+stats_add(stats_counter_t *counter, int64_t delta)
+{
+	if (counter != NULL)
+		atomic_add_64(&counter->value, delta);
+}
+
+
+void
+stats_set(stats_counter_t *counter, uint64_t value)
+{
+	if (counter != NULL)
+		(void) atomic_swap_64(&counter->value, value);
+}
+
+
+uint64_t
+stats_get(stats_counter_t *counter)
+{
+	if (counter == NULL)
+		return (0);
+
+	return (atomic_add_64_nv(&counter->value, 0));
+}
+
+
+void
+stats_register_reporter(stats_reporter_t fn, void *arg)
+{
+	stats_reporter_entry_t *entry = NULL;
+
+	if (fn == NULL) {
+		bunyan_debug("stats_register_reporter: NULL arguments",
+		    BUNYAN_NONE);
+		return;
+	}
+
+	entry = xmalloc(sizeof (stats_reporter_entry_t));
+	if (entry == NULL)
+		return;
+
+	entry->fn = fn;
+	entry->arg = arg;
+
+	(void) pthread_mutex_lock(&g_stats_lock);
+	if (g_stats_reporters_tail == NULL) {
+		g_stats_reporters = entry;
+	} else {
+		g_stats_reporters_tail->next = entry;
+	}
+	g_stats_reporters_tail = entry;
+	(void) pthread_mutex_unlock(&g_stats_lock);
+}
+
+
+void
+stats_report(void)
+{
+	stats_counter_t *counter = NULL;
+	stats_reporter_entry_t *entry = NULL;
+	boolean_t unlimited;
+
+	/* Stats come out once an interval anyway; never rate limit them */
+	unlimited = bunyan_unlimited(B_TRUE);
+	(void) pthread_mutex_lock(&g_stats_lock);
+	for (counter = g_stats_counters; counter != NULL;
+	    counter = counter->next) {
+		bunyan_info("stats",
+		    BUNYAN_STRING, "stat", counter->name,
+		    BUNYAN_INT64, "value", (int64_t)stats_get(counter),
+		    BUNYAN_NONE);
+	}
+
+	for (entry = g_stats_reporters; entry != NULL; entry = entry->next)
+		entry->fn(entry->arg);
+	(void) pthread_mutex_unlock(&g_stats_lock);
+	(void) bunyan_unlimited(unlimited);
+}
@@ -0,0 +1,98 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef STATS_H_
+#define	STATS_H_
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A named, process-wide counter (or gauge).
+ *
+ * Counters are created once at startup and then updated lock-free from any
+ * thread.  stats_report() dumps all of them as bunyan records; the agent
+ * calls it on SIGUSR1.
+ */
+typedef struct stats_counter {
+	const char *name;
+	volatile uint64_t value;
+	struct stats_counter *next;
+} stats_counter_t;
+
+/**
+ * Callback used by modules that have more to say than a flat counter
+ * (e.g., per-owner tables).  Invoked from stats_report().
+ */
+typedef void (*stats_reporter_t)(void *arg);
+
+/**
+ * Creates and registers a counter.
+ *
+ * The name is not copied, so pass a string literal.  Counters live for the
+ * lifetime of the process.
+ *
+ * @param name
+ * @return counter, or NULL on error (all stats_* calls accept NULL)
+ */
+extern stats_counter_t *stats_counter_create(const char *name);
+
+/**
+ * Atomically adds one to a counter.
+ *
+ * @param counter
+ */
+extern void stats_incr(stats_counter_t *counter);
+
+/**
+ * Atomically adds delta (which may be negative) to a counter.
+ *
+ * @param counter
+ * @param delta
+ */
+extern void stats_add(stats_counter_t *counter, int64_t delta);
+
+/**
+ * Sets a gauge to an absolute value.
+ *
+ * @param counter
+ * @param value
+ */
+extern void stats_set(stats_counter_t *counter, uint64_t value);
+
+/**
+ * Reads the current value of a counter.
+ *
+ * @param counter
+ * @return value
+ */
+extern uint64_t stats_get(stats_counter_t *counter);
+
+/**
+ * Registers a callback to be run on every stats_report().
+ *
+ * @param fn
+ * @param arg passed through to fn
+ */
+extern void stats_register_reporter(stats_reporter_t fn, void *arg);
+
+/**
+ * Emits every counter, then runs every reporter.
+ */
+extern void stats_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H_ */
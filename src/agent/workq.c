@@ -0,0 +1,296 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include "bunyan.h"
+#include "stats.h"
+#include "util.h"
+#include "workq.h"
+
+static stats_counter_t *g_stat_queued = NULL;
+static stats_counter_t *g_stat_full = NULL;
+static stats_counter_t *g_stat_expired = NULL;
+
+
+/* Whether a should run before b */
+static boolean_t
+workq_before(workq_job_t *a, workq_job_t *b)
+{
+	if (a->priority != b->priority)
+		return (a->priority < b->priority);
+	if (a->deadline != b->deadline) {
+		/* No deadline sorts last */
+		if (a->deadline == 0 || b->deadline == 0)
+			return (b->deadline == 0);
+		return (a->deadline < b->deadline);
+	}
+	return (a->seq < b->seq);
+}
+
+
+/* Caller holds wq->lock */
+static void
+workq_swap(workq_t *wq, unsigned int i, unsigned int j)
+{
+	workq_job_t *tmp = wq->heap[i];
+
+	wq->heap[i] = wq->heap[j];
+	wq->heap[j] = tmp;
+	wq->heap[i]->index = i;
+	wq->heap[j]->index = j;
+}
+
+
+/* Caller holds wq->lock */
+static void
+workq_sift(workq_t *wq, unsigned int i)
+{
+	unsigned int child;
+
+	while (i > 0 && workq_before(wq->heap[i], wq->heap[(i - 1) / 2])) {
+		workq_swap(wq, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= wq->count)
+			break;
+		if (child + 1 < wq->count &&
+		    workq_before(wq->heap[child + 1], wq->heap[child]))
+			child++;
+		if (!workq_before(wq->heap[child], wq->heap[i]))
+			break;
+		workq_swap(wq, i, child);
+		i = child;
+	}
+}
+
+
+/* Caller holds wq->lock */
+static void
+workq_remove(workq_t *wq, workq_job_t *job)
+{
+	unsigned int i = job->index;
+
+	wq->count--;
+	if (i != wq->count) {
+		wq->heap[i] = wq->heap[wq->count];
+		wq->heap[i]->index = i;
+		workq_sift(wq, i);
+	}
+	job->index = -1;
+}
+
+
+static void *
+workq_worker(void *arg)
+{
+	workq_t *wq = arg;
+	workq_job_t *job = NULL;
+
+	(void) pthread_mutex_lock(&wq->lock);
+	for (;;) {
+		while (wq->running && wq->count == 0)
+			(void) pthread_cond_wait(&wq->work_cv, &wq->lock);
+		if (!wq->running)
+			break;
+
+		job = wq->heap[0];
+		workq_remove(wq, job);
+
+		if (job->deadline == 0 || gethrtime() < job->deadline) {
+			(void) pthread_mutex_unlock(&wq->lock);
+			job->fn(job->arg);
+			(void) pthread_mutex_lock(&wq->lock);
+			job->ran = B_TRUE;
+		}
+		job->done = B_TRUE;
+		(void) pthread_cond_broadcast(&wq->done_cv);
+	}
+	(void) pthread_mutex_unlock(&wq->lock);
+
+	return (NULL);
+}
+
+
+workq_t *
+workq_create(unsigned int nthreads, unsigned int queue_max)
+{
+	workq_t *wq = NULL;
+	unsigned int i;
+
+	if (nthreads == 0 || queue_max == 0) {
+		bunyan_debug("workq_create: NULL arguments", BUNYAN_NONE);
+		return (NULL);
+	}
+
+	wq = xmalloc(sizeof (workq_t));
+	if (wq == NULL)
+		return (NULL);
+
+	(void) pthread_mutex_init(&wq->lock, NULL);
+	(void) pthread_cond_init(&wq->work_cv, NULL);
+	(void) pthread_cond_init(&wq->done_cv, NULL);
+	wq->max = queue_max;
+	wq->heap = xcalloc(queue_max, sizeof (workq_job_t *));
+	wq->threads = xcalloc(nthreads, sizeof (pthread_t));
+	if (wq->heap == NULL || wq->threads == NULL) {
+		workq_destroy(wq);
+		return (NULL);
+	}
+
+	if (g_stat_queued == NULL) {
+		g_stat_queued = stats_counter_create("workq_queued");
+		g_stat_full = stats_counter_create("workq_full");
+		g_stat_expired = stats_counter_create("workq_expired");
+	}
+
+	wq->running = B_TRUE;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&wq->threads[i], NULL, workq_worker,
+		    wq) != 0) {
+			bunyan_error("workq_create: unable to start thread",
+			    BUNYAN_INT32, "errno", errno,
+			    BUNYAN_NONE);
+			workq_destroy(wq);
+			return (NULL);
+		}
+		wq->nthreads++;
+	}
+
+	return (wq);
+}
+
+
+void
+workq_destroy(workq_t *wq)
+{
+	unsigned int i;
+
+	if (wq == NULL)
+		return;
+
+	(void) pthread_mutex_lock(&wq->lock);
+	wq->running = B_FALSE;
+	while (wq->count > 0) {
+		wq->heap[0]->done = B_TRUE;
+		workq_remove(wq, wq->heap[0]);
+	}
+	(void) pthread_cond_broadcast(&wq->work_cv);
+	(void) pthread_cond_broadcast(&wq->done_cv);
+	(void) pthread_mutex_unlock(&wq->lock);
+
+	for (i = 0; i < wq->nthreads; i++)
+		(void) pthread_join(wq->threads[i], NULL);
+
+	(void) pthread_cond_destroy(&wq->done_cv);
+	(void) pthread_cond_destroy(&wq->work_cv);
+	(void) pthread_mutex_destroy(&wq->lock);
+	xfree(wq->threads);
+	xfree(wq->heap);
+	xfree(wq);
+}
+
+
+boolean_t
+workq_submit(workq_t *wq, workq_job_t *job)
+{
+	if (wq == NULL || job == NULL || job->fn == NULL) {
+		bunyan_debug("workq_submit: NULL arguments", BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	job->done = B_FALSE;
+	job->ran = B_FALSE;
+
+	(void) pthread_mutex_lock(&wq->lock);
+	if (!wq->running || wq->count >= wq->max) {
+		(void) pthread_mutex_unlock(&wq->lock);
+		stats_incr(g_stat_full);
+		return (B_FALSE);
+	}
+
+	job->seq = wq->seq++;
+	job->index = wq->count;
+	wq->heap[wq->count++] = job;
+	workq_sift(wq, job->index);
+	(void) pthread_cond_signal(&wq->work_cv);
+	(void) pthread_mutex_unlock(&wq->lock);
+	stats_incr(g_stat_queued);
+
+	return (B_TRUE);
+}
+
+
+workq_status_t
+workq_wait(workq_t *wq, workq_job_t *job)
+{
+	workq_status_t status = WORKQ_DONE;
+	struct timespec ts;
+	hrtime_t remaining;
+	int rc = 0;
+
+	if (wq == NULL || job == NULL) {
+		bunyan_debug("workq_wait: NULL arguments", BUNYAN_NONE);
+		return (WORKQ_EXPIRED);
+	}
+
+	if (job->deadline != 0) {
+		remaining = job->deadline - gethrtime();
+		if (remaining < 0)
+			remaining = 0;
+		(void) clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += remaining / 1000000000LL;
+		ts.tv_nsec += (long)(remaining % 1000000000LL);
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+
+	/*
+	 * Wait for a worker to finish with us.  If our deadline passes while
+	 * we're still queued, take ourselves out; once a worker has picked
+	 * us up we have to wait for it regardless.
+	 */
+	(void) pthread_mutex_lock(&wq->lock);
+	while (!job->done) {
+		if (rc == ETIMEDOUT && job->index != -1) {
+			workq_remove(wq, job);
+			job->done = B_TRUE;
+		} else if (job->deadline != 0 && rc != ETIMEDOUT) {
+			rc = pthread_cond_timedwait(&wq->done_cv, &wq->lock,
+			    &ts);
+		} else {
+			(void) pthread_cond_wait(&wq->done_cv, &wq->lock);
+		}
+	}
+	(void) pthread_mutex_unlock(&wq->lock);
+
+	if (!job->ran) {
+		stats_incr(g_stat_expired);
+		status = WORKQ_EXPIRED;
+	}
+
+	return (status);
+}
+
+
+workq_status_t
+workq_run(workq_t *wq, workq_job_t *job)
+{
+	if (!workq_submit(wq, job))
+		return (WORKQ_FULL);
+
+	return (workq_wait(wq, job));
+}
@@ -0,0 +1,119 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+#ifndef WORKQ_H_
+#define	WORKQ_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Priority classes; lower runs first */
+#define	WORKQ_PRI_HIGH	0
+#define	WORKQ_PRI_LOW	1
+
+typedef enum workq_status {
+	WORKQ_DONE = 0,
+	WORKQ_FULL,
+	WORKQ_EXPIRED
+} workq_status_t;
+
+typedef void (*workq_fn_t)(void *arg);
+
+/**
+ * One unit of work.  Owned by the submitter (typically on its stack);
+ * fill in fn, arg, priority and deadline before workq_run().
+ */
+typedef struct workq_job {
+	workq_fn_t fn;
+	void *arg;
+	int priority;
+	hrtime_t deadline;
+	uint64_t seq;
+	int index;
+	boolean_t done;
+	boolean_t ran;
+} workq_job_t;
+
+/**
+ * A fixed pool of worker threads fed from a bounded priority queue.
+ *
+ * Jobs run in order of priority class, then earliest deadline, then
+ * arrival.  A job still queued at its deadline is dropped rather than run
+ * late.
+ */
+typedef struct workq {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cv;
+	pthread_cond_t done_cv;
+	workq_job_t **heap;
+	unsigned int count;
+	unsigned int max;
+	pthread_t *threads;
+	unsigned int nthreads;
+	boolean_t running;
+	uint64_t seq;
+} workq_t;
+
+/**
+ * Creates a pool and starts its threads.
+ *
+ * @param nthreads
+ * @param queue_max most jobs waiting for a thread at once
+ * @return workq_t on success, NULL on error
+ */
+extern workq_t *workq_create(unsigned int nthreads, unsigned int queue_max);
+
+/**
+ * Stops and joins the threads and frees the pool.  Jobs still queued come
+ * back WORKQ_EXPIRED.
+ *
+ * @param wq
+ */
+extern void workq_destroy(workq_t *wq);
+
+/**
+ * Queues a job without waiting for it.  Every job accepted must be
+ * collected with workq_wait() before it goes out of scope.
+ *
+ * @param wq
+ * @param job
+ * @return B_TRUE if queued, B_FALSE if the queue was full
+ */
+extern boolean_t workq_submit(workq_t *wq, workq_job_t *job);
+
+/**
+ * Blocks until a submitted job has run, or its deadline has passed with
+ * the job still queued (in which case it's dropped).
+ *
+ * @param wq
+ * @param job
+ * @return WORKQ_DONE once job->fn has run; WORKQ_EXPIRED otherwise
+ */
+extern workq_status_t workq_wait(workq_t *wq, workq_job_t *job);
+
+/**
+ * Queues a job and blocks until it has run.
+ *
+ * @param wq
+ * @param job
+ * @return WORKQ_DONE once job->fn has run; WORKQ_FULL if the queue was
+ *	full; WORKQ_EXPIRED if the deadline passed before a thread got to it
+ */
+extern workq_status_t workq_run(workq_t *wq, workq_job_t *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKQ_H_ */
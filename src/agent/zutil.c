@@ -6,6 +6,7 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #include <errno.h>
@@ -17,6 +18,8 @@
 #include <zone.h>
 
 #include "bunyan.h"
+#include "lockprof.h"
+#include "probes.h"
 #include "util.h"
 #include "zutil.h"
 
@@ -31,10 +34,19 @@ extern void * zonecfg_notify_bind(int(*func)(const char *zonename,
 extern void zonecfg_notify_unbind(void *handle);
 
 
-static char *g_zdoor_service_name = NULL;
-static zdoor_callback g_zdoor_callback = NULL;
+/* Most door services we open in each zone */
+#define	ZDOOR_MAX_SERVICES	4
+
+typedef struct zdoor_service {
+	char *name;
+	zdoor_callback callback;
+	boolean_t optional;
+} zdoor_service_t;
+
+static zdoor_service_t g_zdoor_services[ZDOOR_MAX_SERVICES];
+static unsigned int g_zdoor_nservices = 0;
 static zdoor_handle_t g_zdoor_handle = 0;
-static pthread_mutex_t g_zdoor_lock = PTHREAD_MUTEX_INITIALIZER;
+static lockprof_t g_zdoor_lock = LOCKPROF_INITIALIZER("g_zdoor_lock");
 static void *g_zdoor_tree = NULL;
 static void *g_zonecfg_handle = NULL;
 
@@ -79,17 +91,74 @@ zone_monitor(const char *zonename, zoneid_t zid, const char *newstate,
 }
 
 
+/*
+ * Closes the services' doors in a zone whose bit is set in mask (bit i is
+ * g_zdoor_services[i]).  Caller holds g_zdoor_lock.
+ */
+static void
+close_zdoor_services(const char *zone, uint_t mask)
+{
+	unsigned int i;
+	char *owner = NULL;
+
+	for (i = 0; i < g_zdoor_nservices; i++) {
+		if ((mask & (1U << i)) == 0)
+			continue;
+		owner = zdoor_close(g_zdoor_handle, zone,
+		    g_zdoor_services[i].name);
+		SMARTLOGIN_ZDOOR_CLOSE(zone, g_zdoor_services[i].name);
+		if (owner != NULL)
+			xfree(owner);
+	}
+}
+
+
+/*
+ * Opens one service's door in a zone.  Caller holds g_zdoor_lock.
+ */
+static boolean_t
+open_zdoor_service(const char *zone, const char *owner, zdoor_service_t *svc)
+{
+	char *biscuit = NULL;
+
+	/*
+	 * Every door gets its own copy of the owner as its biscuit, since
+	 * zdoor_close() hands each one back for us to free.
+	 */
+	biscuit = xstrdup(owner);
+	if (biscuit == NULL)
+		return (B_FALSE);
+
+	if (zdoor_open(g_zdoor_handle, zone, svc->name, biscuit,
+			svc->callback) != ZDOOR_OK) {
+		xfree(biscuit);
+		return (B_FALSE);
+	}
+
+	bunyan_debug("opened door",
+	    BUNYAN_STRING, "service_name", svc->name,
+	    BUNYAN_STRING, "zone", zone,
+	    BUNYAN_NONE);
+	SMARTLOGIN_ZDOOR_OPEN(zone, svc->name);
+	return (B_TRUE);
+}
+
+
 boolean_t
 open_zdoor(const char *zone)
 {
 	boolean_t success = B_FALSE;
+	boolean_t optional = B_FALSE;
+	unsigned int i;
+	uint_t opened = 0;
 	char *owner = NULL;
 	char *entry = NULL;
+	zdoor_service_t *svc = NULL;
 
 	if (zone == NULL)
 		return (B_FALSE);
 
-	(void) pthread_mutex_lock(&g_zdoor_lock);
+	lockprof_lock(&g_zdoor_lock, "open_zdoor");
 
 	if (tfind(zone, &g_zdoor_tree, _tsearch_compare) != NULL) {
 		bunyan_debug("zone already has an open door",
@@ -100,35 +169,52 @@ open_zdoor(const char *zone)
 	}
 
 	owner = get_owner_uuid(zone);
-	if (owner != NULL) {
-		if (zdoor_open(g_zdoor_handle, zone, g_zdoor_service_name,
-				owner, g_zdoor_callback) != ZDOOR_OK) {
+	if (owner == NULL)
+		goto out;
 
+	/*
+	 * Required services (the one given to register_zmon) go first, so a
+	 * zone that can't have them gets nothing.  An optional service that
+	 * fails to open is logged and skipped: the zone keeps working through
+	 * the required door, the same as before the optional one existed.
+	 */
+	do {
+		for (i = 0; i < g_zdoor_nservices; i++) {
+			svc = &g_zdoor_services[i];
+			if (svc->optional != optional)
+				continue;
+			if (open_zdoor_service(zone, owner, svc)) {
+				opened |= 1U << i;
+				continue;
+			}
+			if (optional) {
+				bunyan_warn("failed to open optional door "
+				    "to zone",
+				    BUNYAN_STRING, "service_name", svc->name,
+				    BUNYAN_STRING, "zone", zone,
+				    BUNYAN_NONE);
+				continue;
+			}
 			bunyan_error("failed to open door to zone",
-			    BUNYAN_STRING, "service_name",
-			    g_zdoor_service_name,
+			    BUNYAN_STRING, "service_name", svc->name,
 			    BUNYAN_STRING, "zone", zone,
 			    BUNYAN_NONE);
+			close_zdoor_services(zone, opened);
 			goto out;
-		} else {
-			bunyan_debug("opened door",
-			    BUNYAN_STRING, "service_name",
-			    g_zdoor_service_name,
-			    BUNYAN_STRING, "zone", zone,
-			    BUNYAN_NONE);
-			entry = xstrdup(zone);
-			if (entry == NULL) {
-				zdoor_close(g_zdoor_handle, zone,
-					    g_zdoor_service_name);
-				xfree(owner);
-				goto out;
-			}
-			(void) tsearch(entry, &g_zdoor_tree, _tsearch_compare);
-			success = B_TRUE;
 		}
+		optional = !optional;
+	} while (optional);
+
+	entry = xstrdup(zone);
+	if (entry == NULL) {
+		close_zdoor_services(zone, opened);
+		goto out;
 	}
+	(void) tsearch(entry, &g_zdoor_tree, _tsearch_compare);
+	success = B_TRUE;
 out:
-	(void) pthread_mutex_unlock(&g_zdoor_lock);
+	lockprof_unlock(&g_zdoor_lock);
+	xfree(owner);
 	return (success);
 }
 
@@ -138,28 +224,65 @@ close_zdoor(const char *zone)
 {
 	boolean_t success = B_FALSE;
 	char **entry = NULL;
-	char *owner = NULL;
 
 	if (zone == NULL)
 		return (B_FALSE);
 
-	(void) pthread_mutex_lock(&g_zdoor_lock);
+	lockprof_lock(&g_zdoor_lock, "close_zdoor");
 	entry = (char **)tfind(zone, &g_zdoor_tree, _tsearch_compare);
 	if (entry != NULL && *entry != NULL) {
-		owner = zdoor_close(g_zdoor_handle, zone, g_zdoor_service_name);
-		if (owner != NULL)
-			xfree(owner);
+		close_zdoor_services(zone, ~0U);
 
 		xfree(*entry);
 		(void) tdelete(zone, &g_zdoor_tree, _tsearch_compare);
 		success = B_TRUE;
 	}
 
-	(void) pthread_mutex_unlock(&g_zdoor_lock);
+	lockprof_unlock(&g_zdoor_lock);
 	return (success);
 }
 
 
+static boolean_t
+add_service(const char *service_name, zdoor_callback callback,
+    boolean_t optional)
+{
+	char *name = NULL;
+
+	if (g_zdoor_nservices >= ZDOOR_MAX_SERVICES) {
+		bunyan_error("too many door services",
+		    BUNYAN_STRING, "service_name", service_name,
+		    BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	name = xstrdup(service_name);
+	if (name == NULL)
+		return (B_FALSE);
+
+	lockprof_lock(&g_zdoor_lock, "add_zdoor_service");
+	g_zdoor_services[g_zdoor_nservices].name = name;
+	g_zdoor_services[g_zdoor_nservices].callback = callback;
+	g_zdoor_services[g_zdoor_nservices].optional = optional;
+	g_zdoor_nservices++;
+	lockprof_unlock(&g_zdoor_lock);
+
+	return (B_TRUE);
+}
+
+
+boolean_t
+add_zdoor_service(const char *service_name, zdoor_callback callback)
+{
+	if (service_name == NULL || callback == NULL) {
+		bunyan_error("add_zdoor_service: NULL arguments", BUNYAN_NONE);
+		return (B_FALSE);
+	}
+
+	return (add_service(service_name, callback, B_TRUE));
+}
+
+
 boolean_t
 register_zmon(const char *service_name, zdoor_callback callback)
 {
@@ -167,16 +290,12 @@ register_zmon(const char *service_name, zdoor_callback callback)
 		bunyan_error("register_zmon: NULL arguments", BUNYAN_NONE);
 		return (B_FALSE);
 	}
-	g_zdoor_service_name = xstrdup(service_name);
-	if (g_zdoor_service_name == NULL)
+	if (!add_service(service_name, callback, B_FALSE))
 		return (B_FALSE);
 
-	g_zdoor_callback = callback;
-
 	g_zdoor_handle = zdoor_handle_init();
 	if (g_zdoor_handle == NULL) {
 		bunyan_error("zdoor_handle_init failed", BUNYAN_NONE);
-		xfree(g_zdoor_service_name);
 		return (B_FALSE);
 	}
 
@@ -188,9 +307,13 @@ register_zmon(const char *service_name, zdoor_callback callback)
 void
 unregister_zmon()
 {
+	unsigned int i;
+
 	zonecfg_notify_unbind(g_zonecfg_handle);
 	zdoor_handle_destroy(g_zdoor_handle);
-	xfree(g_zdoor_service_name);
+	for (i = 0; i < g_zdoor_nservices; i++)
+		xfree(g_zdoor_services[i].name);
+	g_zdoor_nservices = 0;
 }
 
 
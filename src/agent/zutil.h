@@ -6,6 +6,7 @@
 
 /*
  * Copyright (c) 2014, Joyent, Inc.
+ * Copyright 2026 MNX Cloud, Inc.
  */
 
 #ifndef ZUTIL_H_
@@ -20,10 +21,24 @@ extern "C" {
 
 /*
  * The set of APIs in this header all operate on static variables, which is sort
- * of shitty, but we only have one zdoor/zone for the process, so for now it's
- * good enough.
+ * of shitty, but we only have one zone monitor for the process, so for now it's
+ * good enough.  Every zone gets the same (small) set of doors.
  */
 
+/**
+ * Adds an optional door service to open in every zone, alongside the one
+ * passed to register_zmon.  The register_zmon service is always opened
+ * first; if an optional one can't be opened in a zone, that is logged and
+ * the zone gets its other doors anyway.  Call before register_zmon, so no
+ * zone is opened without it.
+ *
+ * @param name of the zdoor to open
+ * @param callback the zdoor callback
+ * @return boolean
+ */
+extern boolean_t add_zdoor_service(const char *service_name,
+			zdoor_callback callback);
+
 /**
  * Sets up a zone_monitor that auto opens/closes zdoors
  *
@@ -45,7 +60,8 @@ extern boolean_t register_zmon(const char *service_name,
 extern void unregister_zmon();
 
 /**
- * Opens zdoor in the given zone that was setup with register_zmon
+ * Opens every registered zdoor in the given zone.  Fails, opening nothing,
+ * only if the register_zmon service can't be opened.
  *
  * @param zone
  * @return boolean
@@ -53,7 +69,7 @@ extern void unregister_zmon();
 extern boolean_t open_zdoor(const char *zone);
 
 /**
- * Closes zdoor in the given zone that was setup with register_zmon
+ * Closes every registered zdoor in the given zone
  *
  * @param zone
  * @return boolean
@@ -0,0 +1,392 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+/*
+ * blog2json turns smartlogin's binary log (see log-binary-file, and blog.h
+ * for the format) back into the bunyan JSON lines smartlogin would have
+ * written to stdout, so the usual tools (bunyan(1), json(1)) work on it:
+ *
+ *	blog2json /var/log/smartlogin.blog | bunyan
+ *
+ * With no arguments it reads stdin.  A log that ends partway through an
+ * entry (because smartlogin is still writing it) is converted up to there.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "blog.h"
+#include "bunyan.h"
+#include "nvpair_json.h"
+#include "util.h"
+
+/* Where we are in the current log */
+static char *g_name = NULL;
+static char *g_hostname = NULL;
+static unsigned long long g_pid = 0;
+static char **g_strings = NULL;
+static uint32_t g_nstrings = 0;
+
+/* Scratch space, grown as needed */
+static char *g_body = NULL;
+static size_t g_body_size = 0;
+static char *g_str = NULL;
+static size_t g_str_size = 0;
+static char *g_esc = NULL;
+static size_t g_esc_size = 0;
+
+static boolean_t
+grow(char **buf, size_t *size, size_t need)
+{
+	char *data = NULL;
+
+	if (need <= *size)
+		return (B_TRUE);
+
+	data = realloc(*buf, need);
+	if (data == NULL)
+		return (B_FALSE);
+	*buf = data;
+	*size = need;
+
+	return (B_TRUE);
+}
+
+static uint64_t
+get_le(const unsigned char *p, int n)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = n - 1; i >= 0; i--)
+		v = (v << 8) | p[i];
+
+	return (v);
+}
+
+static boolean_t
+get_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+	int shift;
+
+	*v = 0;
+	for (shift = 0; *p < end && shift < 64; shift += 7) {
+		*v |= (uint64_t)(**p & 0x7f) << shift;
+		if ((*(*p)++ & 0x80) == 0)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/* Sets *str to the next len bytes, copied and NUL terminated */
+static boolean_t
+get_bytes(const unsigned char **p, const unsigned char *end, uint64_t len,
+    char **str)
+{
+	if (len > end - *p || !grow(&g_str, &g_str_size, len + 1))
+		return (B_FALSE);
+
+	(void) memcpy(g_str, *p, len);
+	g_str[len] = '\0';
+	*p += len;
+	*str = g_str;
+
+	return (B_TRUE);
+}
+
+/* Reads a string ref: an interned string's id, or 0 and the bytes */
+static boolean_t
+get_ref(const unsigned char **p, const unsigned char *end, char **str)
+{
+	uint64_t id, len;
+
+	if (!get_varint(p, end, &id))
+		return (B_FALSE);
+
+	if (id == 0) {
+		return (get_varint(p, end, &len) &&
+		    get_bytes(p, end, len, str));
+	}
+
+	if (id >= g_nstrings || g_strings[id] == NULL) {
+		(void) fprintf(stderr, "blog2json: undefined string %llu\n",
+		    (unsigned long long)id);
+		return (B_FALSE);
+	}
+	*str = g_strings[id];
+
+	return (B_TRUE);
+}
+
+static void
+print_string(const char *str)
+{
+	ssize_t n;
+
+	n = bunyan_json_escape(g_esc, g_esc_size, str);
+	if (n >= 0 && n > g_esc_size) {
+		if (!grow(&g_esc, &g_esc_size, n))
+			n = -1;
+		else
+			(void) bunyan_json_escape(g_esc, g_esc_size, str);
+	}
+
+	if (n < 0)
+		(void) fputs("\"\"", stdout);
+	else
+		(void) fwrite(g_esc, 1, n, stdout);
+}
+
+static boolean_t
+convert_file(const unsigned char *p, const unsigned char *end)
+{
+	uint64_t len;
+	char *str = NULL;
+	uint32_t i;
+
+	/* A new process; its string ids start over */
+	for (i = 0; i < g_nstrings; i++) {
+		xfree(g_strings[i]);
+		g_strings[i] = NULL;
+	}
+
+	if (!get_varint(&p, end, &len) || !get_bytes(&p, end, len, &str))
+		return (B_FALSE);
+	xfree(g_name);
+	g_name = xstrdup(str);
+
+	if (!get_varint(&p, end, &len) || !get_bytes(&p, end, len, &str))
+		return (B_FALSE);
+	xfree(g_hostname);
+	g_hostname = xstrdup(str);
+
+	return (g_name != NULL && g_hostname != NULL);
+}
+
+static boolean_t
+convert_string(uint64_t id, const unsigned char *p, const unsigned char *end)
+{
+	char **strings = NULL;
+	uint32_t n = g_nstrings;
+
+	if (id == 0 || id > BLOG_MAX_ID)
+		return (B_FALSE);
+
+	if (id >= n) {
+		while (n <= id)
+			n = (n == 0 ? 64 : n * 2);
+		strings = realloc(g_strings, n * sizeof (char *));
+		if (strings == NULL)
+			return (B_FALSE);
+		(void) memset(strings + g_nstrings, 0,
+		    (n - g_nstrings) * sizeof (char *));
+		g_strings = strings;
+		g_nstrings = n;
+	}
+
+	xfree(g_strings[id]);
+	g_strings[id] = xmalloc(end - p + 1);
+	if (g_strings[id] == NULL)
+		return (B_FALSE);
+	(void) memcpy(g_strings[id], p, end - p);
+
+	return (B_TRUE);
+}
+
+static boolean_t
+convert_record(int level, uint64_t usec, const unsigned char *p,
+    const unsigned char *end)
+{
+	char *str = NULL;
+	char timebuf[32];
+	struct tm tm;
+	time_t sec = usec / 1000000;
+	uint64_t v;
+	int type;
+
+	if (g_name == NULL) {
+		(void) fprintf(stderr, "blog2json: record before header\n");
+		return (B_FALSE);
+	}
+
+	if (gmtime_r(&sec, &tm) == NULL ||
+	    strftime(timebuf, sizeof (timebuf), "%FT%T", &tm) == 0)
+		return (B_FALSE);
+
+	(void) fputs("{\"v\":0,\"name\":", stdout);
+	print_string(g_name);
+	(void) fputs(",\"hostname\":", stdout);
+	print_string(g_hostname);
+	(void) printf(",\"pid\":%llu,\"level\":%d,\"time\":\"%s.%03dZ\","
+	    "\"msg\":", g_pid, level, timebuf, (int)(usec / 1000 % 1000));
+
+	if (!get_ref(&p, end, &str))
+		return (B_FALSE);
+	print_string(str);
+
+	while (p < end) {
+		type = *p++;
+		if (!get_ref(&p, end, &str))
+			return (B_FALSE);
+		(void) fputc(',', stdout);
+		print_string(str);
+		(void) fputc(':', stdout);
+
+		switch (type) {
+		case BUNYAN_POINTER:
+			if (!get_varint(&p, end, &v))
+				return (B_FALSE);
+			(void) printf("\"0x%llx\"", (unsigned long long)v);
+			break;
+
+		case BUNYAN_BOOLEAN:
+			if (p >= end)
+				return (B_FALSE);
+			(void) fputs(*p++ ? "true" : "false", stdout);
+			break;
+
+		case BUNYAN_STRING:
+			if (!get_varint(&p, end, &v))
+				return (B_FALSE);
+			if (v == 0) {
+				(void) fputs("null", stdout);
+				break;
+			}
+			if (!get_bytes(&p, end, v - 1, &str))
+				return (B_FALSE);
+			print_string(str);
+			break;
+
+		case BUNYAN_INT32:
+		case BUNYAN_INT64:
+			if (!get_varint(&p, end, &v))
+				return (B_FALSE);
+			/* Undo the zigzag encoding */
+			(void) printf("%lld",
+			    (long long)(v >> 1) ^ -(long long)(v & 1));
+			break;
+
+		default:
+			(void) fprintf(stderr, "blog2json: unknown field type "
+			    "%d\n", type);
+			return (B_FALSE);
+		}
+	}
+
+	(void) fputs("}\n", stdout);
+
+	return (B_TRUE);
+}
+
+static int
+convert(FILE *fp, const char *path)
+{
+	unsigned char hdr[BLOG_HDR_LEN];
+	const unsigned char *body = NULL;
+	uint64_t value;
+	uint32_t len;
+	boolean_t ok = B_FALSE;
+	struct stat st;
+	off_t size = -1;
+	off_t offset = 0;
+
+	/* For a file, we can check lengths against what's actually there */
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode))
+		size = st.st_size;
+
+	while (fread(hdr, 1, sizeof (hdr), fp) == sizeof (hdr)) {
+		if (get_le(hdr + 2, 2) != BLOG_VERSION) {
+			(void) fprintf(stderr, "%s: unsupported version %d\n",
+			    path, (int)get_le(hdr + 2, 2));
+			return (-1);
+		}
+		len = get_le(hdr + 4, 4);
+		value = get_le(hdr + 8, 8);
+
+		if (len > BLOG_MAX_LEN) {
+			(void) fprintf(stderr, "%s: entry of %u bytes at "
+			    "offset %lld is too long\n", path, len,
+			    (long long)offset);
+			return (-1);
+		}
+		/* The last entry of a log still being written may be cut off */
+		if (size >= 0 && len > size - offset - BLOG_HDR_LEN)
+			break;
+
+		if (!grow(&g_body, &g_body_size, len + 1)) {
+			(void) fprintf(stderr, "%s: out of memory\n", path);
+			return (-1);
+		}
+		if (fread(g_body, 1, len, fp) != len)
+			break;
+		body = (const unsigned char *)g_body;
+
+		switch (hdr[0]) {
+		case BLOG_FILE:
+			g_pid = value;
+			ok = convert_file(body, body + len);
+			break;
+		case BLOG_STRING:
+			ok = convert_string(value, body, body + len);
+			break;
+		case BLOG_RECORD:
+			ok = convert_record(hdr[1], value, body, body + len);
+			break;
+		default:
+			ok = B_FALSE;
+			break;
+		}
+
+		if (!ok) {
+			(void) fflush(stdout);
+			(void) fprintf(stderr, "%s: bad entry at offset %lld\n",
+			    path, (long long)offset);
+			return (-1);
+		}
+		offset += BLOG_HDR_LEN + len;
+	}
+
+	if (ferror(fp)) {
+		(void) fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *fp = NULL;
+	int rc = 0;
+	int i;
+
+	if (argc < 2)
+		return (convert(stdin, "<stdin>") == 0 ? 0 : 1);
+
+	for (i = 1; i < argc; i++) {
+		fp = fopen(argv[i], "r");
+		if (fp == NULL) {
+			(void) fprintf(stderr, "%s: %s\n", argv[i],
+			    strerror(errno));
+			rc = 1;
+			continue;
+		}
+		if (convert(fp, argv[i]) != 0)
+			rc = 1;
+		(void) fclose(fp);
+	}
+
+	return (rc);
+}
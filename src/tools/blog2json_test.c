@@ -0,0 +1,272 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright 2026 MNX Cloud, Inc.
+ */
+
+/*
+ * Logs the same records as JSON and to a small, rotating binary log, runs
+ * blog2json over the binary files, oldest first, and checks it gives back
+ * exactly the JSON (times aside, which are taken separately).  Then checks
+ * that a log whose last entry was cut off converts up to that entry.
+ *
+ *	make test	(runs blog2json_test bin/blog2json)
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/varargs.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bunyan.h"
+#include "util.h"
+
+#define	CHECK(cond)	check((cond), #cond, __LINE__)
+
+#define	RECORDS		500
+/* Small enough to rotate every few dozen records */
+#define	ROTATE_SIZE	4096
+#define	KEEP		100
+
+#define	LINE_MAX_LEN	4096
+#define	PATH_LEN	256
+#define	CMD_LEN		(PATH_LEN * (KEEP + 4))
+
+/* "time":"2026-01-01T00:00:00.000Z" */
+#define	TIME_KEY	"\"time\":\""
+#define	TIME_LEN	24
+
+static unsigned long g_failures = 0;
+static char g_dir[] = "/tmp/blog2json_test.XXXXXX";
+
+static void
+check(boolean_t ok, const char *what, int line)
+{
+	if (!ok) {
+		(void) fprintf(stderr, "blog2json_test:%d: %s\n", line, what);
+		g_failures++;
+	}
+}
+
+/* Every field type but pointers (printed differently by each libc) */
+static void
+log_records(void)
+{
+	char zone[64];
+	int i;
+
+	(void) bunyan_level(BUNYAN_DEBUG);
+	for (i = 0; i < RECORDS; i++) {
+		(void) snprintf(zone, sizeof (zone), "zone-%d", i % 7);
+		bunyan_req_id_set(i % 3 == 0 ? "c0ffee00-req" : NULL);
+		(void) bunyan_info("completed auth check",
+		    BUNYAN_STRING, "zone", zone,
+		    BUNYAN_STRING, "owner", (i % 5 == 0 ? NULL : "owner"),
+		    BUNYAN_STRING, "escaped", "quote\" bslash\\ nl\n tab\t\x01",
+		    BUNYAN_INT32, "i", i,
+		    BUNYAN_INT32, "neg", -i,
+		    BUNYAN_INT64, "big", (int64_t)-1234567890123LL * i,
+		    BUNYAN_BOOLEAN, "odd", (boolean_t)(i & 1),
+		    BUNYAN_NONE);
+		if (i % 50 == 0) {
+			(void) bunyan_debug("debug record",
+			    BUNYAN_INT32, "i", i,
+			    BUNYAN_NONE);
+			(void) bunyan_warn("", BUNYAN_NONE);
+		}
+	}
+	bunyan_req_id_set(NULL);
+}
+
+/* Blanks out the time, the one thing the two outputs can differ in */
+static void
+mask_time(char *line)
+{
+	char *t = strstr(line, TIME_KEY);
+
+	if (t != NULL && strlen(t) > sizeof (TIME_KEY) - 1 + TIME_LEN)
+		(void) memset(t + sizeof (TIME_KEY) - 1, 'x', TIME_LEN);
+}
+
+/*
+ * Compares two files of JSON lines, times aside.  Returns how many lines
+ * matched before the first difference, or -1 if it couldn't read them.
+ */
+static long
+compare(const char *want_path, const char *got_path, boolean_t *same)
+{
+	char want[LINE_MAX_LEN], got[LINE_MAX_LEN];
+	FILE *wfp = NULL, *gfp = NULL;
+	char *w, *g;
+	long n = -1;
+
+	*same = B_FALSE;
+	if ((wfp = fopen(want_path, "r")) == NULL ||
+	    (gfp = fopen(got_path, "r")) == NULL)
+		goto out;
+
+	for (n = 0; ; n++) {
+		w = fgets(want, sizeof (want), wfp);
+		g = fgets(got, sizeof (got), gfp);
+		if (w == NULL || g == NULL) {
+			*same = (w == NULL && g == NULL);
+			break;
+		}
+		mask_time(want);
+		mask_time(got);
+		if (strcmp(want, got) != 0) {
+			(void) fprintf(stderr, "blog2json_test: line %ld "
+			    "differs:\n  want: %s  got:  %s", n + 1, want, got);
+			break;
+		}
+	}
+
+out:
+	if (wfp != NULL)
+		(void) fclose(wfp);
+	if (gfp != NULL)
+		(void) fclose(gfp);
+	return (n);
+}
+
+/* Appends to a command being built up in buf */
+static void
+append(char *buf, size_t size, const char *fmt, ...)
+{
+	size_t len = strlen(buf);
+	va_list ap;
+
+	va_start(ap, fmt);
+	(void) vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+}
+
+static int
+run(const char *cmd)
+{
+	int rc = system(cmd);
+
+	if (rc == -1 || !WIFEXITED(rc))
+		return (-1);
+	return (WEXITSTATUS(rc));
+}
+
+/* Copies `from` to `to`, less the last `cut` bytes */
+static boolean_t
+copy_cut(const char *from, const char *to, off_t cut)
+{
+	char cmd[CMD_LEN];
+	struct stat st;
+
+	if (stat(from, &st) != 0 || st.st_size <= cut)
+		return (B_FALSE);
+	cmd[0] = '\0';
+	append(cmd, sizeof (cmd), "head -c %lld '%s' > '%s'",
+	    (long long)(st.st_size - cut), from, to);
+
+	return (run(cmd) == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	char json[PATH_LEN], blog[PATH_LEN], out[PATH_LEN];
+	char path[PATH_LEN + 16];
+	char cut[PATH_LEN], cut_out[PATH_LEN], cut_want[PATH_LEN];
+	char cmd[CMD_LEN];
+	struct stat st;
+	boolean_t same;
+	long lines;
+	int files, i, fd, saved;
+
+	if (argc != 2) {
+		(void) fprintf(stderr, "usage: blog2json_test <blog2json>\n");
+		return (2);
+	}
+
+	if (mkdtemp(g_dir) == NULL) {
+		perror("blog2json_test: mkdtemp");
+		return (2);
+	}
+	(void) snprintf(json, sizeof (json), "%s/log.json", g_dir);
+	(void) snprintf(blog, sizeof (blog), "%s/log.blog", g_dir);
+	(void) snprintf(out, sizeof (out), "%s/out.json", g_dir);
+
+	/* First as JSON, which goes to stdout */
+	(void) fflush(stdout);
+	if ((saved = dup(STDOUT_FILENO)) < 0 ||
+	    (fd = open(json, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+	    dup2(fd, STDOUT_FILENO) < 0) {
+		perror("blog2json_test: redirecting stdout");
+		return (2);
+	}
+	(void) close(fd);
+	log_records();
+	if (dup2(saved, STDOUT_FILENO) < 0) {
+		perror("blog2json_test: restoring stdout");
+		return (2);
+	}
+	(void) close(saved);
+
+	/* Then the same again to the binary log */
+	if (bunyan_binary_start(blog, ROTATE_SIZE, KEEP) != 0) {
+		(void) fprintf(stderr, "blog2json_test: bunyan_binary_start "
+		    "failed\n");
+		return (2);
+	}
+	log_records();
+
+	/* Convert log.blog.N .. log.blog.0, log.blog, in that order */
+	for (files = 0; files < KEEP; files++) {
+		(void) snprintf(path, sizeof (path), "%s.%d", blog, files);
+		if (stat(path, &st) != 0)
+			break;
+	}
+	CHECK(files > 2 && files < KEEP);
+	cmd[0] = '\0';
+	append(cmd, sizeof (cmd), "'%s'", argv[1]);
+	for (i = files - 1; i >= 0; i--)
+		append(cmd, sizeof (cmd), " '%s.%d'", blog, i);
+	append(cmd, sizeof (cmd), " '%s' > '%s'", blog, out);
+	CHECK(run(cmd) == 0);
+
+	lines = compare(json, out, &same);
+	CHECK(same);
+	CHECK(lines > RECORDS);
+
+	/*
+	 * Cut a few bytes off the end of the current file, as if we'd caught
+	 * the agent mid-write: it should convert, without its last record.
+	 */
+	(void) snprintf(cut, sizeof (cut), "%s/cut.blog", g_dir);
+	(void) snprintf(cut_out, sizeof (cut_out), "%s/cut.json", g_dir);
+	(void) snprintf(cut_want, sizeof (cut_want), "%s/cut_want.json",
+	    g_dir);
+	CHECK(copy_cut(blog, cut, 3));
+	cmd[0] = '\0';
+	append(cmd, sizeof (cmd), "'%s' '%s' > '%s' && '%s' '%s' | "
+	    "sed '$d' > '%s'", argv[1], cut, cut_out, argv[1], blog, cut_want);
+	CHECK(run(cmd) == 0);
+	(void) compare(cut_want, cut_out, &same);
+	CHECK(same);
+
+	if (g_failures != 0) {
+		(void) printf("blog2json_test: %lu failures (files left in "
+		    "%s)\n", g_failures, g_dir);
+		return (1);
+	}
+
+	cmd[0] = '\0';
+	append(cmd, sizeof (cmd), "rm -rf '%s'", g_dir);
+	(void) run(cmd);
+	(void) printf("blog2json_test: %ld records in %d files: ok\n", lines,
+	    files + 1);
+	return (0);
+}